@@ -1,4 +1,6 @@
 #include "apu.h"
+#include "dmg.h"
+#include <stdlib.h>
 #include <string.h>
 
 static void volume_envelope_reload(VolumeEnvelopeGenerator* self, u8 nr_2) {
@@ -9,6 +11,33 @@ static void volume_envelope_reload(VolumeEnvelopeGenerator* self, u8 nr_2) {
 	self->vol = self->init_vol;
 }
 
+static void volume_envelope_clock(VolumeEnvelopeGenerator* self) {
+	if (self->sweep_pace && ++self->cycle % self->sweep_pace == 0) {
+		if (self->increase) {
+			if (self->vol < 15) {
+				self->vol += 1;
+			}
+		}
+		else {
+			if (self->vol > 0) {
+				self->vol -= 1;
+			}
+		}
+	}
+}
+
+// Divisors selected by the low 3 bits of NR43, shifted left by its high nibble
+static const u8 NOISE_DIVISORS[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+static u32 noise_cycle_rate(u8 nr43) {
+	u8 shift = nr43 >> 4;
+	// Shifts of 14 and 15 leave the LFSR without a clock
+	if (shift >= 14) {
+		return 0;
+	}
+	return (u32) NOISE_DIVISORS[nr43 & 0b111] << shift;
+}
+
 #define NR51_CH1_RIGHT (1 << 0)
 #define NR51_CH2_RIGHT (1 << 1)
 #define NR51_CH3_RIGHT (1 << 2)
@@ -23,7 +52,214 @@ static void volume_envelope_reload(VolumeEnvelopeGenerator* self, u8 nr_2) {
 #define NR52_CH3_ON (1 << 2)
 #define NR52_CH4_ON (1 << 3)
 
-void apu_write(Apu* self, u16 addr, u8 value) {
+static const bool DUTY_TABLE[][8] = {
+	[0] = {true, true, true, true, true, true, true, false},
+	[1] = {false, true, true, true, true, true, true, false},
+	[2] = {false, true, true, true, true, false, false, false},
+	[3] = {true, false, false, false, false, false, false, true}
+};
+
+// 4 channels of -15..15 at the maximum master volume of 8
+#define AMP_MAX (15 * 4 * 8)
+
+// Digital 0-15 output of a channel
+static u8 apu_channel_output(const Apu* self, u8 channel) {
+	if (channel == 0) {
+		if (!(self->nr52 & NR52_CH1_ON) ||
+			!DUTY_TABLE[self->channel1_generator.duty_cycle][self->channel1_generator.cur_duty]) {
+			return 0;
+		}
+		return self->channel1_vol_envelope.vol;
+	}
+	else if (channel == 1) {
+		if (!(self->nr52 & NR52_CH2_ON) ||
+			!DUTY_TABLE[self->channel2_generator.duty_cycle][self->channel2_generator.cur_duty]) {
+			return 0;
+		}
+		return self->channel2_vol_envelope.vol;
+	}
+	else if (channel == 2) {
+		if (!(self->nr52 & NR52_CH3_ON)) {
+			return 0;
+		}
+		u8 vol = self->nr32 >> 5 & 0b11;
+		u8 sample = self->wave_sample >> (!(self->channel3_generator.cur_wave & 1) * 4) & 0b1111;
+		if (vol == 0) {
+			return 0;
+		}
+		return sample >> (vol - 1);
+	}
+	else {
+		// Bit 0 of the LFSR inverted
+		if (!(self->nr52 & NR52_CH4_ON) || self->channel4_generator.lfsr & 1) {
+			return 0;
+		}
+		return self->channel4_vol_envelope.vol;
+	}
+}
+
+// Adds a change of a single channel's amplitude, for when the state
+// producing it isn't materialized at that time
+static void apu_channel_delta(Apu* self, u8 channel, i32 delta, u32 time) {
+	if (self->nr51 & NR51_CH1_LEFT << channel) {
+		i32 side_delta = delta * ((self->nr50 >> 4 & 0b111) + 1);
+		blip_add_delta(&self->blip[0], time, side_delta);
+		self->level[0] += side_delta;
+	}
+	if (self->nr51 & NR51_CH1_RIGHT << channel) {
+		i32 side_delta = delta * ((self->nr50 & 0b111) + 1);
+		blip_add_delta(&self->blip[1], time, side_delta);
+		self->level[1] += side_delta;
+	}
+	if (self->stem_blip) {
+		blip_add_delta(&self->stem_blip[channel], time, delta);
+		self->stem_level[channel] += delta;
+	}
+}
+
+// Adds the change of the mixed output at time to the blip buffers
+static void apu_update_output(Apu* self, u32 time) {
+	i32 left = 0;
+	i32 right = 0;
+	for (u8 channel = 0; channel < 4; ++channel) {
+		i32 amp = self->dac_enable[channel] ? 2 * apu_channel_output(self, channel) - 15 : 0;
+		if (self->nr51 & NR51_CH1_LEFT << channel) {
+			left += amp;
+		}
+		if (self->nr51 & NR51_CH1_RIGHT << channel) {
+			right += amp;
+		}
+		if (self->stem_blip && amp != self->stem_level[channel]) {
+			blip_add_delta(&self->stem_blip[channel], time, amp - self->stem_level[channel]);
+			self->stem_level[channel] = amp;
+		}
+	}
+
+	i32 level[2] = {
+		left * ((self->nr50 >> 4 & 0b111) + 1),
+		right * ((self->nr50 & 0b111) + 1)
+	};
+	for (u8 side = 0; side < 2; ++side) {
+		if (level[side] != self->level[side]) {
+			blip_add_delta(&self->blip[side], time, level[side] - self->level[side]);
+			self->level[side] = level[side];
+		}
+	}
+}
+
+// The frame sequencer is clocked by DIV bit 12 falling
+#define FRAME_SEQ_PERIOD 0x2000
+// Frames normally end with apu_end_frame, this only keeps the blip buffers from overflowing
+#define MAX_FRAME_TIME (DMG_FRAME_CYCLES * 2)
+
+// Channels only advance when something needs their state. Each sync walks the steps
+// since the last one and adds the output changes at the times they happened.
+
+static void square_sync(Apu* self, SquareWaveGenerator* gen, u8 on_bit, u32 time) {
+	if (!(self->nr52 & on_bit) || !gen->cycle_rate) {
+		gen->last_sync = time;
+		return;
+	}
+
+	u32 remaining = gen->cur_cycle < gen->cycle_rate ? gen->cycle_rate - gen->cur_cycle : 1;
+	u32 step = gen->last_sync + remaining;
+	while (step <= time) {
+		gen->cur_duty = (gen->cur_duty + 1) & 7;
+		apu_update_output(self, step);
+		step += gen->cycle_rate;
+	}
+	gen->cur_cycle = gen->cycle_rate - (step - time);
+	gen->last_sync = time;
+}
+
+static void wave_sync(Apu* self, u32 time) {
+	WaveGenerator* gen = &self->channel3_generator;
+	if (!(self->nr52 & NR52_CH3_ON) || !gen->cycle_rate) {
+		gen->last_sync = time;
+		return;
+	}
+
+	u32 remaining = gen->cur_cycle < gen->cycle_rate ? gen->cycle_rate - gen->cur_cycle : 1;
+	u32 step = gen->last_sync + remaining;
+	while (step <= time) {
+		gen->cur_wave = (gen->cur_wave + 1) % 32;
+		self->wave_sample = self->wave_pattern[gen->cur_wave / 2];
+		apu_update_output(self, step);
+		step += gen->cycle_rate;
+	}
+	gen->cur_cycle = gen->cycle_rate - (step - time);
+	gen->last_sync = time;
+}
+
+// The LFSR can step up to 524288 times a second, so it is advanced several steps at once:
+// the next outputs are bits already in the register and the feedback bits for a whole
+// chunk only depend on the bits before it. In 15-bit mode that holds for 14 steps,
+// in 7-bit mode (feedback also goes into bit 6) for 6.
+static void noise_sync(Apu* self, u32 time) {
+	NoiseGenerator* gen = &self->channel4_generator;
+	if (!(self->nr52 & NR52_CH4_ON) || !gen->cycle_rate) {
+		gen->last_sync = time;
+		return;
+	}
+
+	u32 remaining = gen->cur_cycle < gen->cycle_rate ? gen->cycle_rate - gen->cur_cycle : 1;
+	u32 step = gen->last_sync + remaining;
+	if (step > time) {
+		gen->cur_cycle += time - gen->last_sync;
+		gen->last_sync = time;
+		return;
+	}
+
+	u32 steps = (time - step) / gen->cycle_rate + 1;
+	bool narrow = self->nr43 & 1 << 3;
+	u8 vol = self->channel4_vol_envelope.vol;
+	bool audible = self->dac_enable[3] && vol && (self->nr51 & (NR51_CH4_LEFT | NR51_CH4_RIGHT) || self->stem_blip);
+	u16 out = ~gen->lfsr & 1;
+
+	while (steps) {
+		u8 count = narrow ? 6 : 14;
+		if (steps < count) {
+			count = (u8) steps;
+		}
+		u16 mask = (1 << count) - 1;
+
+		u16 lfsr = gen->lfsr;
+		u16 feedback = (lfsr ^ lfsr >> 1) & mask;
+		u16 next = (lfsr >> count) | feedback << (15 - count);
+		if (narrow) {
+			next = (next & ~(mask << (7 - count))) | feedback << (7 - count);
+		}
+
+		if (audible) {
+			// Bit j is the output after step j + 1
+			u16 outputs = ~lfsr >> 1 & mask;
+			u16 changes = (outputs ^ (outputs << 1 | out)) & mask;
+			for (u8 j = 0; changes >> j; ++j) {
+				if (changes >> j & 1) {
+					i32 delta = outputs >> j & 1 ? 2 * vol : -2 * vol;
+					apu_channel_delta(self, 3, delta, step + j * gen->cycle_rate);
+				}
+			}
+			out = outputs >> (count - 1) & 1;
+		}
+
+		gen->lfsr = next;
+		step += count * gen->cycle_rate;
+		steps -= count;
+	}
+
+	gen->cur_cycle = gen->cycle_rate - (step - time);
+	gen->last_sync = time;
+}
+
+static void apu_sync(Apu* self, u32 time) {
+	square_sync(self, &self->channel1_generator, NR52_CH1_ON, time);
+	square_sync(self, &self->channel2_generator, NR52_CH2_ON, time);
+	wave_sync(self, time);
+	noise_sync(self, time);
+}
+
+static void apu_write_reg(Apu* self, u16 addr, u8 value) {
 	if (addr >= 0xFF30 && addr <= 0xFF3F) {
 		self->wave_pattern[addr - 0xFF30] = value;
 		return;
@@ -147,12 +383,15 @@ void apu_write(Apu* self, u16 addr, u8 value) {
 	}
 	else if (addr == 0xFF22) {
 		self->nr43 = value;
+		self->channel4_generator.cycle_rate = noise_cycle_rate(value);
 	}
 	else if (addr == 0xFF23) {
 		self->nr44 = value;
 		if (self->dac_enable[3] && value & 1 << 7) {
 			volume_envelope_reload(&self->channel4_vol_envelope, self->nr42);
 			self->nr52 |= NR52_CH4_ON;
+			self->channel4_generator.lfsr = 0x7FFF;
+			self->channel4_generator.cur_cycle = 0;
 			if (self->channel4_generator.len_timer == 64) {
 				self->channel4_generator.len_timer = 0;
 			}
@@ -168,7 +407,7 @@ void apu_write(Apu* self, u16 addr, u8 value) {
 		if (!(value & 1 << 7)) {
 			u8 saved[16];
 			memcpy(saved, self->wave_pattern, 16);
-			memset(self, 0, sizeof(Apu));
+			memset(self, 0, APU_POWER_STATE_SIZE);
 			self->enabled = false;
 			memcpy(self->wave_pattern, saved, 16);
 		}
@@ -191,62 +430,16 @@ void apu_write(Apu* self, u16 addr, u8 value) {
 	}
 }
 
-void apu_clock_channels(Apu* self) {
-	if (!self->enabled) {
-		return;
-	}
-
-	if ((self->nr52 & NR52_CH1_ON) && ++self->channel1_generator.cur_cycle == self->channel1_generator.cycle_rate) {
-		self->channel1_generator.cur_duty = (self->channel1_generator.cur_duty + 1) & 7;
-		self->channel1_generator.cur_cycle = 0;
-	}
-
-	if ((self->nr52 & NR52_CH2_ON) && ++self->channel2_generator.cur_cycle == self->channel2_generator.cycle_rate) {
-		self->channel2_generator.cur_duty = (self->channel2_generator.cur_duty + 1) & 7;
-		self->channel2_generator.cur_cycle = 0;
-	}
-
-	if ((self->nr52 & NR52_CH3_ON) && ++self->channel3_generator.cur_cycle == self->channel3_generator.cycle_rate) {
-		self->channel3_generator.cur_wave = (self->channel3_generator.cur_wave + 1) % 32;
-		self->wave_sample = self->wave_pattern[self->channel3_generator.cur_wave / 2];
-		self->channel3_generator.cur_cycle = 0;
-	}
-}
-
-void apu_clock(Apu* self) {
+static void apu_clock(Apu* self) {
 	if (!self->enabled) {
 		return;
 	}
 
 	// Envelope sweep
 	if (self->clock % 8 == 0) {
-		VolumeEnvelopeGenerator* env1 = &self->channel2_vol_envelope;
-		if (env1->sweep_pace && ++env1->cycle % env1->sweep_pace == 0) {
-			if (env1->increase) {
-				if (env1->vol < 15) {
-					env1->vol += 1;
-				}
-			}
-			else {
-				if (env1->vol > 0) {
-					env1->vol -= 1;
-				}
-			}
-		}
-
-		VolumeEnvelopeGenerator* env2 = &self->channel2_vol_envelope;
-		if (env2->sweep_pace && ++env2->cycle % env2->sweep_pace == 0) {
-			if (env2->increase) {
-				if (env2->vol < 15) {
-					env2->vol += 1;
-				}
-			}
-			else {
-				if (env2->vol > 0) {
-					env2->vol -= 1;
-				}
-			}
-		}
+		volume_envelope_clock(&self->channel1_vol_envelope);
+		volume_envelope_clock(&self->channel2_vol_envelope);
+		volume_envelope_clock(&self->channel4_vol_envelope);
 	}
 
 	// Sound length
@@ -318,100 +511,204 @@ void apu_clock(Apu* self) {
 	self->clock += 1;
 }
 
-static bool DUTY_TABLE[][8] = {
-	[0] = {true, true, true, true, true, true, true, false},
-	[1] = {false, true, true, true, true, true, true, false},
-	[2] = {false, true, true, true, true, false, false, false},
-	[3] = {true, false, false, false, false, false, false, true}
-};
+// Without output the channel generators are left alone, nothing register-visible depends on
+// them: lengths, sweep and NR52 live in apu_clock and apu_write_reg, wave RAM is never locked
+static void apu_frame_seq_step(Apu* self, u32 time) {
+	if (!self->output_enabled) {
+		apu_clock(self);
+		return;
+	}
+	apu_sync(self, time);
+	apu_clock(self);
+	apu_update_output(self, time);
+}
 
-static f32 left_capacitor = 0;
-f32 do_high_pass_left(f32 in) {
-	f32 out = in - left_capacitor;
-	left_capacitor = in - out * 0.999958f;
-	return out;
+void apu_write(Apu* self, u16 addr, u8 value) {
+	if (!self->output_enabled) {
+		apu_write_reg(self, addr, value);
+		return;
+	}
+	apu_sync(self, self->time);
+	apu_write_reg(self, addr, value);
+	apu_update_output(self, self->time);
 }
 
-static f32 right_capacitor = 0;
-f32 do_high_pass_right(f32 in) {
-	f32 out = in - right_capacitor;
-	right_capacitor = in - out * 0.999958f;
-	return out;
+void apu_reset(Apu* self) {
+	self->next_frame_seq = FRAME_SEQ_PERIOD;
+	self->output_enabled = true;
+	apu_set_sample_rate(self, APU_NATIVE_RATE);
 }
 
-void apu_gen_sample(Apu* self, f32 out[2]) {
-	f32 left = 0;
-	f32 right = 0;
+// For headless and muted runs. Turning it back on resumes the channels from where they
+// were when it was turned off, as if their generators had been stopped meanwhile.
+void apu_set_output_enabled(Apu* self, bool enabled) {
+	if (enabled == self->output_enabled) {
+		return;
+	}
 
-	if (self->nr52 & NR52_CH1_ON) {
-		u8 vol = self->channel1_vol_envelope.vol;
-		if (vol && DUTY_TABLE[self->channel1_generator.duty_cycle][self->channel1_generator.cur_duty]) {
-			f32 amp = 2.0f / 15.0f * (f32) vol;
-			if (amp < 1) {
-				amp *= -1;
-			}
-			else {
-				amp -= 1;
-			}
-			if (self->nr51 & NR51_CH1_LEFT) {
-				left += amp;
-			}
-			if (self->nr51 & NR51_CH1_RIGHT) {
-				right += amp;
-			}
-		}
+	self->output_enabled = enabled;
+	self->channel1_generator.last_sync = self->time;
+	self->channel2_generator.last_sync = self->time;
+	self->channel3_generator.last_sync = self->time;
+	self->channel4_generator.last_sync = self->time;
+	for (u8 i = 0; i < 2; ++i) {
+		blip_clear(&self->blip[i]);
+		self->level[i] = 0;
+		self->capacitor[i] = 0;
+	}
+	for (u8 i = 0; self->stem_blip && i < 4; ++i) {
+		blip_clear(&self->stem_blip[i]);
+		self->stem_level[i] = 0;
+		self->stem_capacitor[i] = 0;
+	}
+	if (enabled) {
+		apu_update_output(self, self->time);
 	}
-	if (self->nr52 & NR52_CH2_ON) {
-		u8 vol = self->channel2_vol_envelope.vol;
-		if (vol && DUTY_TABLE[self->channel2_generator.duty_cycle][self->channel2_generator.cur_duty]) {
-			f32 amp = 2.0f / 15.0f * (f32) vol;
-			if (amp < 1) {
-				amp *= -1;
-			}
-			else {
-				amp -= 1;
-			}
-			if (self->nr51 & NR51_CH2_LEFT) {
-				left += amp;
-			}
-			if (self->nr51 & NR51_CH2_RIGHT) {
-				right += amp;
-			}
+}
+
+// Called once per M-cycle, everything else happens when it is needed
+void apu_advance(Apu* self, u32 cycles) {
+	self->time += cycles;
+	if (self->time >= self->next_frame_seq) {
+		apu_frame_seq_step(self, self->next_frame_seq);
+		self->next_frame_seq += FRAME_SEQ_PERIOD;
+		if (self->time >= MAX_FRAME_TIME) {
+			apu_end_frame(self);
 		}
 	}
+}
 
-	if (self->nr52 & NR52_CH3_ON) {
-		u8 vol = self->nr32 >> 5 & 0b11;
-		u8 sample = self->wave_sample >> (!(self->channel3_generator.cur_wave & 1) * 4) & 0b1111;
-		if (vol == 0b10) {
-			sample >>= 1;
+// Resetting DIV restarts the sequencer period, and clocks it if bit 12 was set
+void apu_div_reset(Apu* self, u16 old_div) {
+	if (old_div & 1 << 12) {
+		apu_frame_seq_step(self, self->time);
+	}
+	self->next_frame_seq = self->time + FRAME_SEQ_PERIOD;
+	if (self->time >= MAX_FRAME_TIME) {
+		apu_end_frame(self);
+	}
+}
+
+void apu_set_sample_rate(Apu* self, u32 sample_rate) {
+	self->sample_rate = sample_rate;
+	for (u8 i = 0; i < 2; ++i) {
+		blip_init(&self->blip[i], DMG_CLOCK_HZ, sample_rate);
+		self->level[i] = 0;
+		self->capacitor[i] = 0;
+	}
+	for (u8 i = 0; self->stem_blip && i < 4; ++i) {
+		blip_init(&self->stem_blip[i], DMG_CLOCK_HZ, sample_rate);
+		self->stem_level[i] = 0;
+		self->stem_capacitor[i] = 0;
+	}
+	// Same ~0.3 Hz high-pass corner at every rate
+	self->charge_factor = 1.0f - 2.0f / (f32) sample_rate;
+	if (self->output_enabled) {
+		apu_update_output(self, self->time);
+	}
+}
+
+// Stems are read with apu_read_stem_samples, in step with the mixed output.
+// Returns false if they couldn't be allocated.
+bool apu_set_stems_enabled(Apu* self, bool enabled) {
+	if (enabled == !!self->stem_blip) {
+		return true;
+	}
+	if (!enabled) {
+		free(self->stem_blip);
+		self->stem_blip = NULL;
+		return true;
+	}
+
+	self->stem_blip = malloc(4 * sizeof(Blip));
+	if (!self->stem_blip) {
+		return false;
+	}
+	// Start from silence at the same point the mixed output is at
+	for (u8 i = 0; i < 4; ++i) {
+		blip_init(&self->stem_blip[i], DMG_CLOCK_HZ, self->sample_rate);
+		self->stem_blip[i].offset = self->blip[0].offset;
+		self->stem_level[i] = 0;
+		self->stem_capacitor[i] = 0;
+	}
+	if (self->output_enabled) {
+		apu_update_output(self, self->time);
+	}
+	return true;
+}
+
+// Makes everything up to now available to apu_read_samples
+void apu_end_frame(Apu* self) {
+	if (self->output_enabled) {
+		apu_sync(self, self->time);
+		blip_end_frame(&self->blip[0], self->time);
+		blip_end_frame(&self->blip[1], self->time);
+		for (u8 i = 0; self->stem_blip && i < 4; ++i) {
+			blip_end_frame(&self->stem_blip[i], self->time);
 		}
-		else if (vol == 0b11) {
-			sample >>= 2;
+	}
+
+	self->channel1_generator.last_sync = 0;
+	self->channel2_generator.last_sync = 0;
+	self->channel3_generator.last_sync = 0;
+	self->channel4_generator.last_sync = 0;
+	self->next_frame_seq -= self->time;
+	self->time = 0;
+}
+
+// Reads up to count interleaved stereo samples, returns the number of sample pairs read
+u32 apu_read_samples(Apu* self, f32* out, u32 count) {
+	i32 samples[2][512];
+	u32 done = 0;
+	while (done < count) {
+		u32 chunk = count - done < 512 ? count - done : 512;
+		chunk = blip_read_samples(&self->blip[0], samples[0], chunk, 1);
+		blip_read_samples(&self->blip[1], samples[1], chunk, 1);
+		if (!chunk) {
+			break;
 		}
-		if (vol && sample) {
-			//f32 amp = 0.5f / 15.0f * (f32) sample;
-			f32 f_sample = 2.0f / 15.0f * (f32) sample;
-			if (f_sample < 1) {
-				f_sample *= -1;
-			}
-			else {
-				f_sample -= 1;
-			}
-			if (self->nr51 & NR51_CH3_LEFT) {
-				left += f_sample;
-			}
-			if (self->nr51 & NR51_CH3_RIGHT) {
-				right += f_sample;
+
+		for (u32 i = 0; i < chunk; ++i) {
+			for (u8 side = 0; side < 2; ++side) {
+				f32 in = (f32) samples[side][i] * (1.0f / (f32) (AMP_MAX << BLIP_SAMPLE_BITS));
+				f32 filtered = in - self->capacitor[side];
+				self->capacitor[side] = in - filtered * self->charge_factor;
+				out[(done + i) * 2 + side] = filtered;
 			}
 		}
+		done += chunk;
 	}
+	return done;
+}
 
-	u8 left_vol = (self->nr50 >> 4 & 0b111) + 1;
-	u8 right_vol = (self->nr50 & 0b111) + 1;
-	f32 left_amp = 0.8f / 8.0f * (f32) left_vol;
-	f32 right_amp = 0.8f / 8.0f * (f32) right_vol;
+// Reads up to count frames of the four channels interleaved, returns the number of frames read.
+// Each channel is at the level it has in the mix at full master volume.
+u32 apu_read_stem_samples(Apu* self, f32* out, u32 count) {
+	if (!self->stem_blip) {
+		return 0;
+	}
 
-	out[0] = do_high_pass_left(left_amp * left);
-	out[1] = do_high_pass_right(right_amp * right);
+	i32 samples[4][512];
+	u32 done = 0;
+	while (done < count) {
+		u32 chunk = count - done < 512 ? count - done : 512;
+		chunk = blip_read_samples(&self->stem_blip[0], samples[0], chunk, 1);
+		for (u8 channel = 1; channel < 4; ++channel) {
+			blip_read_samples(&self->stem_blip[channel], samples[channel], chunk, 1);
+		}
+		if (!chunk) {
+			break;
+		}
+
+		for (u32 i = 0; i < chunk; ++i) {
+			for (u8 channel = 0; channel < 4; ++channel) {
+				f32 in = (f32) samples[channel][i] * (1.0f / (f32) ((15 * 4) << BLIP_SAMPLE_BITS));
+				f32 filtered = in - self->stem_capacitor[channel];
+				self->stem_capacitor[channel] = in - filtered * self->charge_factor;
+				out[(done + i) * 4 + channel] = filtered;
+			}
+		}
+		done += chunk;
+	}
+	return done;
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include "types.h"
+#include "utils/blip.h"
+#include <stddef.h>
 
 typedef struct {
 	u16 cycle_rate;
@@ -7,6 +9,8 @@ typedef struct {
 	u8 cur_duty;
 	u8 duty_cycle;
 	u8 len_timer;
+	// Time cur_cycle/cur_duty are up to date for, the rest is derived on demand
+	u32 last_sync;
 } SquareWaveGenerator;
 
 typedef struct {
@@ -14,10 +18,16 @@ typedef struct {
 	u16 cur_cycle;
 	u16 len_timer;
 	u8 cur_wave;
+	u32 last_sync;
 } WaveGenerator;
 
 typedef struct {
 	u8 len_timer;
+	// T-cycles per LFSR step, 0 when the clock shift stops it
+	u32 cycle_rate;
+	u32 cur_cycle;
+	u16 lfsr;
+	u32 last_sync;
 } NoiseGenerator;
 
 typedef struct {
@@ -69,9 +79,37 @@ typedef struct {
 	u8 wave_pattern[16];
 	u8 wave_sample;
 	bool enabled;
+
+	// Keep these last, they survive powering the APU off through NR52.
+	// T-cycles since the last apu_end_frame
+	u32 time;
+	// The frame sequencer follows DIV, so it keeps running while the APU is off
+	u32 next_frame_seq;
+	// Mixed left/right amplitude last added to the blip buffers
+	i32 level[2];
+	f32 capacitor[2];
+	f32 charge_factor;
+	// Only register-visible state is kept up to date while false
+	bool output_enabled;
+	u32 sample_rate;
+	Blip blip[2];
+	// Per channel output before panning and master volume, NULL unless enabled
+	Blip* stem_blip;
+	i32 stem_level[4];
+	f32 stem_capacitor[4];
 } Apu;
 
-void apu_clock(Apu* self);
-void apu_clock_channels(Apu* self);
-void apu_gen_sample(Apu* self, f32 out[2]);
+#define APU_POWER_STATE_SIZE offsetof(Apu, time)
+// DMG_CLOCK_HZ / 32, the blip buffers run here and a resampler takes it to the device rate
+#define APU_NATIVE_RATE 131072
+
+void apu_reset(Apu* self);
+void apu_set_sample_rate(Apu* self, u32 sample_rate);
+void apu_set_output_enabled(Apu* self, bool enabled);
+bool apu_set_stems_enabled(Apu* self, bool enabled);
+void apu_advance(Apu* self, u32 cycles);
+void apu_div_reset(Apu* self, u16 old_div);
 void apu_write(Apu* self, u16 addr, u8 value);
+void apu_end_frame(Apu* self);
+u32 apu_read_samples(Apu* self, f32* out, u32 count);
+u32 apu_read_stem_samples(Apu* self, f32* out, u32 count);
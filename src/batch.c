@@ -0,0 +1,527 @@
+#include "emu.h"
+#include "utils/rom_image.h"
+#include "utils/thread_pool.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+// Runs many short headless jobs on a thread pool and prints one json object per job as each
+// finishes. The manifest has one job per line as key=value words, # starts a comment:
+//   rom=PATH          required
+//   frames=N          frames to run, 600 if missing
+//   input=PATH        input script, see input_load
+//   ram=ADDR:LEN      hex address and length of memory to dump at the end, up to 8 of them
+//   id=NAME           echoed back, the line number if missing
+// Throughput over all jobs goes to stderr at the end, the exit status is 1 if any failed.
+// seconds and fps only count running frames, loading and decompressing the rom is load_seconds.
+
+#define MAX_RAM_EXCERPTS 8
+// Test roms print their results over serial, more than this is cut off
+#define SERIAL_CAPACITY 4096
+#define DEFAULT_FRAMES 600
+
+typedef struct {
+	u16 addr;
+	u32 size;
+} RamExcerpt;
+
+typedef struct {
+	u32 frame;
+	u8 buttons;
+} InputEvent;
+
+typedef struct {
+	u32 line;
+	char* id;
+	char* rom;
+	char* input;
+	u32 frames;
+	RamExcerpt ram[MAX_RAM_EXCERPTS];
+	u8 ram_count;
+} Job;
+
+typedef struct {
+	char* data;
+	usize size;
+	usize capacity;
+	// Set once an append didn't fit and couldn't grow, the line is dropped then
+	bool failed;
+} Text;
+
+typedef struct {
+	Emulator* emu;
+	u8 serial[SERIAL_CAPACITY];
+	usize serial_size;
+	bool serial_truncated;
+	Text out;
+} Worker;
+
+typedef struct {
+	Job* jobs;
+	u32 job_count;
+	Worker* workers;
+	mtx_t output_lock;
+	atomic_uint_fast64_t frames;
+	// Summed over the jobs
+	atomic_uint_fast64_t load_usecs;
+	atomic_uint failed;
+} Batch;
+
+static f64 now_seconds() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (f64) ts.tv_sec + (f64) ts.tv_nsec / 1e9;
+}
+
+static char* copy_string(const char* str, usize len) {
+	char* copy = malloc(len + 1);
+	if (copy) {
+		memcpy(copy, str, len);
+		copy[len] = 0;
+	}
+	return copy;
+}
+
+static void text_printf(Text* self, const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	va_list copy;
+	va_copy(copy, args);
+	int len = vsnprintf(NULL, 0, fmt, copy);
+	va_end(copy);
+
+	if (len < 0 || self->failed) {
+		self->failed = true;
+		va_end(args);
+		return;
+	}
+	if (self->size + len + 1 > self->capacity) {
+		usize capacity = self->capacity ? self->capacity : 1024;
+		while (capacity < self->size + len + 1) {
+			capacity *= 2;
+		}
+		char* data = realloc(self->data, capacity);
+		if (!data) {
+			self->failed = true;
+			va_end(args);
+			return;
+		}
+		self->data = data;
+		self->capacity = capacity;
+	}
+	vsnprintf(self->data + self->size, self->capacity - self->size, fmt, args);
+	self->size += len;
+	va_end(args);
+}
+
+// Bytes above 0x7F are taken as latin-1, serial output has no encoding
+static void text_json_string(Text* self, const u8* str, usize len) {
+	text_printf(self, "\"");
+	for (usize i = 0; i < len; ++i) {
+		u8 c = str[i];
+		if (c == '"' || c == '\\') {
+			text_printf(self, "\\%c", c);
+		}
+		else if (c == '\n') {
+			text_printf(self, "\\n");
+		}
+		else if (c < 0x20 || c >= 0x7F) {
+			text_printf(self, "\\u%04x", c);
+		}
+		else {
+			text_printf(self, "%c", c);
+		}
+	}
+	text_printf(self, "\"");
+}
+
+static void batch_serial(void* arg, u8 byte) {
+	Worker* worker = arg;
+	if (worker->serial_size < SERIAL_CAPACITY) {
+		worker->serial[worker->serial_size++] = byte;
+	}
+	else {
+		worker->serial_truncated = true;
+	}
+}
+
+static bool parse_buttons(const char* str, usize len, u8* buttons) {
+	static const char* NAMES[] = {"right", "left", "up", "down", "a", "b", "select", "start"};
+
+	*buttons = 0;
+	if (len == 1 && *str == '-') {
+		return true;
+	}
+	while (len) {
+		usize name_len = 0;
+		while (name_len < len && str[name_len] != '+') {
+			name_len += 1;
+		}
+		bool found = false;
+		for (u8 i = 0; i < 8 && !found; ++i) {
+			if (strlen(NAMES[i]) == name_len && memcmp(NAMES[i], str, name_len) == 0) {
+				*buttons |= 1 << i;
+				found = true;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+		str += name_len;
+		len -= name_len;
+		if (len) {
+			str += 1;
+			len -= 1;
+		}
+	}
+	return true;
+}
+
+// One "frame buttons" pair per line in frame order, the buttons are held from that frame on.
+// Buttons are right, left, up, down, a, b, select and start joined with +, or - for none.
+static bool input_load(const char* path, InputEvent** events, usize* count) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		return false;
+	}
+
+	usize capacity = 0;
+	bool ok = true;
+	char line[256];
+	for (u32 line_num = 1; ok && fgets(line, sizeof(line), file); ++line_num) {
+		char* end;
+		char* str = line;
+		while (*str == ' ' || *str == '\t') {
+			str += 1;
+		}
+		if (*str == '#' || *str == '\n' || *str == '\r' || !*str) {
+			continue;
+		}
+
+		const char* digits = str;
+		u32 frame = (u32) strtoul(digits, &end, 10);
+		str = end;
+		while (*str == ' ' || *str == '\t') {
+			str += 1;
+		}
+		usize len = strcspn(str, " \t\r\n#");
+		InputEvent event = {.frame = frame};
+		if (end == digits || !len || !parse_buttons(str, len, &event.buttons)) {
+			fprintf(stderr, "warning: %s:%u: expected a frame and buttons\n", path, line_num);
+			ok = false;
+		}
+		else if (*count && (*events)[*count - 1].frame > frame) {
+			fprintf(stderr, "warning: %s:%u: frames have to be in order\n", path, line_num);
+			ok = false;
+		}
+		else {
+			if (*count == capacity) {
+				capacity = capacity ? capacity * 2 : 64;
+				InputEvent* grown = realloc(*events, capacity * sizeof(InputEvent));
+				if (!grown) {
+					ok = false;
+					break;
+				}
+				*events = grown;
+			}
+			(*events)[(*count)++] = event;
+		}
+	}
+	fclose(file);
+	return ok;
+}
+
+// FNV-1a over the pixels
+static u64 hash_framebuffer(const u32* pixels) {
+	u64 hash = 0xCBF29CE484222325;
+	const u8* bytes = (const u8*) pixels;
+	for (usize i = 0; i < LCD_WIDTH * LCD_HEIGHT * 4; ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3;
+	}
+	return hash;
+}
+
+static void batch_run_job(void* arg, u32 worker_index, u32 task) {
+	Batch* batch = arg;
+	Job* job = &batch->jobs[task];
+	Worker* worker = &batch->workers[worker_index];
+	Emulator* emu = worker->emu;
+
+	emu_init(emu);
+	emu->mute = true;
+	emu->no_save = true;
+	emu_set_serial_callback(emu, batch_serial, worker);
+	worker->serial_size = 0;
+	worker->serial_truncated = false;
+
+	InputEvent* events = NULL;
+	usize event_count = 0;
+	const char* error = NULL;
+	f64 load_start = now_seconds();
+	if (job->input && !input_load(job->input, &events, &event_count)) {
+		error = "failed to read the input script";
+	}
+	else if (!emu_load_rom(emu, job->rom)) {
+		error = "failed to load the rom";
+	}
+	// Compressed roms finish decompressing here instead of in the first frame
+	else if (!rom_image_wait(emu->bus.cart.image, rom_image_size(emu->bus.cart.image))) {
+		error = "failed to load the rom";
+	}
+
+	f64 start = now_seconds();
+	f64 load_elapsed = start - load_start;
+	u32 frames = 0;
+	usize next_event = 0;
+	while (!error && frames < job->frames) {
+		while (next_event < event_count && events[next_event].frame <= frames) {
+			emu_set_buttons(emu, events[next_event++].buttons);
+		}
+		if (!emu_step_frame(emu)) {
+			error = "failed to load the rom";
+		}
+		else {
+			frames += 1;
+		}
+	}
+	f64 elapsed = now_seconds() - start;
+
+	Text* out = &worker->out;
+	out->size = 0;
+	out->failed = false;
+	text_printf(out, "{\"id\":");
+	if (job->id) {
+		text_json_string(out, (const u8*) job->id, strlen(job->id));
+	}
+	else {
+		text_printf(out, "\"%u\"", job->line);
+	}
+	text_printf(out, ",\"rom\":");
+	text_json_string(out, (const u8*) job->rom, strlen(job->rom));
+	text_printf(out, ",\"ok\":%s", error ? "false" : "true");
+	if (error) {
+		text_printf(out, ",\"error\":\"%s\"", error);
+	}
+	else {
+		text_printf(out, ",\"frames\":%u,\"framebuffer_hash\":\"%016llx\"", frames, (unsigned long long) hash_framebuffer(emu_framebuffer(emu)));
+		text_printf(out, ",\"serial\":");
+		text_json_string(out, worker->serial, worker->serial_size);
+		if (worker->serial_truncated) {
+			text_printf(out, ",\"serial_truncated\":true");
+		}
+		text_printf(out, ",\"ram\":{");
+		for (u8 i = 0; i < job->ram_count; ++i) {
+			text_printf(out, "%s\"%04X\":\"", i ? "," : "", job->ram[i].addr);
+			for (u32 j = 0; j < job->ram[i].size; ++j) {
+				text_printf(out, "%02x", bus_read(&emu->bus, (u16) (job->ram[i].addr + j)));
+			}
+			text_printf(out, "\"");
+		}
+		text_printf(out, "},\"load_seconds\":%.6f", load_elapsed);
+		text_printf(out, ",\"seconds\":%.6f,\"fps\":%.1f", elapsed, elapsed > 0 ? frames / elapsed : 0.0);
+	}
+	text_printf(out, "}\n");
+
+	emu_unload(emu);
+	free(events);
+
+	atomic_fetch_add_explicit(&batch->frames, frames, memory_order_relaxed);
+	atomic_fetch_add_explicit(&batch->load_usecs, (u64) (load_elapsed * 1e6), memory_order_relaxed);
+	if (error) {
+		atomic_fetch_add_explicit(&batch->failed, 1, memory_order_relaxed);
+	}
+	if (out->failed) {
+		fprintf(stderr, "warning: out of memory formatting the result of line %u\n", job->line);
+		return;
+	}
+	mtx_lock(&batch->output_lock);
+	fwrite(out->data, 1, out->size, stdout);
+	fflush(stdout);
+	mtx_unlock(&batch->output_lock);
+}
+
+static bool parse_job(Job* job, char* line, const char* path, u32 line_num) {
+	*job = (Job) {.line = line_num, .frames = DEFAULT_FRAMES};
+
+	char* str = line;
+	while (true) {
+		str += strspn(str, " \t\r\n");
+		usize len = strcspn(str, " \t\r\n");
+		if (!len || *str == '#') {
+			break;
+		}
+
+		char* eq = memchr(str, '=', len);
+		if (!eq) {
+			fprintf(stderr, "warning: %s:%u: expected key=value, got %.*s\n", path, line_num, (int) len, str);
+			return false;
+		}
+		usize key_len = (usize) (eq - str);
+		char* value = copy_string(eq + 1, len - key_len - 1);
+		if (!value) {
+			return false;
+		}
+
+		if (key_len == 3 && memcmp(str, "rom", 3) == 0) {
+			free(job->rom);
+			job->rom = value;
+		}
+		else if (key_len == 5 && memcmp(str, "input", 5) == 0) {
+			free(job->input);
+			job->input = value;
+		}
+		else if (key_len == 2 && memcmp(str, "id", 2) == 0) {
+			free(job->id);
+			job->id = value;
+		}
+		else if (key_len == 6 && memcmp(str, "frames", 6) == 0) {
+			job->frames = (u32) strtoul(value, NULL, 10);
+			free(value);
+		}
+		else if (key_len == 3 && memcmp(str, "ram", 3) == 0) {
+			char* end;
+			unsigned long addr = strtoul(value, &end, 16);
+			unsigned long size = *end == ':' ? strtoul(end + 1, NULL, 0) : 0;
+			free(value);
+			if (job->ram_count == MAX_RAM_EXCERPTS) {
+				fprintf(stderr, "warning: %s:%u: at most %u ram excerpts\n", path, line_num, MAX_RAM_EXCERPTS);
+				return false;
+			}
+			if (!size || addr + size > 0x10000) {
+				fprintf(stderr, "warning: %s:%u: expected ram=ADDR:LEN inside the address space\n", path, line_num);
+				return false;
+			}
+			job->ram[job->ram_count++] = (RamExcerpt) {.addr = (u16) addr, .size = (u32) size};
+		}
+		else {
+			fprintf(stderr, "warning: %s:%u: unknown key %.*s\n", path, line_num, (int) len, str);
+			free(value);
+			return false;
+		}
+		str += len;
+	}
+
+	if (!job->rom) {
+		fprintf(stderr, "warning: %s:%u: missing rom=\n", path, line_num);
+		return false;
+	}
+	return true;
+}
+
+static void free_job(Job* job) {
+	free(job->id);
+	free(job->rom);
+	free(job->input);
+}
+
+// Blank and comment lines aren't jobs, bad ones are reported and skipped
+static bool load_manifest(Batch* batch, FILE* file, const char* path) {
+	u32 capacity = 0;
+	char line[4096];
+	for (u32 line_num = 1; fgets(line, sizeof(line), file); ++line_num) {
+		const char* str = line + strspn(line, " \t\r\n");
+		if (!*str || *str == '#') {
+			continue;
+		}
+
+		Job job;
+		if (!parse_job(&job, line, path, line_num)) {
+			free_job(&job);
+			continue;
+		}
+		if (batch->job_count == capacity) {
+			capacity = capacity ? capacity * 2 : 256;
+			Job* grown = realloc(batch->jobs, capacity * sizeof(Job));
+			if (!grown) {
+				free_job(&job);
+				return false;
+			}
+			batch->jobs = grown;
+		}
+		batch->jobs[batch->job_count++] = job;
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	const char* path = "-";
+	u32 threads = thread_pool_default_size();
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			threads = (u32) strtoul(argv[++i], NULL, 10);
+		}
+		else if (argv[i][0] == '-' && argv[i][1]) {
+			fprintf(stderr, "usage: %s [--threads N] [manifest, - or nothing for stdin]\n", argv[0]);
+			return 1;
+		}
+		else {
+			path = argv[i];
+		}
+	}
+	if (!threads) {
+		threads = 1;
+	}
+
+	FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "failed to open %s\n", path);
+		return 1;
+	}
+	Batch batch = {};
+	bool ok = load_manifest(&batch, file, path);
+	if (file != stdin) {
+		fclose(file);
+	}
+	if (!ok) {
+		fputs("failed to allocate the job list\n", stderr);
+		return 1;
+	}
+
+	if (threads > batch.job_count && batch.job_count) {
+		threads = batch.job_count;
+	}
+	batch.workers = calloc(threads, sizeof(Worker));
+	ok = batch.workers && mtx_init(&batch.output_lock, mtx_plain) == thrd_success;
+	for (u32 i = 0; ok && i < threads; ++i) {
+		batch.workers[i].emu = emu_new();
+		ok = batch.workers[i].emu;
+	}
+
+	f64 start = now_seconds();
+	if (!ok || !thread_pool_run(threads, batch.job_count, batch_run_job, &batch)) {
+		fputs("failed to allocate the workers\n", stderr);
+		return 1;
+	}
+	f64 elapsed = now_seconds() - start;
+
+	u64 frames = atomic_load(&batch.frames);
+	u32 failed = atomic_load(&batch.failed);
+	// The loads ran spread over the threads, take out their share of the wall time
+	f64 run_seconds = elapsed - (f64) atomic_load(&batch.load_usecs) / 1e6 / threads;
+	fprintf(
+		stderr,
+		"%u jobs, %u failed, %llu frames in %.2f s on %u threads: %.0f frames/s, %.0f without loading roms\n",
+		batch.job_count,
+		failed,
+		(unsigned long long) frames,
+		elapsed,
+		threads,
+		elapsed > 0 ? (f64) frames / elapsed : 0.0,
+		run_seconds > 0 ? (f64) frames / run_seconds : 0.0);
+
+	for (u32 i = 0; i < threads; ++i) {
+		emu_free(batch.workers[i].emu);
+		free(batch.workers[i].out.data);
+	}
+	for (u32 i = 0; i < batch.job_count; ++i) {
+		free_job(&batch.jobs[i]);
+	}
+	free(batch.workers);
+	free(batch.jobs);
+	mtx_destroy(&batch.output_lock);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,415 @@
+#include "batch_env.h"
+#include "utils/rom_image.h"
+#include "utils/thread_pool.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define WRAM_SIZE (1024 * 8)
+
+struct BatchEnv {
+	BatchEnvConfig config;
+	u16* ram_addrs;
+	BatchEnvLayout layout;
+	// Loaded but not started, resets copy it over an instance
+	Emulator* initial;
+	Emulator* instances;
+	// Every instance's wram as of the end of its last frame
+	u8* prev_wram;
+	// With lockstep_lanes set, consecutive instances stepped together
+	Lockstep** groups;
+	u32 group_count;
+
+	thrd_t* threads;
+	u32 thread_count;
+	mtx_t lock;
+	cnd_t start_cond;
+	cnd_t done_cond;
+	u64 generation;
+	u32 busy;
+	bool quit;
+
+	// The step in progress, instances or groups are claimed one at a time through next
+	const u8* actions;
+	u8* observations;
+	atomic_uint next;
+};
+
+BatchEnvConfig batch_env_config_new() {
+	return (BatchEnvConfig) {
+		.instances = 1,
+		.frames_per_step = 4,
+		.obs = BATCH_ENV_OBS_SHADES,
+		.downsample = 1,
+		.diff_capacity = 64
+	};
+}
+
+// The framebuffer only ever holds the four palette colors, one channel tells them apart
+static u8 color_shade(u32 color) {
+	u8 level = (u8) (color >> 24);
+	if (level > 0xE9) {
+		return 0;
+	}
+	else if (level > 0x96) {
+		return 1;
+	}
+	else if (level > 0x2D) {
+		return 2;
+	}
+	else {
+		return 3;
+	}
+}
+
+static void batch_env_write_pixels(const BatchEnv* self, const u32* pixels, u8* out) {
+	const BatchEnvLayout* layout = &self->layout;
+	u32 step = self->config.downsample;
+	for (u32 y = 0; y < layout->height; ++y) {
+		const u32* row = pixels + y * step * LCD_WIDTH;
+		if (self->config.obs == BATCH_ENV_OBS_RGBA) {
+			u32* dest = (u32*) out + y * layout->width;
+			for (u32 x = 0; x < layout->width; ++x) {
+				dest[x] = row[x * step];
+			}
+		}
+		else if (self->config.obs == BATCH_ENV_OBS_SHADES) {
+			u8* dest = out + y * layout->width;
+			for (u32 x = 0; x < layout->width; ++x) {
+				dest[x] = color_shade(row[x * step]);
+			}
+		}
+		else if (self->config.obs == BATCH_ENV_OBS_SHADES_PACKED) {
+			u8* dest = out + y * layout->width / 4;
+			for (u32 x = 0; x < layout->width; x += 4) {
+				dest[x / 4] = color_shade(row[x * step]) |
+					color_shade(row[(x + 1) * step]) << 2 |
+					color_shade(row[(x + 2) * step]) << 4 |
+					color_shade(row[(x + 3) * step]) << 6;
+			}
+		}
+	}
+}
+
+// Compares eight bytes at a time, frames usually touch only a few of them
+static void batch_env_diff_wram(const BatchEnv* self, const u8* wram, u8* prev, u8* out) {
+	BatchEnvDiffHeader* header = (BatchEnvDiffHeader*) out;
+	BatchEnvDiffEntry* entries = (BatchEnvDiffEntry*) (out + sizeof(BatchEnvDiffHeader));
+	u32 count = 0;
+	for (u32 i = 0; i < WRAM_SIZE; i += 8) {
+		u64 now;
+		u64 before;
+		memcpy(&now, wram + i, 8);
+		memcpy(&before, prev + i, 8);
+		if (now == before) {
+			continue;
+		}
+		for (u32 j = i; j < i + 8; ++j) {
+			if (wram[j] == prev[j]) {
+				continue;
+			}
+			if (count < self->config.diff_capacity) {
+				entries[count] = (BatchEnvDiffEntry) {.addr = (u16) j, .old_value = prev[j], .new_value = wram[j]};
+			}
+			count += 1;
+		}
+		memcpy(prev + i, wram + i, 8);
+	}
+	header->count = (u16) count;
+	header->reserved = 0;
+}
+
+static void batch_env_end_frame(BatchEnv* self, u32 index, u32 frame) {
+	Emulator* emu = &self->instances[index];
+	u8* prev = self->prev_wram + (usize) index * WRAM_SIZE;
+	if (self->observations) {
+		u8* out = self->observations + index * self->layout.stride;
+		batch_env_diff_wram(self, emu->bus.wram, prev, out + self->layout.diff_offset + frame * self->layout.diff_frame_size);
+	}
+	else {
+		memcpy(prev, emu->bus.wram, WRAM_SIZE);
+	}
+}
+
+static void batch_env_observe(BatchEnv* self, u32 index) {
+	if (!self->observations) {
+		return;
+	}
+	Emulator* emu = &self->instances[index];
+	u8* out = self->observations + index * self->layout.stride;
+	batch_env_write_pixels(self, emu_framebuffer(emu), out + self->layout.pixels_offset);
+	for (u32 i = 0; i < self->config.ram_count; ++i) {
+		out[self->layout.ram_offset + i] = bus_read(&emu->bus, self->ram_addrs[i]);
+	}
+}
+
+static void batch_env_run(BatchEnv* self, u32 index) {
+	Emulator* emu = &self->instances[index];
+	emu_set_buttons(emu, self->actions ? self->actions[index] : 0);
+	for (u32 frame = 0; frame < self->config.frames_per_step; ++frame) {
+		emu_step_frame(emu);
+		batch_env_end_frame(self, index, frame);
+	}
+	batch_env_observe(self, index);
+}
+
+static void batch_env_run_group(BatchEnv* self, u32 group) {
+	u32 first = group * self->config.lockstep_lanes;
+	u32 end = first + self->config.lockstep_lanes;
+	end = end < self->config.instances ? end : self->config.instances;
+
+	for (u32 i = first; i < end; ++i) {
+		emu_set_buttons(&self->instances[i], self->actions ? self->actions[i] : 0);
+	}
+	for (u32 frame = 0; frame < self->config.frames_per_step; ++frame) {
+		lockstep_step_frame(self->groups[group]);
+		for (u32 i = first; i < end; ++i) {
+			batch_env_end_frame(self, i, frame);
+		}
+	}
+	for (u32 i = first; i < end; ++i) {
+		batch_env_observe(self, i);
+	}
+}
+
+static void batch_env_work(BatchEnv* self) {
+	u32 index;
+	if (self->groups) {
+		while ((index = atomic_fetch_add_explicit(&self->next, 1, memory_order_relaxed)) < self->group_count) {
+			batch_env_run_group(self, index);
+		}
+		return;
+	}
+	while ((index = atomic_fetch_add_explicit(&self->next, 1, memory_order_relaxed)) < self->config.instances) {
+		batch_env_run(self, index);
+	}
+}
+
+static int batch_env_worker(void* arg) {
+	BatchEnv* self = arg;
+	u64 seen = 0;
+	mtx_lock(&self->lock);
+	while (true) {
+		while (self->generation == seen && !self->quit) {
+			cnd_wait(&self->start_cond, &self->lock);
+		}
+		if (self->quit) {
+			break;
+		}
+		seen = self->generation;
+		mtx_unlock(&self->lock);
+
+		batch_env_work(self);
+
+		mtx_lock(&self->lock);
+		self->busy -= 1;
+		if (!self->busy) {
+			cnd_signal(&self->done_cond);
+		}
+	}
+	mtx_unlock(&self->lock);
+	return 0;
+}
+
+// Thousands of instances printing test rom output to stderr isn't useful
+static void batch_env_discard_serial(void* arg, u8 byte) {}
+
+static void batch_env_copy_initial(BatchEnv* self, u32 index) {
+	emu_copy(&self->instances[index], self->initial);
+	emu_set_serial_callback(&self->instances[index], batch_env_discard_serial, NULL);
+	memcpy(self->prev_wram + (usize) index * WRAM_SIZE, self->initial->bus.wram, WRAM_SIZE);
+}
+
+static bool batch_env_layout_init(BatchEnv* self) {
+	const BatchEnvConfig* config = &self->config;
+	BatchEnvLayout* layout = &self->layout;
+	if (config->downsample != 1 && config->downsample != 2 && config->downsample != 4) {
+		fprintf(stderr, "warning: downsample has to be 1, 2 or 4, not %u\n", config->downsample);
+		return false;
+	}
+	layout->width = LCD_WIDTH / config->downsample;
+	layout->height = LCD_HEIGHT / config->downsample;
+
+	usize pixels = (usize) layout->width * layout->height;
+	if (config->obs == BATCH_ENV_OBS_RGBA) {
+		layout->pixels_size = pixels * 4;
+	}
+	else if (config->obs == BATCH_ENV_OBS_SHADES) {
+		layout->pixels_size = pixels;
+	}
+	else if (config->obs == BATCH_ENV_OBS_SHADES_PACKED) {
+		layout->pixels_size = pixels / 4;
+	}
+	layout->pixels_offset = 0;
+	layout->ram_offset = layout->pixels_size;
+	layout->diff_offset = (layout->ram_offset + config->ram_count + 3) & ~(usize) 3;
+	layout->diff_frame_size = sizeof(BatchEnvDiffHeader) + config->diff_capacity * sizeof(BatchEnvDiffEntry);
+	usize end = layout->diff_offset + config->frames_per_step * layout->diff_frame_size;
+	layout->stride = (end + 63) & ~(usize) 63;
+	return true;
+}
+
+static void batch_env_free_groups(BatchEnv* self) {
+	for (u32 i = 0; self->groups && i < self->group_count; ++i) {
+		if (self->groups[i]) {
+			lockstep_free(self->groups[i]);
+		}
+	}
+	free(self->groups);
+}
+
+// Loads the rom once and copies it into every instance. Returns NULL if the rom can't be
+// loaded or the config is invalid.
+BatchEnv* batch_env_new(const BatchEnvConfig* config) {
+	if (!config->instances || !config->frames_per_step) {
+		return NULL;
+	}
+
+	BatchEnv* self = calloc(1, sizeof(BatchEnv));
+	if (!self) {
+		return NULL;
+	}
+	self->config = *config;
+	if (!batch_env_layout_init(self)) {
+		free(self);
+		return NULL;
+	}
+
+	self->ram_addrs = malloc(config->ram_count * sizeof(u16) + 1);
+	self->initial = emu_new();
+	self->instances = malloc(config->instances * sizeof(Emulator));
+	self->prev_wram = malloc((usize) config->instances * WRAM_SIZE);
+	u32 units = config->instances;
+	if (config->lockstep_lanes) {
+		self->group_count = (config->instances + config->lockstep_lanes - 1) / config->lockstep_lanes;
+		self->groups = calloc(self->group_count, sizeof(Lockstep*));
+		units = self->group_count;
+	}
+	u32 threads = config->threads ? config->threads : thread_pool_default_size();
+	threads = threads < units ? threads : units;
+	self->threads = malloc(threads * sizeof(thrd_t));
+	bool ok = self->ram_addrs && self->initial && self->instances && self->prev_wram && self->threads &&
+		(self->groups || !config->lockstep_lanes);
+	for (u32 i = 0; ok && i < self->group_count; ++i) {
+		u32 first = i * config->lockstep_lanes;
+		u32 lanes = config->instances - first < config->lockstep_lanes ? config->instances - first : config->lockstep_lanes;
+		self->groups[i] = lockstep_new(&self->instances[first], lanes);
+		ok = self->groups[i];
+	}
+	if (ok) {
+		if (config->ram_count) {
+			memcpy(self->ram_addrs, config->ram_addrs, config->ram_count * sizeof(u16));
+		}
+		self->config.ram_addrs = self->ram_addrs;
+		self->initial->mute = true;
+		self->initial->no_save = true;
+		ok = emu_load_rom(self->initial, config->rom);
+		RomImage* image = self->initial->bus.cart.image;
+		ok = ok && rom_image_wait(image, rom_image_size(image));
+		if (!ok) {
+			fprintf(stderr, "failed to load rom %s\n", config->rom);
+		}
+	}
+	if (!ok) {
+		if (self->initial) {
+			emu_free(self->initial);
+		}
+		free(self->ram_addrs);
+		free(self->instances);
+		free(self->prev_wram);
+		free(self->threads);
+		batch_env_free_groups(self);
+		free(self);
+		return NULL;
+	}
+
+	for (u32 i = 0; i < config->instances; ++i) {
+		batch_env_copy_initial(self, i);
+	}
+
+	mtx_init(&self->lock, mtx_plain);
+	cnd_init(&self->start_cond);
+	cnd_init(&self->done_cond);
+	// The calling thread steps instances too, threads that don't start are made up for by it
+	for (u32 i = 0; i + 1 < threads; ++i) {
+		if (thrd_create(&self->threads[self->thread_count], batch_env_worker, self) == thrd_success) {
+			self->thread_count += 1;
+		}
+	}
+	return self;
+}
+
+void batch_env_free(BatchEnv* self) {
+	mtx_lock(&self->lock);
+	self->quit = true;
+	cnd_broadcast(&self->start_cond);
+	mtx_unlock(&self->lock);
+	for (u32 i = 0; i < self->thread_count; ++i) {
+		thrd_join(self->threads[i], NULL);
+	}
+	mtx_destroy(&self->lock);
+	cnd_destroy(&self->start_cond);
+	cnd_destroy(&self->done_cond);
+
+	for (u32 i = 0; i < self->config.instances; ++i) {
+		emu_unload(&self->instances[i]);
+	}
+	emu_free(self->initial);
+	free(self->ram_addrs);
+	free(self->instances);
+	free(self->prev_wram);
+	free(self->threads);
+	batch_env_free_groups(self);
+	free(self);
+}
+
+const BatchEnvLayout* batch_env_layout(const BatchEnv* self) {
+	return &self->layout;
+}
+
+// For reading anything the observations don't cover, only between steps
+Emulator* batch_env_instance(BatchEnv* self, u32 index) {
+	return &self->instances[index];
+}
+
+// Puts an instance back to power on, e.g. at the end of an episode. Its next step starts
+// the game over.
+void batch_env_reset(BatchEnv* self, u32 index) {
+	emu_unload(&self->instances[index]);
+	batch_env_copy_initial(self, index);
+}
+
+// Holds actions[i] (BUTTON_* bits) on instance i for frames_per_step frames and fills its
+// slot of observations, which has room for instances * stride bytes and is at least 4 byte
+// aligned. Either may be NULL for no buttons or no observations. Returns once every
+// instance is done.
+void batch_env_step(BatchEnv* self, const u8* actions, u8* observations) {
+	self->actions = actions;
+	self->observations = observations;
+	atomic_store_explicit(&self->next, 0, memory_order_relaxed);
+
+	mtx_lock(&self->lock);
+	self->generation += 1;
+	self->busy = self->thread_count;
+	cnd_broadcast(&self->start_cond);
+	mtx_unlock(&self->lock);
+
+	batch_env_work(self);
+
+	mtx_lock(&self->lock);
+	while (self->busy) {
+		cnd_wait(&self->done_cond, &self->lock);
+	}
+	mtx_unlock(&self->lock);
+}
+
+// Totals over every lockstep group since batch_env_new, all zero without lockstep_lanes
+LockstepStats batch_env_lockstep_stats(const BatchEnv* self) {
+	LockstepStats stats = {};
+	for (u32 i = 0; i < self->group_count; ++i) {
+		lockstep_stats_add(&stats, lockstep_stats(self->groups[i]));
+	}
+	return stats;
+}
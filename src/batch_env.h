@@ -0,0 +1,76 @@
+#pragma once
+#include "emu.h"
+#include "lockstep.h"
+
+// N instances of one rom stepped in lockstep for agent training. Every step holds one set of
+// buttons per instance for frames_per_step frames, then writes each instance's observation
+// into its slot of one caller buffer: the last frame's pixels, the selected memory bytes
+// and the wram bytes every frame changed. The instances live in one array and are stepped
+// on persistent threads, nothing is allocated after batch_env_new.
+
+typedef enum {
+	BATCH_ENV_OBS_NONE,
+	// 0xBBGGRRAA like the framebuffer
+	BATCH_ENV_OBS_RGBA,
+	// One byte per pixel, shade 0 (white) to 3 (black)
+	BATCH_ENV_OBS_SHADES,
+	// Four pixels per byte, the leftmost in the low bits
+	BATCH_ENV_OBS_SHADES_PACKED
+} BatchEnvObs;
+
+typedef struct {
+	const char* rom;
+	u32 instances;
+	u32 frames_per_step;
+	BatchEnvObs obs;
+	// 1, 2 or 4, keeps the top left pixel of every square that size
+	u32 downsample;
+	// Read like the cpu would at the end of the step, copied by batch_env_new
+	const u16* ram_addrs;
+	u32 ram_count;
+	// Changed wram bytes recorded per frame, a frame with more only reports the count
+	u32 diff_capacity;
+	// 0 for one per online core
+	u32 threads;
+	// Experimental, 0 steps instances on their own, otherwise in lockstep groups of up to
+	// this many (see lockstep.h)
+	u32 lockstep_lanes;
+} BatchEnvConfig;
+
+// One changed wram byte, addr is the offset from 0xC000
+typedef struct {
+	u16 addr;
+	u8 old_value;
+	u8 new_value;
+} BatchEnvDiffEntry;
+
+// Followed by diff_capacity entries, the first min(count, diff_capacity) of them valid
+typedef struct {
+	u16 count;
+	u16 reserved;
+} BatchEnvDiffHeader;
+
+// Where everything is inside an instance's slot. Slots are stride bytes apart and stride is
+// a multiple of 64, so threads never write the same cache line.
+typedef struct {
+	usize stride;
+	u32 width;
+	u32 height;
+	usize pixels_offset;
+	usize pixels_size;
+	usize ram_offset;
+	// frames_per_step blocks of diff_frame_size bytes, a header and its entries each
+	usize diff_offset;
+	usize diff_frame_size;
+} BatchEnvLayout;
+
+typedef struct BatchEnv BatchEnv;
+
+BatchEnvConfig batch_env_config_new();
+BatchEnv* batch_env_new(const BatchEnvConfig* config);
+void batch_env_free(BatchEnv* self);
+const BatchEnvLayout* batch_env_layout(const BatchEnv* self);
+Emulator* batch_env_instance(BatchEnv* self, u32 index);
+void batch_env_reset(BatchEnv* self, u32 index);
+void batch_env_step(BatchEnv* self, const u8* actions, u8* observations);
+LockstepStats batch_env_lockstep_stats(const BatchEnv* self);
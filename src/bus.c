@@ -2,15 +2,27 @@
 #include <stdio.h>
 
 void bus_cycle(Bus* self) {
-	u8 old_div = self->timer.div >> 8;
+	self->cart.cycles += 1;
 	cpu_cycle(&self->cpu);
+	bus_cycle_devices(self);
+}
+
+// The rest of an M cycle after the cpu's part, for drivers that step the cpu themselves
+void bus_cycle_devices(Bus* self) {
 	// PPU uses T cycles
-	for (u8 i = 0; i < 4; ++i) {
+	for (u8 i = 0; !self->audio_only && i < 4; ++i) {
 		ppu_clock(&self->ppu);
-		apu_clock_channels(&self->apu);
 	}
-	if (old_div & 1 << 4 && !((self->timer.div >> 8) & 1 << 4)) {
-		apu_clock(&self->apu);
+	apu_advance(&self->apu, 4);
+}
+
+// Joypad lines are active low, the low nibble of the pressed mask are the directions
+void bus_set_buttons(Bus* self, u8 pressed) {
+	if (self->joyp & 1 << 5) {
+		self->joyp = (self->joyp & 0xF0) | (~pressed >> 4 & 0xF);
+	}
+	if (self->joyp & 1 << 4) {
+		self->joyp = (self->joyp & 0xF0) | (~pressed & 0xF);
 	}
 }
 
@@ -19,7 +31,7 @@ void bus_write(Bus* self, u16 addr, u8 value) {
 		self->cart.mapper->write(self->cart.mapper, addr, value);
 	}
 	else if (addr <= 0x9FFF) {
-		self->ppu.vram[addr - 0x8000] = value;
+		ppu_write(&self->ppu, addr, value);
 	}
 	else if (addr <= 0xBFFF) {
 		self->cart.mapper->write(self->cart.mapper, addr, value);
@@ -31,14 +43,17 @@ void bus_write(Bus* self, u16 addr, u8 value) {
 		self->wram[addr - 0xE000] = value;
 	}
 	else if (addr <= 0xFE9F) {
-		self->ppu.oam[addr - 0xFE00] = value;
+		ppu_write(&self->ppu, addr, value);
 	}
 	else if (addr <= 0xFF7F) {
 		if (addr == 0xFF01) {
 			self->serial_byte = value;
 		}
 		else if (addr == 0xFF02) {
-			if (value == 0x81) {
+			if (value == 0x81 && self->serial_callback) {
+				self->serial_callback(self->serial_arg, self->serial_byte);
+			}
+			else if (value == 0x81) {
 				fprintf(stderr, "%c", self->serial_byte);
 			}
 		}
@@ -51,43 +66,15 @@ void bus_write(Bus* self, u16 addr, u8 value) {
 		else if (addr >= 0xFF10 && addr <= 0xFF3F) {
 			apu_write(&self->apu, addr, value);
 		}
-		else if (addr == 0xFF40) {
-			self->ppu.lcdc = value;
-		}
-		else if (addr == 0xFF41) {
-			self->ppu.stat &= 0b111;
-			self->ppu.stat |= value & ~0b111;
-		}
-		else if (addr == 0xFF42) {
-			self->ppu.scy = value;
-		}
-		else if (addr == 0xFF43) {
-			self->ppu.scx = value;
-		}
-		else if (addr == 0xFF45) {
-			self->ppu.lyc = value;
-		}
 		else if (addr == 0xFF46) {
 			self->last_dma = value;
 			u16 dma_src = (u16) value << 8;
 			for (u8 i = 0; i < 160; ++i) {
-				self->ppu.oam[i] = bus_read(self, dma_src + i);
+				ppu_write(&self->ppu, 0xFE00 + i, bus_read(self, dma_src + i));
 			}
 		}
-		else if (addr == 0xFF47) {
-			self->ppu.bg_palette = value;
-		}
-		else if (addr == 0xFF48) {
-			self->ppu.ob_palette0 = value;
-		}
-		else if (addr == 0xFF49) {
-			self->ppu.ob_palette1 = value;
-		}
-		else if (addr == 0xFF4A) {
-			self->ppu.wy = value;
-		}
-		else if (addr == 0xFF4B) {
-			self->ppu.wx = value;
+		else if (addr >= 0xFF40 && addr <= 0xFF4B) {
+			ppu_write(&self->ppu, addr, value);
 		}
 		else if (addr == 0xFF50 && value) {
 			self->bootrom_mapped = false;
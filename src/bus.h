@@ -6,6 +6,19 @@
 #include "timer.h"
 #include "types.h"
 
+typedef enum : u8 {
+	BUTTON_RIGHT = 1 << 0,
+	BUTTON_LEFT = 1 << 1,
+	BUTTON_UP = 1 << 2,
+	BUTTON_DOWN = 1 << 3,
+	BUTTON_A = 1 << 4,
+	BUTTON_B = 1 << 5,
+	BUTTON_SELECT = 1 << 6,
+	BUTTON_START = 1 << 7
+} Button;
+
+typedef void (*SerialCallback)(void* arg, u8 byte);
+
 typedef struct Bus {
 	Cpu cpu;
 	Ppu ppu;
@@ -16,10 +29,15 @@ typedef struct Bus {
 	u8 hram[127];
 	u8 boot_rom[0x100];
 	bool bootrom_mapped;
+	// Only the cpu, timer and apu are clocked, for the gbs player
+	bool audio_only;
 	bool serial_enabled;
 	u8 serial_out;
 	u8 serial_byte;
 	u8 serial_cycle;
+	// Bytes sent with the internal clock go here, or to stderr while it's NULL
+	SerialCallback serial_callback;
+	void* serial_arg;
 	u8 joyp;
 	u8 last_dma;
 } Bus;
@@ -27,3 +45,5 @@ typedef struct Bus {
 void bus_write(Bus* self, u16 addr, u8 value);
 u8 bus_read(Bus* self, u16 addr);
 void bus_cycle(Bus* self);
+void bus_cycle_devices(Bus* self);
+void bus_set_buttons(Bus* self, u8 pressed);
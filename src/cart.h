@@ -26,12 +26,52 @@ typedef struct Mapper {
 	Cart* cart;
 } Mapper;
 
+typedef struct RomImage RomImage;
+
+// Room for the largest mapper's state, mappers are built in place so a cart is one block
+#define CART_MAPPER_SIZE 128
+// MBC5's 16 banks
+#define CART_MAX_RAM_SIZE (128 * 1024)
+
 typedef struct Cart {
+	// Points into mapper_storage, see cart_rebind
 	Mapper* mapper;
 	const CartHdr* hdr;
-	u8* data;
-	u8* ram;
+	// Owns data, which may be shared with other carts and is never written
+	RomImage* image;
+	const u8* data;
 	usize num_rom_banks;
 	usize rom_size;
 	usize ram_size;
+	// M-cycles since power on, for mappers with a clock
+	u64 cycles;
+	// Ram written since the last hand-off to the save file, empty when start >= end
+	usize ram_dirty_start;
+	usize ram_dirty_end;
+	alignas(max_align_t) u8 mapper_storage[CART_MAPPER_SIZE];
+	// Only the first ram_size bytes are used
+	u8 ram[CART_MAX_RAM_SIZE];
 } Cart;
+
+// Nothing in a cart points outside of it except at the shared rom, so it can be moved or
+// copied with memcpy as long as this is called on the copy
+static inline void cart_rebind(Cart* self) {
+	if (self->mapper) {
+		self->mapper = (Mapper*) self->mapper_storage;
+		self->mapper->cart = self;
+	}
+}
+
+// Mappers call this for every ram write, the range is handed to the save file once a frame
+static inline void cart_ram_dirty(Cart* self, usize offset) {
+	if (self->ram_dirty_start >= self->ram_dirty_end) {
+		self->ram_dirty_start = offset;
+		self->ram_dirty_end = offset + 1;
+	}
+	else if (offset < self->ram_dirty_start) {
+		self->ram_dirty_start = offset;
+	}
+	else if (offset >= self->ram_dirty_end) {
+		self->ram_dirty_end = offset + 1;
+	}
+}
@@ -68,7 +68,8 @@ static u8 cpu_fetch(Cpu* self) {
 			self->fetched_data = bus_read(self->bus, self->pc++);
 			return 1;
 		case M_U16:
-			self->fetched_data = bus_read(self->bus, self->pc++) | bus_read(self->bus, self->pc++) << 8;
+			self->fetched_data = bus_read(self->bus, self->pc++);
+			self->fetched_data |= bus_read(self->bus, self->pc++) << 8;
 			return 2;
 		case M_R:
 			self->fetched_data = reg_read(self, self->cur_inst->rs);
@@ -123,7 +124,8 @@ static u8 cpu_fetch(Cpu* self) {
 			return 2;
 		case M_R_M_U16:
 			// not really dest_addr but just used as tmp
-			self->dest_addr = bus_read(self->bus, self->pc++) | bus_read(self->bus, self->pc++) << 8;
+			self->dest_addr = bus_read(self->bus, self->pc++);
+			self->dest_addr |= bus_read(self->bus, self->pc++) << 8;
 			self->fetched_data = bus_read(self->bus, self->dest_addr);
 			return 3;
 		case M_M_U8:
@@ -133,7 +135,8 @@ static u8 cpu_fetch(Cpu* self) {
 			return 1;
 		case M_M_U16_R:
 			self->fetched_data = reg_read(self, self->cur_inst->rs);
-			self->dest_addr = bus_read(self->bus, self->pc++) | bus_read(self->bus, self->pc++) << 8;
+			self->dest_addr = bus_read(self->bus, self->pc++);
+			self->dest_addr |= bus_read(self->bus, self->pc++) << 8;
 			self->dest_is_mem = true;
 			return 2;
 		case M_SP_I8:
@@ -165,7 +168,7 @@ void cpu_request_irq(Cpu* self, Irq irq) {
 	self->if_flag |= (u8) irq;
 }
 
-static u16 IRQ_LOCATIONS[5] = {
+static const u16 IRQ_LOCATIONS[5] = {
 	[0] = 0x40,
 	[1] = 0x48,
 	[2] = 0x50,
@@ -198,8 +201,6 @@ bool cpu_process_irqs(Cpu* self) {
 	return false;
 }
 
-static usize INST_COUNT = 0;
-
 void cpu_cycle(Cpu* self) {
 	if (self->remaining_cycles) {
 		self->remaining_cycles -= 1;
@@ -215,16 +216,14 @@ void cpu_cycle(Cpu* self) {
 		return;
 	}
 
-	/*printf("%zu  TIMA: %02X TMA: %02X DIV: %02X TAC: %02X IME: %02X IE: %02X IF: %02X "
+	/*printf("%llu  TIMA: %02X TMA: %02X DIV: %02X TAC: %02X IME: %02X IE: %02X IF: %02X "
 		   "A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X (%02X %02X %02X %02X)\n",
-		   INST_COUNT, self->bus->timer.tima, self->bus->timer.tma, self->bus->timer.div >> 8, self->bus->timer.tac,
+		   (unsigned long long) self->bus->cart.cycles, self->bus->timer.tima, self->bus->timer.tma, self->bus->timer.div >> 8, self->bus->timer.tac,
 		   self->ime ? 1 : 0, self->ie, self->if_flag,
 		   self->regs[REG_A], self->regs[REG_F], self->regs[REG_B], self->regs[REG_C],
 		   self->regs[REG_D], self->regs[REG_E], self->regs[REG_H], self->regs[REG_L],
 		   self->sp, self->pc, bus_read(self->bus, self->pc), bus_read(self->bus, self->pc + 1),
-		   bus_read(self->bus, self->pc + 2), bus_read(self->bus, self->pc + 3));
-
-	INST_COUNT += 1;*/
+		   bus_read(self->bus, self->pc + 2), bus_read(self->bus, self->pc + 3));*/
 
 	/*if (self->pc >= 0x100) {
 		printf("A: %02X F: %02X B: %02X C: %02X D: %02X E: %02X H: %02X L: %02X SP: %04X PC: 00:%04X (%02X %02X %02X %02X)\n",
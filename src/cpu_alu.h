@@ -0,0 +1,79 @@
+#pragma once
+#include "cpu.h"
+
+// The 8 bit arithmetic behind the instruction handlers, shared with the lockstep lanes so
+// both compute the same results and flags. Every op takes the flags from before it.
+
+typedef struct {
+	u8 value;
+	u8 flags;
+} AluResult;
+
+static inline AluResult alu_add(u8 value, u8 value2, u8) {
+	u16 sum = value + value2;
+	u16 no_carry_sum = value ^ value2;
+	u16 carry_into = sum ^ no_carry_sum;
+	u16 hc = carry_into & 1 << 4;
+	u16 carry = carry_into & 1 << 8;
+
+	u8 res = (u8) sum;
+	return (AluResult) {res, (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (carry ? F_C : 0)};
+}
+
+static inline AluResult alu_adc(u8 value, u8 value2, u8 flags) {
+	u8 prev_c = (flags & F_C) > 0 ? 1 : 0;
+
+	bool hc = ((value & 0xF) + (value2 & 0xF) + prev_c) & 1 << 4;
+	u16 res = value + value2 + prev_c;
+	u8 trunc_res = res & 0xFF;
+	return (AluResult) {trunc_res, (trunc_res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (res > 0xFF ? F_C : 0)};
+}
+
+static inline AluResult alu_sub(u8 value, u8 value2, u8) {
+	bool hc = ((value & 0xF) - (value2 & 0xF)) & 1 << 4;
+	u8 res = value - value2;
+	bool c = value2 > value;
+
+	return (AluResult) {res, (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (c ? F_C : 0) | F_N};
+}
+
+static inline AluResult alu_sbc(u8 value, u8 value2, u8 flags) {
+	u8 prev_c = (flags & F_C) > 0 ? 1 : 0;
+
+	bool hc = ((value & 0xF) - (value2 & 0xF) - prev_c) & 1 << 4;
+	u8 res = value - value2 - prev_c;
+	bool c = (value2 + prev_c) > value;
+	return (AluResult) {res, (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (c ? F_C : 0) | F_N};
+}
+
+// Leaves value as it is, only the flags are kept
+static inline AluResult alu_cp(u8 value, u8 value2, u8 flags) {
+	return (AluResult) {value, alu_sub(value, value2, flags).flags};
+}
+
+static inline AluResult alu_and(u8 value, u8 value2, u8) {
+	u8 res = value & value2;
+	return (AluResult) {res, (res == 0 ? F_Z : 0) | F_H};
+}
+
+static inline AluResult alu_xor(u8 value, u8 value2, u8) {
+	u8 res = value ^ value2;
+	return (AluResult) {res, res == 0 ? F_Z : 0};
+}
+
+static inline AluResult alu_or(u8 value, u8 value2, u8) {
+	u8 res = value | value2;
+	return (AluResult) {res, res == 0 ? F_Z : 0};
+}
+
+static inline AluResult alu_inc(u8 value, u8 flags) {
+	bool hc = ((value & 0xF) + 1) & 1 << 4;
+	u8 res = value + 1;
+	return (AluResult) {res, (flags & F_C) | (hc ? F_H : 0) | (res == 0 ? F_Z : 0)};
+}
+
+static inline AluResult alu_dec(u8 value, u8 flags) {
+	bool hc = ((value & 0xF) - 1) & 1 << 4;
+	u8 res = value - 1;
+	return (AluResult) {res, (flags & F_C) | (hc ? F_H : 0) | (res == 0 ? F_Z : 0) | F_N};
+}
@@ -1,5 +1,6 @@
 #include "bus.h"
 #include "cpu.h"
+#include "cpu_alu.h"
 #include "inst.h"
 
 static u8 inst_ld(Cpu* self) {
@@ -20,16 +21,13 @@ static u8 inst_ld16(Cpu* self) {
 }
 
 static u8 inst_xor(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-	u8 res = value ^ value2;
-
-	self->regs[REG_F] = res == 0 ? F_Z : 0;
-	self->regs[REG_A] = res;
+	AluResult res = alu_xor(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
-static Reg CB_REGS[] = {
+static const Reg CB_REGS[] = {
 	[0] = REG_B,
 	[1] = REG_C,
 	[2] = REG_D,
@@ -215,17 +213,14 @@ static u8 inst_inc(Cpu* self) {
 		return 2;
 	}
 
-	bool hc = ((self->fetched_data & 0xF) + 1) & 1 << 4;
-	u8 res = (u8) self->fetched_data + 1;
-
-	self->regs[REG_F] = (self->regs[REG_F] & F_C) | (hc ? F_H : 0) |
-						(res == 0 ? F_Z : 0);
+	AluResult res = alu_inc((u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
 	if (self->dest_is_mem) {
-		bus_write(self->bus, self->dest_addr, res);
+		bus_write(self->bus, self->dest_addr, res.value);
 		return 2;
 	}
 	else {
-		self->regs[self->cur_inst->rd] = res;
+		self->regs[self->cur_inst->rd] = res.value;
 		return 1;
 	}
 }
@@ -272,17 +267,14 @@ static u8 inst_dec(Cpu* self) {
 		return 2;
 	}
 
-	bool hc = ((self->fetched_data & 0xF) - 1) & 1 << 4;
-	u8 res = (u8) self->fetched_data - 1;
-
-	self->regs[REG_F] = (self->regs[REG_F] & F_C) | (hc ? F_H : 0) |
-						(res == 0 ? F_Z : 0) | F_N;
+	AluResult res = alu_dec((u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
 	if (self->dest_is_mem) {
-		bus_write(self->bus, self->dest_addr, res);
+		bus_write(self->bus, self->dest_addr, res.value);
 		return 2;
 	}
 	else {
-		self->regs[self->cur_inst->rd] = res;
+		self->regs[self->cur_inst->rd] = res.value;
 		return 1;
 	}
 }
@@ -303,40 +295,15 @@ static u8 inst_ret(Cpu* self) {
 	return 5;
 }
 
-static char flag_buf[5] = {};
-
-const char* get_flags(u8 flags) {
-	flag_buf[0] = flags & F_C ? 'C' : ' ';
-	flag_buf[1] = flags & F_H ? 'H' : ' ';
-	flag_buf[2] = flags & F_Z ? 'Z' : ' ';
-	flag_buf[3] = flags & F_N ? 'N' : ' ';
-	return flag_buf;
-}
-
 static u8 inst_cp(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-
-	bool hc = ((value & 0xF) - (value2 & 0xF)) & 1 << 4;
-	u8 res = value - value2;
-	bool c = value2 > value;
-
-	self->regs[REG_F] = (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (c ? F_C : 0) | F_N;
-
+	self->regs[REG_F] = alu_cp(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]).flags;
 	return 1;
 }
 
 static u8 inst_sub(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-
-	bool hc = ((value & 0xF) - (value2 & 0xF)) & 1 << 4;
-	u8 res = value - value2;
-	bool c = value2 > value;
-
-	self->regs[REG_A] = res;
-	self->regs[REG_F] = (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (c ? F_C : 0) | F_N;
-
+	AluResult res = alu_sub(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
@@ -363,19 +330,9 @@ static u8 inst_add(Cpu* self) {
 		return 2;
 	}
 
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-
-	u16 sum = value + value2;
-	u16 no_carry_sum = value ^ value2;
-	u16 carry_into = sum ^ no_carry_sum;
-	u16 hc = carry_into & 1 << 4;
-	u16 carry = carry_into & 1 << 8;
-
-	u8 res = (u8) sum;
-	self->regs[REG_F] = (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (carry ? F_C : 0);
-	self->regs[REG_A] = res;
-
+	AluResult res = alu_add(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
@@ -399,24 +356,16 @@ static u8 inst_di(Cpu* self) {
 }
 
 static u8 inst_or(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-	u8 res = value | value2;
-
-	self->regs[REG_F] = res == 0 ? F_Z : 0;
-	self->regs[REG_A] = res;
-
+	AluResult res = alu_or(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
 static u8 inst_and(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-	u8 res = value & value2;
-
-	self->regs[REG_F] = (res == 0 ? F_Z : 0) | F_H;
-	self->regs[REG_A] = res;
-
+	AluResult res = alu_and(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
@@ -429,16 +378,9 @@ static u8 inst_rra(Cpu* self) {
 }
 
 static u8 inst_adc(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-	u8 prev_c = (self->regs[REG_F] & F_C) > 0 ? 1 : 0;
-
-	bool hc = ((value & 0xF) + (value2 & 0xF) + prev_c) & 1 << 4;
-	u16 res = value + value2 + prev_c;
-	u8 trunc_res = res & 0xFF;
-	self->regs[REG_F] = (trunc_res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (res > 0xFF ? F_C : 0);
-	self->regs[REG_A] = trunc_res;
-
+	AluResult res = alu_adc(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
@@ -456,16 +398,9 @@ static u8 inst_rlca(Cpu* self) {
 }
 
 static u8 inst_sbc(Cpu* self) {
-	u8 value = self->regs[REG_A];
-	u8 value2 = (u8) self->fetched_data;
-	u8 prev_c = (self->regs[REG_F] & F_C) > 0 ? 1 : 0;
-
-	bool hc = ((value & 0xF) - (value2 & 0xF) - prev_c) & 1 << 4;
-	u8 res = value - value2 - prev_c;
-	bool c = (value2 + prev_c) > value;
-	self->regs[REG_F] = (res == 0 ? F_Z : 0) | (hc ? F_H : 0) | (c ? F_C : 0) | F_N;
-	self->regs[REG_A] = res;
-
+	AluResult res = alu_sbc(self->regs[REG_A], (u8) self->fetched_data, self->regs[REG_F]);
+	self->regs[REG_F] = res.flags;
+	self->regs[REG_A] = res.value;
 	return 1;
 }
 
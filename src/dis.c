@@ -55,7 +55,7 @@ static const char* REG_NAMES[REG_MAX] = {
 	[REG_SP] = "SP"
 };
 
-static Reg CB_REGS[] = {
+static const Reg CB_REGS[] = {
 	[0] = REG_B,
 	[1] = REG_C,
 	[2] = REG_D,
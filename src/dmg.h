@@ -0,0 +1,6 @@
+#pragma once
+
+// T-cycles per second
+#define DMG_CLOCK_HZ 4194304
+// One frame is 154 lines of 456 dots (T-cycles), ~59.73 Hz
+#define DMG_FRAME_CYCLES 70224
@@ -1,18 +1,40 @@
 #include "emu.h"
+#include "dmg.h"
 #include "mbc/mbc1.h"
+#include "mbc/mbc3.h"
+#include "mbc/mbc5.h"
 #include "mbc/no_mbc.h"
+#include "resampler.h"
 #include "utils/fsize.h"
+#include "utils/rom_image.h"
+#include "wav_writer.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void emu_link_bus(Emulator* self);
+
+// Sets up an instance in memory the caller provides, e.g. one slot of an array of them.
+// Free it with emu_unload.
+void emu_init(Emulator* self) {
+	memset(self, 0, sizeof(Emulator));
+	self->bus.joyp = 0xFF;
+	self->audio_rate = 48000;
+	self->resampler_quality = RESAMPLER_MEDIUM;
+	self->rtc_speed = 1;
+	apu_reset(&self->bus.apu);
+	ppu_reset(&self->bus.ppu);
+	emu_link_bus(self);
+}
 
-Emulator emu_new() {
-	Emulator emu = {};
-	emu.bus.cpu.bus = &emu.bus;
-	emu.bus.ppu.bus = &emu.bus;
-	emu.bus.timer.bus = &emu.bus;
-	emu.bus.joyp = 0xFF;
-	ppu_reset(&emu.bus.ppu);
-	return emu;
+Emulator* emu_new() {
+	Emulator* self = malloc(sizeof(Emulator));
+	if (!self) {
+		return NULL;
+	}
+	emu_init(self);
+	return self;
 }
 
 bool emu_load_boot_rom(Emulator* self, const char* path) {
@@ -30,25 +52,96 @@ bool emu_load_boot_rom(Emulator* self, const char* path) {
 	return true;
 }
 
+static bool cart_has_battery(u8 type) {
+	return type == 0x03 || type == 0x06 || type == 0x09 || type == 0x0D || type == 0x0F ||
+		type == 0x10 || type == 0x13 || type == 0x1B || type == 0x1E || type == 0x22 || type == 0xFF;
+}
+
+static bool cart_has_rtc(u8 type) {
+	return type == 0x0F || type == 0x10;
+}
+
+static bool cart_supported(u8 type) {
+	return type <= 3 || (type >= 0x0F && type <= 0x13) || (type >= 0x19 && type <= 0x1E);
+}
+
+static void emu_load_battery(Emulator* self);
+
+// Fails without changing anything, an emulator that had a rom keeps it. Otherwise the rom
+// loaded before is unloaded like with emu_unload, its battery ram saved.
 bool emu_load_rom(Emulator* self, const char* path) {
-	usize size = fsize(path);
-	if (!size) {
+	RomImage* image = rom_image_open(path);
+	if (!image) {
+		return false;
+	}
+	// Compressed roms keep decompressing while the rest is set up, only the header is needed now
+	usize size = rom_image_size(image);
+	if (size < 0x100 + sizeof(CartHdr) || !rom_image_wait(image, 0x100 + sizeof(CartHdr))) {
+		rom_image_release(image);
 		return false;
 	}
+	const CartHdr* file_hdr = (const CartHdr*) (rom_image_data(image) + 0x100);
 
-	self->bus.cart.data = malloc(size);
-	if (!self->bus.cart.data) {
+	// 32KiB << n up to 8MiB (512 banks), the odd 0x52-0x54 sizes never shipped
+	if (file_hdr->rom_size > 8) {
+		fprintf(stderr, "error: unsupported rom size code %X\n", file_hdr->rom_size);
+		rom_image_release(image);
+		return false;
+	}
+	u8 type = file_hdr->type;
+	if (!cart_supported(type)) {
+		fprintf(stderr, "error: unsupported cartridge type %X\n", type);
+		rom_image_release(image);
 		return false;
 	}
+	usize rom_banks = 2 << file_hdr->rom_size;
+	usize rom_size = (1024 * 32) * (1 << file_hdr->rom_size);
+	if (size != rom_size) {
+		fprintf(stderr, "warning: rom file is %zu bytes but the header says %zu\n", size, rom_size);
+	}
 
-	FILE* file = fopen(path, "rb");
-	fread(self->bus.cart.data, size, 1, file);
-	fclose(file);
+	// Masked bank reads have to stay inside, a short dump gets a private copy padded with 0
+	if (size < rom_size) {
+		u8* padded = calloc(1, rom_size);
+		RomImage* padded_image = padded ? rom_image_from_buffer(padded, rom_size) : NULL;
+		if (!padded_image || !rom_image_wait(image, size)) {
+			if (padded_image) {
+				rom_image_release(padded_image);
+			}
+			else {
+				free(padded);
+			}
+			rom_image_release(image);
+			return false;
+		}
+		memcpy(padded, rom_image_data(image), size);
+		rom_image_release(image);
+		image = padded_image;
+	}
+
+	char* save_path = NULL;
+	if (cart_has_battery(type) && !self->no_save) {
+		// <rom without extension>.sav
+		const char* ext = strrchr(path, '.');
+		usize base_len = ext && !strchr(ext, '/') ? (usize) (ext - path) : strlen(path);
+		save_path = malloc(base_len + 5);
+		if (!save_path) {
+			rom_image_release(image);
+			return false;
+		}
+		memcpy(save_path, path, base_len);
+		memcpy(save_path + base_len, ".sav", 5);
+	}
+
+	if (self->bus.cart.image) {
+		emu_unload(self);
+	}
+	self->bus.cart.image = image;
+	self->bus.cart.data = rom_image_data(image);
+	self->bus.audio_only = false;
 
 	const CartHdr* hdr = (const CartHdr*) (self->bus.cart.data + 0x100);
 
-	usize rom_banks = 2 << hdr->rom_size;
-	usize rom_size = (1024 * 32) * (1 << hdr->rom_size);
 	usize ram_size = 0;
 	if (hdr->ram_size == 1) {
 		ram_size = 1024;
@@ -66,57 +159,158 @@ bool emu_load_rom(Emulator* self, const char* path) {
 		ram_size = 1024 * 64;
 	}
 
-	if (ram_size) {
-		self->bus.cart.ram = malloc(ram_size);
-		if (!self->bus.cart.ram) {
-			return false;
-		}
-	}
-
 	self->bus.cart.rom_size = rom_size;
 	self->bus.cart.ram_size = ram_size;
 	self->bus.cart.num_rom_banks = rom_banks;
 	self->bus.cart.hdr = hdr;
 
-	Mapper* mapper = NULL;
 	// ROM ONLY
 	if (hdr->type == 0) {
-		mapper = no_mbc_new(&self->bus.cart);
+		no_mbc_init(&self->bus.cart);
 	}
 	// MBC1/MBC1+RAM/MBC1+RAM+BATTERY
 	else if (hdr->type == 1 || hdr->type == 2 || hdr->type == 3) {
-		mapper = mbc1_new(&self->bus.cart);
-	}
-	else if (hdr->type == 0x13) {
-		fprintf(stderr, "warning: using mbc1 for mbc3 rom\n");
-		mapper = mbc1_new(&self->bus.cart);
+		mbc1_init(&self->bus.cart);
 	}
 	// MBC3+TIMER+BATTERY/MBC3+TIMER+RAM+BATTERY/MBC3/MBC3+RAM/MBC3+RAM+BATTERY
+	else if (hdr->type >= 0x0F && hdr->type <= 0x13) {
+		mbc3_init(&self->bus.cart, cart_has_rtc(hdr->type));
+		if (cart_has_rtc(hdr->type)) {
+			mbc3_set_rtc_speed(self->bus.cart.mapper, self->rtc_speed);
+		}
+	}
+	// MBC5/MBC5+RAM/MBC5+RAM+BATTERY/MBC5+RUMBLE/MBC5+RUMBLE+RAM/MBC5+RUMBLE+RAM+BATTERY
 	else {
-		fprintf(stderr, "error: unsupported cartridge type %X\n", hdr->type);
-		exit(1);
+		mbc5_init(&self->bus.cart, hdr->type >= 0x1C);
 	}
 
-	if (!mapper) {
-		return false;
+	if (save_path) {
+		self->save_path = save_path;
+		emu_load_battery(self);
 	}
-	self->bus.cart.mapper = mapper;
 
 	return true;
 }
 
-#include <SDL.h>
+// Maps the save file when possible, otherwise reads it. Missing or short save files leave
+// the ram as it is.
+static void emu_load_battery(Emulator* self) {
+	Cart* cart = &self->bus.cart;
+	bool has_rtc = cart_has_rtc(cart->hdr->type);
+	// Some emulators write a 32-bit timestamp, the upper half stays zero then
+	usize rtc_min_size = cart->ram_size + MBC3_RTC_SAVE_SIZE - 4;
+
+	usize map_size = cart->ram_size + (has_rtc ? MBC3_RTC_SAVE_SIZE : 0);
+	usize existing_size;
+	self->save_file = map_size ? save_file_open(self->save_path, map_size, &existing_size) : NULL;
+	if (self->save_file) {
+		u8* data = save_file_data(self->save_file);
+		if (existing_size && existing_size < cart->ram_size) {
+			fprintf(stderr, "warning: save file %s is shorter than the cartridge ram\n", self->save_path);
+		}
+		memcpy(cart->ram, data, cart->ram_size);
+		if (has_rtc && existing_size >= rtc_min_size) {
+			mbc3_load_rtc(cart->mapper, data + cart->ram_size, (u64) time(NULL));
+		}
+		return;
+	}
 
-#define REAL_WIDTH 160
-#define REAL_HEIGHT 144
+	FILE* file = fopen(self->save_path, "rb");
+	if (!file) {
+		return;
+	}
 
-#define TILE_VIEWER_WIDTH (128 * 4)
-#define TILE_VIEWER_HEIGHT (128 * 4)
+	usize read = cart->ram_size ? fread(cart->ram, 1, cart->ram_size, file) : 0;
+	if (read < cart->ram_size) {
+		fprintf(stderr, "warning: save file %s is shorter than the cartridge ram\n", self->save_path);
+	}
+	else if (has_rtc) {
+		u8 rtc[MBC3_RTC_SAVE_SIZE] = {};
+		if (fread(rtc, 1, MBC3_RTC_SAVE_SIZE, file) >= MBC3_RTC_SAVE_SIZE - 4) {
+			mbc3_load_rtc(cart->mapper, rtc, (u64) time(NULL));
+		}
+	}
+	fclose(file);
+}
+
+// Copies the ram written during the frame into the mapping and hands it to the save file's
+// flush thread
+static void emu_mark_battery_dirty(Emulator* self) {
+	Cart* cart = &self->bus.cart;
+	if (cart->ram_dirty_start >= cart->ram_dirty_end) {
+		return;
+	}
+	if (self->save_file) {
+		usize start = cart->ram_dirty_start;
+		memcpy(save_file_data(self->save_file) + start, cart->ram + start, cart->ram_dirty_end - start);
+		save_file_mark_dirty(self->save_file, start, cart->ram_dirty_end);
+	}
+	cart->ram_dirty_start = 0;
+	cart->ram_dirty_end = 0;
+}
+
+// Writes the battery backed ram, and the clock for carts with one
+bool emu_save_battery(Emulator* self) {
+	Cart* cart = &self->bus.cart;
+	if (!self->save_path) {
+		return true;
+	}
 
-#define SPRITE_VIEWER_WIDTH (128 * 4)
-#define SPRITE_VIEWER_HEIGHT (128 * 4)
+	if (self->save_file) {
+		emu_mark_battery_dirty(self);
+		if (cart_has_rtc(cart->hdr->type)) {
+			mbc3_save_rtc(cart->mapper, save_file_data(self->save_file) + cart->ram_size, (u64) time(NULL));
+		}
+		if (!save_file_sync(self->save_file)) {
+			fprintf(stderr, "warning: failed to write %s\n", self->save_path);
+			return false;
+		}
+		return true;
+	}
+
+	FILE* file = fopen(self->save_path, "wb");
+	if (!file) {
+		fprintf(stderr, "warning: failed to open %s for saving\n", self->save_path);
+		return false;
+	}
+	bool ok = !cart->ram_size || fwrite(cart->ram, cart->ram_size, 1, file) == 1;
+	if (cart_has_rtc(cart->hdr->type)) {
+		u8 rtc[MBC3_RTC_SAVE_SIZE];
+		mbc3_save_rtc(cart->mapper, rtc, (u64) time(NULL));
+		ok = ok && fwrite(rtc, sizeof(rtc), 1, file) == 1;
+	}
+	if (fclose(file) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		fprintf(stderr, "warning: failed to write %s\n", self->save_path);
+	}
+	return ok;
+}
 
-void emu_run(Emulator* self) {
+// Points everything that refers to another part of the instance back at it, the only
+// fix-up a copy of the block needs
+static void emu_link_bus(Emulator* self) {
+	self->bus.cpu.bus = &self->bus;
+	self->bus.ppu.bus = &self->bus;
+	self->bus.timer.bus = &self->bus;
+	self->bus.ppu.texture = self->frame_target ? self->frame_target : self->framebuffer;
+	cart_rebind(&self->bus.cart);
+}
+
+// The rom has to be all there before the first instruction
+static bool emu_wait_rom(Emulator* self) {
+	RomImage* image = self->bus.cart.image;
+	if (image && !rom_image_wait(image, rom_image_size(image))) {
+		fprintf(stderr, "failed to load rom\n");
+		return false;
+	}
+	return true;
+}
+
+// Called before running, without a boot rom start with the state it leaves behind
+static void emu_prepare(Emulator* self) {
+	emu_link_bus(self);
 	// A: 01 F: B0 B: 00 C: 13 D: 00 E: D8 H: 01 L: 4D SP: FFFE PC: 00:0100 (00 C3 13 02)
 	if (!self->bus.bootrom_mapped) {
 		Cpu* cpu = &self->bus.cpu;
@@ -132,280 +326,356 @@ void emu_run(Emulator* self) {
 		cpu->pc = 0x100;
 		self->bus.ppu.lcdc |= 1 << 7;
 	}
+}
 
-	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
-	SDL_Window* window = SDL_CreateWindow(
-		"qgbe",
-		SDL_WINDOWPOS_CENTERED,
-		SDL_WINDOWPOS_CENTERED,
-		REAL_WIDTH * 4,
-		REAL_HEIGHT * 4,
-		SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE);
+// Whether a frame that has run for cycles M cycles is over, the caller clears frame_ready
+bool emu_frame_done(const Emulator* self, usize cycles) {
+	const Ppu* ppu = &self->bus.ppu;
+	// With the lcd off there are no frames, end one after the same time instead
+	return ppu->frame_ready || (!(ppu->lcdc & 1 << 7) && cycles >= DMG_FRAME_CYCLES / 4);
+}
 
-	SDL_Renderer* renderer = SDL_CreateRenderer(window, 0,  SDL_RENDERER_ACCELERATED);
+static void emu_run_frame(Emulator* self) {
+	usize cycles = 0;
+	while (!emu_frame_done(self, cycles)) {
+		bus_cycle(&self->bus);
+		cycles += 1;
+	}
+}
 
-	SDL_Texture* tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGRA8888, SDL_TEXTUREACCESS_STREAMING, REAL_WIDTH, REAL_HEIGHT);
-	u32* backing = (u32*) calloc(1, REAL_WIDTH * REAL_HEIGHT * 4);
-	for (usize i = 0; i < REAL_WIDTH; ++i) {
-		backing[i] = 0x00FF00FF;
-		backing[(REAL_HEIGHT - 1) * REAL_WIDTH + i] = 0x00FF00FF;
+// Ends the apu frame and takes its samples for the accessor and the callback
+static void emu_end_frame(Emulator* self) {
+	apu_end_frame(&self->bus.apu);
+	self->audio_frames = apu_read_samples(&self->bus.apu, self->audio, EMU_AUDIO_CAPACITY);
+	if (self->audio_callback && self->audio_frames) {
+		self->audio_callback(self->callback_arg, self->audio, self->audio_frames);
 	}
-	for (usize i = 0; i < REAL_HEIGHT; ++i) {
-		backing[i * REAL_WIDTH] = 0x00FF00FF;
-		backing[i * REAL_WIDTH + REAL_WIDTH - 1] = 0x00FF00FF;
+}
+
+// The parts of emu_step_frame before and after the cycles, for drivers that run those
+// themselves with bus_cycle until emu_frame_done. Begin fails only if the rom couldn't be loaded.
+bool emu_begin_frame(Emulator* self) {
+	if (!self->started) {
+		if (!emu_wait_rom(self)) {
+			return false;
+		}
+		emu_prepare(self);
+		if (self->mute) {
+			apu_set_output_enabled(&self->bus.apu, false);
+		}
+		self->started = true;
 	}
 
-	u32* tile_data_backing = (u32*) calloc(1, TILE_VIEWER_WIDTH * TILE_VIEWER_HEIGHT * 4);
-	u32* sprite_data_backing = (u32*) calloc(1, SPRITE_VIEWER_WIDTH * SPRITE_VIEWER_HEIGHT * 4);
+	ppu_clear_dirty_lines(&self->bus.ppu);
+	bus_set_buttons(&self->bus, self->buttons);
+	return true;
+}
 
-	self->bus.ppu.texture = backing;
+void emu_finish_frame(Emulator* self) {
+	Ppu* ppu = &self->bus.ppu;
+	emu_mark_battery_dirty(self);
+	if (ppu->renderer) {
+		ppu_renderer_wait_frame(ppu);
+	}
+	ppu->frame_ready = false;
 
-	SDL_UpdateTexture(tex, NULL, backing, REAL_WIDTH * 4);
+	if (self->frame_callback) {
+		self->frame_callback(self->callback_arg, ppu->texture, ppu->dirty_lines);
+	}
+	emu_end_frame(self);
+}
 
-	const u8* key_state = SDL_GetKeyboardState(NULL);
+// Runs one frame with the buttons set before it. Afterwards the accessors return what it
+// produced and the callbacks have been called. Fails only if the rom couldn't be loaded.
+bool emu_step_frame(Emulator* self) {
+	if (!emu_begin_frame(self)) {
+		return false;
+	}
+	emu_run_frame(self);
+	emu_finish_frame(self);
+	return true;
+}
 
-	SDL_Scancode key_down = SDL_SCANCODE_DOWN;
-	SDL_Scancode key_up = SDL_SCANCODE_UP;
-	SDL_Scancode key_left = SDL_SCANCODE_LEFT;
-	SDL_Scancode key_right = SDL_SCANCODE_RIGHT;
+// BUTTON_* bits of the buttons held down, applied at the start of the next frame
+void emu_set_buttons(Emulator* self, u8 pressed) {
+	self->buttons = pressed;
+}
 
-	SDL_Scancode key_start = SDL_SCANCODE_RETURN;
-	SDL_Scancode key_select = SDL_SCANCODE_BACKSPACE;
-	SDL_Scancode key_b = SDL_SCANCODE_B;
-	SDL_Scancode key_a = SDL_SCANCODE_A;
+void emu_set_button(Emulator* self, Button button, bool pressed) {
+	self->buttons = pressed ? self->buttons | button : self->buttons & ~button;
+}
 
-	SDL_AudioSpec spec = {
-		.freq = 48000,
-		.format = AUDIO_F32SYS,
-		.channels = 2,
-		.samples = 2048
-	};
+// Makes the ppu draw into pixels (LCD_WIDTH * LCD_HEIGHT, 0xBBGGRRAA) from the next frame on,
+// NULL switches back to the emulator's own buffer
+void emu_set_framebuffer(Emulator* self, u32* pixels) {
+	self->frame_target = pixels;
+	self->bus.ppu.texture = pixels ? pixels : self->framebuffer;
+}
 
-	f32 audio_buffer[2048] = {};
-	usize audio_size = 0;
-	SDL_AudioDeviceID audio_dev = SDL_OpenAudioDevice(NULL, false, &spec, &spec, 0);
-	if (!audio_dev) {
-		fprintf(stderr, "failed to open audio device: %s\n", SDL_GetError());
-		SDL_DestroyRenderer(renderer);
-		SDL_DestroyWindow(window);
-		SDL_Quit();
-		return;
+const u32* emu_framebuffer(const Emulator* self) {
+	return self->frame_target ? self->frame_target : self->framebuffer;
+}
+
+// Lines that changed in the last frame, one bit each
+const u64* emu_dirty_lines(const Emulator* self) {
+	return self->bus.ppu.dirty_lines;
+}
+
+// The last frame's audio, interleaved stereo at APU_NATIVE_RATE. Valid until the next step.
+const f32* emu_audio_samples(const Emulator* self, u32* frames) {
+	*frames = self->audio_frames;
+	return self->audio;
+}
+
+// Called at the end of every step with the same data the accessors return, either may be NULL
+void emu_set_callbacks(Emulator* self, EmuFrameCallback frame, EmuAudioCallback audio, void* arg) {
+	self->frame_callback = frame;
+	self->audio_callback = audio;
+	self->callback_arg = arg;
+}
+
+// Copies a running instance into self, which must not hold a cart. The copy shares only
+// the read-only rom and goes on independently: it has no save file, renderer thread, stems
+// or callbacks and draws into its own framebuffer. Copying between frames on the thread
+// that steps src is the caller's job.
+void emu_copy(Emulator* self, const Emulator* src) {
+	memcpy(self, src, sizeof(Emulator));
+	self->save_path = NULL;
+	self->save_file = NULL;
+	self->frame_target = NULL;
+	self->frame_callback = NULL;
+	self->audio_callback = NULL;
+	self->callback_arg = NULL;
+	self->bus.serial_callback = NULL;
+	self->bus.serial_arg = NULL;
+	self->bus.ppu.renderer = NULL;
+	self->bus.ppu.timing_only = false;
+	self->bus.apu.stem_blip = NULL;
+	if (self->bus.cart.image) {
+		rom_image_retain(self->bus.cart.image);
 	}
-	SDL_PauseAudioDevice(audio_dev, false);
-
-	SDL_Window* tile_viewer_window = NULL;
-	SDL_Renderer* tile_renderer = NULL;
-	SDL_Texture* tile_view_tex = NULL;
-
-	SDL_Window* sprite_viewer_window = NULL;
-	SDL_Renderer* sprite_renderer = NULL;
-	SDL_Texture* sprite_view_tex = NULL;
-
-	Uint32 main_window_id = SDL_GetWindowID(window);
-	Uint32 tile_window_id = 0;
-	Uint32 sprite_window_id = 0;
-
-	bool running = true;
-	f64 delta;
-	Uint64 last_time = SDL_GetPerformanceCounter();
-	Uint64 perf_freq = SDL_GetPerformanceFrequency();
-	while (running) {
-		SDL_Event event;
-		while (SDL_PollEvent(&event)) {
-			if (event.type == SDL_WINDOWEVENT) {
-				if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
-					if (event.window.windowID == main_window_id) {
-						running = false;
-					}
-					else if (event.window.windowID == tile_window_id) {
-						SDL_DestroyTexture(tile_view_tex);
-						SDL_DestroyRenderer(tile_renderer);
-						SDL_DestroyWindow(tile_viewer_window);
-						tile_window_id = 0;
-					}
-					else if (event.window.windowID == sprite_window_id) {
-						SDL_DestroyTexture(sprite_view_tex);
-						SDL_DestroyRenderer(sprite_renderer);
-						SDL_DestroyWindow(sprite_viewer_window);
-						sprite_window_id = 0;
-					}
-				}
-				else if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
-					SDL_RenderSetLogicalSize(renderer, REAL_WIDTH * 4, REAL_HEIGHT * 4);
-				}
-			}
-			else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_t && event.key.keysym.mod & KMOD_CTRL) {
-				if (!tile_window_id) {
-					tile_viewer_window = SDL_CreateWindow(
-						"qgbe tile viewer",
-						SDL_WINDOWPOS_UNDEFINED,
-						SDL_WINDOWPOS_UNDEFINED,
-						TILE_VIEWER_WIDTH,
-						TILE_VIEWER_HEIGHT,
-						0);
-					tile_window_id = SDL_GetWindowID(tile_viewer_window);
-					tile_renderer = SDL_CreateRenderer(tile_viewer_window, 0, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-					tile_view_tex = SDL_CreateTexture(
-						tile_renderer,
-						SDL_PIXELFORMAT_BGRA8888,
-						SDL_TEXTUREACCESS_STREAMING,
-						TILE_VIEWER_WIDTH,
-						TILE_VIEWER_HEIGHT);
-				}
-			}
-			else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_s && event.key.keysym.mod & KMOD_CTRL) {
-				if (!sprite_window_id) {
-					sprite_viewer_window = SDL_CreateWindow(
-						"qgbe sprite viewer",
-						SDL_WINDOWPOS_UNDEFINED,
-						SDL_WINDOWPOS_UNDEFINED,
-						SPRITE_VIEWER_WIDTH,
-						SPRITE_VIEWER_HEIGHT,
-						0);
-					sprite_window_id = SDL_GetWindowID(sprite_viewer_window);
-					sprite_renderer = SDL_CreateRenderer(sprite_viewer_window, 0, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
-					sprite_view_tex = SDL_CreateTexture(
-						sprite_renderer,
-						SDL_PIXELFORMAT_BGRA8888,
-						SDL_TEXTUREACCESS_STREAMING,
-						SPRITE_VIEWER_WIDTH,
-						SPRITE_VIEWER_HEIGHT);
-				}
-			}
-		}
+	emu_link_bus(self);
+}
 
-		u8* joyp = &self->bus.joyp;
+Emulator* emu_clone(const Emulator* self) {
+	Emulator* clone = malloc(sizeof(Emulator));
+	if (!clone) {
+		return NULL;
+	}
+	emu_copy(clone, self);
+	return clone;
+}
 
-		// Actions
-		if (*joyp & 1 << 5) {
-			if (key_state[key_start]) {
-				*joyp &= ~(1 << 3);
-			}
-			else {
-				*joyp |= 1 << 3;
-			}
+// Bytes the game sends over the link cable, instead of printing them to stderr
+void emu_set_serial_callback(Emulator* self, SerialCallback callback, void* arg) {
+	self->bus.serial_callback = callback;
+	self->bus.serial_arg = arg;
+}
 
-			if (key_state[key_select]) {
-				*joyp &= ~(1 << 2);
-			}
-			else {
-				*joyp |= 1 << 2;
-			}
+// Saves the battery ram, frees the cart and puts the machine back to how emu_init left it,
+// the emulator can load another rom afterwards. The settings, callbacks and frame target
+// stay, a boot rom has to be loaded again.
+void emu_unload(Emulator* self) {
+	ppu_renderer_stop(&self->bus.ppu);
+	apu_set_stems_enabled(&self->bus.apu, false);
+	emu_save_battery(self);
+	free(self->save_path);
+	if (self->save_file) {
+		save_file_close(self->save_file);
+	}
+	if (self->bus.cart.image) {
+		rom_image_release(self->bus.cart.image);
+	}
 
-			if (key_state[key_b]) {
-				*joyp &= ~(1 << 1);
-			}
-			else {
-				*joyp |= 1 << 1;
-			}
+	PpuRenderMode ppu_render_mode = self->ppu_render_mode;
+	u32 audio_rate = self->audio_rate;
+	ResamplerQuality resampler_quality = self->resampler_quality;
+	bool mute = self->mute;
+	u32 rtc_speed = self->rtc_speed;
+	bool no_save = self->no_save;
+	u32* frame_target = self->frame_target;
+	EmuFrameCallback frame_callback = self->frame_callback;
+	EmuAudioCallback audio_callback = self->audio_callback;
+	void* callback_arg = self->callback_arg;
+	SerialCallback serial_callback = self->bus.serial_callback;
+	void* serial_arg = self->bus.serial_arg;
+
+	emu_init(self);
+	self->ppu_render_mode = ppu_render_mode;
+	self->audio_rate = audio_rate;
+	self->resampler_quality = resampler_quality;
+	self->mute = mute;
+	self->rtc_speed = rtc_speed;
+	self->no_save = no_save;
+	self->frame_target = frame_target;
+	self->frame_callback = frame_callback;
+	self->audio_callback = audio_callback;
+	self->callback_arg = callback_arg;
+	self->bus.serial_callback = serial_callback;
+	self->bus.serial_arg = serial_arg;
+	emu_link_bus(self);
+}
 
-			if (key_state[key_a]) {
-				*joyp &= ~(1 << 0);
-			}
-			else {
-				*joyp |= 1 << 0;
-			}
-		}
-		if (*joyp & 1 << 4) {
-			if (key_state[key_down]) {
-				*joyp &= ~(1 << 3);
-			}
-			else {
-				*joyp |= 1 << 3;
-			}
+void emu_free(Emulator* self) {
+	emu_unload(self);
+	free(self);
+}
 
-			if (key_state[key_up]) {
-				*joyp &= ~(1 << 2);
-			}
-			else {
-				*joyp |= 1 << 2;
-			}
+// Makes room for frames stereo frames in *buffer, what it holds is lost when it grows
+static bool emu_reserve_audio(f32** buffer, u32* capacity, u32 frames) {
+	if (frames <= *capacity) {
+		return true;
+	}
+	free(*buffer);
+	*buffer = malloc((usize) frames * 2 * sizeof(f32));
+	*capacity = *buffer ? frames : 0;
+	return *buffer;
+}
 
-			if (key_state[key_left]) {
-				*joyp &= ~(1 << 1);
-			}
-			else {
-				*joyp |= 1 << 1;
-			}
+// Renders frames frames of either the game or a gbs song as fast as the core goes
+static bool emu_render_wav(Emulator* self, Gbs* gbs, const char* path, bool stems, u32 frames) {
+	Apu* apu = &self->bus.apu;
+
+	// The mix, then the stems in pairs as the resampler is stereo
+	Resampler* resamplers[3] = {};
+	WavWriter* writers[5] = {};
+	bool ok = !stems || apu_set_stems_enabled(apu, true);
+	for (u8 i = 0; ok && i < (stems ? 3 : 1); ++i) {
+		resamplers[i] = resampler_new(self->resampler_quality, APU_NATIVE_RATE, self->audio_rate);
+		ok = resamplers[i];
+	}
+	if (!ok) {
+		fprintf(stderr, "failed to allocate the audio buffers\n");
+	}
+	else if (!(writers[0] = wav_writer_new(path, self->audio_rate, 2))) {
+		fprintf(stderr, "failed to create %s\n", path);
+		ok = false;
+	}
 
-			if (key_state[key_right]) {
-				*joyp &= ~(1 << 0);
-			}
-			else {
-				*joyp |= 1 << 0;
-			}
+	usize base_len = strlen(path);
+	if (base_len >= 4 && strcmp(path + base_len - 4, ".wav") == 0) {
+		base_len -= 4;
+	}
+	for (u8 i = 0; ok && stems && i < 4; ++i) {
+		char stem_path[4096];
+		snprintf(stem_path, sizeof(stem_path), "%.*s.ch%u.wav", (int) base_len, path, i + 1);
+		writers[1 + i] = wav_writer_new(stem_path, self->audio_rate, 1);
+		if (!writers[1 + i]) {
+			fprintf(stderr, "failed to create %s\n", stem_path);
+			ok = false;
 		}
+	}
 
-		usize cycles = 0;
-		while (!self->bus.ppu.frame_ready) {
-			bus_cycle(&self->bus);
-			if (cycles % 22 == 0) {
-				apu_gen_sample(&self->bus.apu, audio_buffer + audio_size);
-				audio_size += 2;
-				if (audio_size == sizeof(audio_buffer) / sizeof(*audio_buffer)) {
-					SDL_QueueAudio(audio_dev, audio_buffer, audio_size * sizeof(f32));
-					audio_size = 0;
+	f32 stem_native[1024 * 4];
+	f32 pair[1024 * 2];
+	// Sized for resampler_max_output, the stems are split into the two halves of mono
+	f32* out = NULL;
+	u32 out_capacity = 0;
+	f32* mono = NULL;
+	u32 mono_capacity = 0;
+	for (u32 frame = 0; ok && frame < frames; ++frame) {
+		if (gbs) {
+			emu_step_gbs(self, gbs);
+		}
+		else if (!emu_step_frame(self)) {
+			ok = false;
+			break;
+		}
+
+		u32 count;
+		const f32* native = emu_audio_samples(self, &count);
+		while (ok && count) {
+			u32 chunk = count < 1024 ? count : 1024;
+			ok = emu_reserve_audio(&out, &out_capacity, resampler_max_output(resamplers[0], chunk));
+			if (ok) {
+				u32 produced = resampler_process(resamplers[0], native, chunk, out, out_capacity);
+				wav_writer_write(writers[0], out, produced);
+				native += chunk * 2;
+				count -= chunk;
+			}
+		}
+		while (ok && stems && (count = apu_read_stem_samples(apu, stem_native, 1024))) {
+			for (u8 p = 0; ok && p < 2; ++p) {
+				u32 max_frames = resampler_max_output(resamplers[1 + p], count);
+				ok = emu_reserve_audio(&out, &out_capacity, max_frames) &&
+					emu_reserve_audio(&mono, &mono_capacity, max_frames);
+				if (!ok) {
+					break;
+				}
+				for (u32 i = 0; i < count; ++i) {
+					pair[i * 2] = stem_native[i * 4 + p * 2];
+					pair[i * 2 + 1] = stem_native[i * 4 + p * 2 + 1];
+				}
+				u32 produced = resampler_process(resamplers[1 + p], pair, count, out, out_capacity);
+				for (u32 i = 0; i < produced; ++i) {
+					mono[i] = out[i * 2];
+					mono[produced + i] = out[i * 2 + 1];
 				}
+				wav_writer_write(writers[1 + p * 2], mono, produced);
+				wav_writer_write(writers[2 + p * 2], mono + produced, produced);
 			}
-			cycles += 1;
 		}
-
-		SDL_UpdateTexture(tex, NULL, backing, REAL_WIDTH * 4);
-		self->bus.ppu.frame_ready = false;
-		SDL_RenderClear(renderer);
-		SDL_RenderCopy(renderer, tex, NULL, NULL);
-		SDL_RenderPresent(renderer);
-
-		if (tile_window_id) {
-			ppu_generate_tile_map(&self->bus.ppu, TILE_VIEWER_WIDTH, TILE_VIEWER_HEIGHT, tile_data_backing);
-			SDL_UpdateTexture(tile_view_tex, NULL, tile_data_backing, TILE_VIEWER_WIDTH * 4);
-			SDL_RenderClear(tile_renderer);
-			SDL_RenderCopy(tile_renderer, tile_view_tex, NULL, NULL);
-			SDL_RenderPresent(tile_renderer);
+		if (!ok) {
+			fprintf(stderr, "failed to allocate the audio buffers\n");
 		}
+	}
+	free(out);
+	free(mono);
 
-		if (sprite_window_id) {
-			ppu_generate_sprite_map(&self->bus.ppu, SPRITE_VIEWER_WIDTH, SPRITE_VIEWER_HEIGHT, sprite_data_backing);
-			SDL_UpdateTexture(sprite_view_tex, NULL, sprite_data_backing, SPRITE_VIEWER_WIDTH * 4);
-			SDL_RenderClear(sprite_renderer);
-			SDL_RenderCopy(sprite_renderer, sprite_view_tex, NULL, NULL);
-			SDL_RenderPresent(sprite_renderer);
+	for (u8 i = 0; i < 5; ++i) {
+		if (writers[i] && !wav_writer_close(writers[i])) {
+			fprintf(stderr, "failed to write %s\n", i ? "a stem" : path);
+			ok = false;
 		}
-
-		Uint64 cur_time = SDL_GetPerformanceCounter();
-		Uint64 delta_ticks = cur_time - last_time;
-		last_time = cur_time;
-		const f64 wanted_delta = 1.0 / 60.0f;
-		delta = (f64) delta_ticks / (f64) perf_freq;
-		//fprintf(stderr, "delta: %f, fps: %d\n", delta, (int) (1.0f / delta));
-		if (delta < wanted_delta) {
-			SDL_Delay((Uint32) ((wanted_delta - delta) * 1000));
+	}
+	for (u8 i = 0; i < 3; ++i) {
+		if (resamplers[i]) {
+			resampler_free(resamplers[i]);
 		}
 	}
+	apu_set_stems_enabled(apu, false);
+	return ok;
+}
 
-	if (tile_window_id) {
-		SDL_DestroyTexture(tile_view_tex);
-		SDL_DestroyRenderer(tile_renderer);
-		SDL_DestroyWindow(tile_viewer_window);
+// Runs frames frames without a window or audio device as fast as the core goes and writes
+// the audio to a wav file at the configured rate. With stems every channel also goes to
+// its own file next to it, <path without .wav>.ch1.wav to .ch4.wav.
+bool emu_render_audio(Emulator* self, const char* path, bool stems, u32 frames) {
+	bool ok = emu_render_wav(self, NULL, path, stems, frames);
+	return emu_save_battery(self) && ok;
+}
+
+// Loads a gbs file in place of a rom with only the cpu, timer and apu running.
+// song is 0-based, or the file's default if it's out of range. A rom or gbs loaded before
+// is unloaded first, also when this one fails.
+bool emu_load_gbs(Emulator* self, Gbs* gbs, const char* path, u32 song) {
+	if (self->bus.cart.image) {
+		emu_unload(self);
 	}
-	if (sprite_window_id) {
-		SDL_DestroyTexture(sprite_view_tex);
-		SDL_DestroyRenderer(sprite_renderer);
-		SDL_DestroyWindow(sprite_viewer_window);
+	if (!gbs_load(gbs, &self->bus.cart, path)) {
+		fprintf(stderr, "failed to load gbs %s\n", path);
+		return false;
 	}
-	SDL_DestroyTexture(tex);
-	free(backing);
-	free(tile_data_backing);
-	free(sprite_data_backing);
-	SDL_CloseAudioDevice(audio_dev);
-	SDL_DestroyRenderer(renderer);
-	SDL_DestroyWindow(window);
-	SDL_Quit();
-
-	if (self->bus.cart.data) {
-		free(self->bus.cart.data);
+	if (song >= gbs->song_count) {
+		song = gbs->first_song - 1;
 	}
-	if (self->bus.cart.ram) {
-		free(self->bus.cart.ram);
+	emu_link_bus(self);
+	self->bus.audio_only = true;
+	if (self->mute) {
+		apu_set_output_enabled(&self->bus.apu, false);
 	}
-}
\ No newline at end of file
+	gbs_start_song(gbs, &self->bus, (u8) song);
+	self->started = true;
+	return true;
+}
+
+// A frame's worth of the song, the audio goes to the accessor and the callback like with emu_step_frame
+void emu_step_gbs(Emulator* self, Gbs* gbs) {
+	gbs_run(gbs, &self->bus, DMG_FRAME_CYCLES / 4);
+	emu_end_frame(self);
+}
+
+// Renders frames frames of the song into a wav file like emu_render_audio
+bool emu_render_gbs(Emulator* self, Gbs* gbs, const char* path, bool stems, u32 frames) {
+	return emu_render_wav(self, gbs, path, stems, frames);
+}
@@ -1,12 +1,77 @@
 #pragma once
 #include "types.h"
 #include "bus.h"
+#include "gbs.h"
+#include "utils/save_file.h"
+#include "ppu_thread.h"
+#include "resampler.h"
+
+// The headless core. Load a rom, then call emu_step_frame in a loop and read the frame and
+// the audio it produced through the accessors or the callbacks, no copies are made.
+// An instance is one block with no global state behind it, so any number of them can run
+// on their own threads, and a copy made with emu_copy picks up exactly where the original is.
+
+// Enough for a frame of native rate audio with room to spare
+#define EMU_AUDIO_CAPACITY 4096
+
+typedef void (*EmuFrameCallback)(void* arg, const u32* pixels, const u64* dirty_lines);
+// Interleaved stereo at APU_NATIVE_RATE
+typedef void (*EmuAudioCallback)(void* arg, const f32* samples, u32 frames);
 
 typedef struct {
 	Bus bus;
+	PpuRenderMode ppu_render_mode;
+	// Rate audio files are written at and frontends resample to
+	u32 audio_rate;
+	ResamplerQuality resampler_quality;
+	// The apu skips everything only needed for sound, no samples are produced
+	bool mute;
+	// How many times faster than emulated time the cartridge clock runs
+	u32 rtc_speed;
+	// Battery backed ram starts out blank and is never saved, for throwaway instances
+	bool no_save;
+	// Battery backed carts only
+	char* save_path;
+	// Mirrors the cart's ram into the mapped save file, NULL if it's written on saving instead
+	SaveFile* save_file;
+
+	// Set by the first emu_step_frame
+	bool started;
+	u8 buttons;
+	// Where the ppu draws, framebuffer unless the caller gave its own
+	u32* frame_target;
+	u32 framebuffer[LCD_WIDTH * LCD_HEIGHT];
+	f32 audio[EMU_AUDIO_CAPACITY * 2];
+	u32 audio_frames;
+	EmuFrameCallback frame_callback;
+	EmuAudioCallback audio_callback;
+	void* callback_arg;
 } Emulator;
 
-Emulator emu_new();
+Emulator* emu_new();
+void emu_init(Emulator* self);
+Emulator* emu_clone(const Emulator* self);
+void emu_copy(Emulator* self, const Emulator* src);
+void emu_unload(Emulator* self);
+void emu_free(Emulator* self);
 bool emu_load_boot_rom(Emulator* self, const char* path);
 bool emu_load_rom(Emulator* self, const char* path);
-void emu_run(Emulator* self);
+bool emu_save_battery(Emulator* self);
+
+bool emu_step_frame(Emulator* self);
+bool emu_begin_frame(Emulator* self);
+bool emu_frame_done(const Emulator* self, usize cycles);
+void emu_finish_frame(Emulator* self);
+void emu_set_buttons(Emulator* self, u8 pressed);
+void emu_set_button(Emulator* self, Button button, bool pressed);
+void emu_set_framebuffer(Emulator* self, u32* pixels);
+const u32* emu_framebuffer(const Emulator* self);
+const u64* emu_dirty_lines(const Emulator* self);
+const f32* emu_audio_samples(const Emulator* self, u32* frames);
+void emu_set_callbacks(Emulator* self, EmuFrameCallback frame, EmuAudioCallback audio, void* arg);
+void emu_set_serial_callback(Emulator* self, SerialCallback callback, void* arg);
+
+bool emu_render_audio(Emulator* self, const char* path, bool stems, u32 frames);
+bool emu_load_gbs(Emulator* self, Gbs* gbs, const char* path, u32 song);
+void emu_step_gbs(Emulator* self, Gbs* gbs);
+bool emu_render_gbs(Emulator* self, Gbs* gbs, const char* path, bool stems, u32 frames);
@@ -0,0 +1,619 @@
+#include "frontend.h"
+#include "dmg.h"
+#include "pacer.h"
+#include "utils/ring_buffer.h"
+#include "utils/triple_buffer.h"
+#include "viewer.h"
+#include <SDL.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REAL_WIDTH 160
+#define REAL_HEIGHT 144
+
+#define VIEWER_MAX_FPS 15
+#define STATS_INTERVAL_MS 1000
+// How far the output rate may be bent to keep the audio ring at its target fill
+#define AUDIO_RATE_CONTROL_DELTA 0.005
+#define AUDIO_DEVICE_SAMPLES 512
+
+typedef struct {
+	u32 pixels[REAL_WIDTH * REAL_HEIGHT];
+	// Lines that changed since the frame before it, including frames the presenter skipped
+	u64 dirty_lines[(REAL_HEIGHT + 63) / 64];
+} Frame;
+
+// State shared between the presentation (main) thread and the emulation thread
+typedef struct {
+	Emulator* emu;
+	const FrontendConfig* config;
+	SDL_AudioDeviceID audio_dev;
+	Resampler* resampler;
+	// Resampler output, grown to what resampler_max_output asks for
+	f32* audio_buffer;
+	u32 audio_buffer_capacity;
+	RingBuffer audio_ring;
+	// Stereo sample pairs the ring is kept at, and the device rate
+	u32 audio_target;
+	u32 audio_rate;
+	bool audio_sync;
+	SDL_sem* audio_sem;
+	Viewer* viewer;
+	Pacer* pacer;
+	SDL_sem* frame_sem;
+	TripleBuffer frame_buffer;
+	Frame frames[3];
+	atomic_bool running;
+	atomic_uchar buttons;
+} EmuThread;
+
+static bool line_dirty(const u64* dirty_lines, u8 line) {
+	return dirty_lines[line / 64] & 1ULL << (line % 64);
+}
+
+// Uploads the runs of lines that changed since the last frame, returns whether there were any.
+// Every source line covers scale rows of the texture.
+static bool upload_dirty_lines(SDL_Texture* tex, const u32* pixels, const u64* dirty_lines, u32 scale) {
+	u32 width = REAL_WIDTH * scale;
+	bool dirty = false;
+	for (u8 y = 0; y < REAL_HEIGHT;) {
+		if (!line_dirty(dirty_lines, y)) {
+			y += 1;
+			continue;
+		}
+
+		u8 start = y;
+		while (y < REAL_HEIGHT && line_dirty(dirty_lines, y)) {
+			y += 1;
+		}
+		SDL_Rect rect = {0, (int) (start * scale), (int) width, (int) ((y - start) * scale)};
+		SDL_UpdateTexture(tex, &rect, pixels + start * scale * width, (int) (width * 4));
+		dirty = true;
+	}
+	return dirty;
+}
+
+static void scaled_frame_ready(void* arg) {
+	SDL_SemPost((SDL_sem*) arg);
+}
+
+static void audio_callback(void* arg, Uint8* stream, int len) {
+	EmuThread* ctx = (EmuThread*) arg;
+	f32* out = (f32*) stream;
+	u32 count = (u32) len / sizeof(f32);
+	u32 read = ring_buffer_read(&ctx->audio_ring, out, count);
+	// Underrun, better a gap than repeating old samples
+	memset(out + read, 0, (count - read) * sizeof(f32));
+	if (ctx->audio_sync) {
+		SDL_SemPost(ctx->audio_sem);
+	}
+}
+
+// Bends the resampler output rate slightly so the ring stays around the target,
+// too little in it raises the rate and too much lowers it
+static void audio_rate_control(EmuThread* ctx) {
+	f64 fill = (f64) (ring_buffer_size(&ctx->audio_ring) / 2) / (f64) ctx->audio_target;
+	f64 adjust = 1.0 + AUDIO_RATE_CONTROL_DELTA * (1.0 - fill);
+	if (adjust < 1.0 - AUDIO_RATE_CONTROL_DELTA) {
+		adjust = 1.0 - AUDIO_RATE_CONTROL_DELTA;
+	}
+	else if (adjust > 1.0 + AUDIO_RATE_CONTROL_DELTA) {
+		adjust = 1.0 + AUDIO_RATE_CONTROL_DELTA;
+	}
+	resampler_set_rates(ctx->resampler, APU_NATIVE_RATE, (f64) ctx->audio_rate * adjust);
+}
+
+static void frontend_close_audio(EmuThread* ctx) {
+	if (ctx->audio_dev) {
+		SDL_CloseAudioDevice(ctx->audio_dev);
+		ctx->audio_dev = 0;
+	}
+	if (ctx->audio_sem) {
+		SDL_DestroySemaphore(ctx->audio_sem);
+		ctx->audio_sem = NULL;
+	}
+	if (ctx->resampler) {
+		resampler_free(ctx->resampler);
+		ctx->resampler = NULL;
+	}
+	free(ctx->audio_buffer);
+	ctx->audio_buffer = NULL;
+	ctx->audio_buffer_capacity = 0;
+	ring_buffer_free(&ctx->audio_ring);
+}
+
+// Resamples a frame of native rate audio into the ring
+static void frontend_queue_audio(EmuThread* ctx, const f32* native, u32 count) {
+	while (count) {
+		u32 chunk = count < 1024 ? count : 1024;
+		u32 frames = resampler_max_output(ctx->resampler, chunk);
+		if (frames > ctx->audio_buffer_capacity) {
+			free(ctx->audio_buffer);
+			ctx->audio_buffer = malloc((usize) frames * 2 * sizeof(f32));
+			ctx->audio_buffer_capacity = ctx->audio_buffer ? frames : 0;
+			// The frame's audio is dropped, the device plays a gap
+			if (!ctx->audio_buffer) {
+				return;
+			}
+		}
+		u32 samples = resampler_process(ctx->resampler, native, chunk, ctx->audio_buffer, ctx->audio_buffer_capacity);
+		ring_buffer_write(&ctx->audio_ring, ctx->audio_buffer, samples * 2);
+		native += chunk * 2;
+		count -= chunk;
+	}
+}
+
+// Sets up the ring, resampler and device for ctx at the configured rate, the device starts paused
+static bool frontend_open_audio(Emulator* self, EmuThread* ctx) {
+	const FrontendConfig* config = ctx->config;
+	// No changes allowed, SDL converts if the device wants something else
+	SDL_AudioSpec spec = {
+		.freq = (int) self->audio_rate,
+		.format = AUDIO_F32SYS,
+		.channels = 2,
+		.samples = AUDIO_DEVICE_SAMPLES,
+		.callback = audio_callback,
+		.userdata = ctx
+	};
+
+	ctx->audio_rate = self->audio_rate;
+	ctx->audio_target = ctx->audio_rate * config->audio_latency_ms / 1000;
+	if (ctx->audio_target < AUDIO_DEVICE_SAMPLES * 2) {
+		ctx->audio_target = AUDIO_DEVICE_SAMPLES * 2;
+	}
+
+	// Room for the target plus a few frames of slack, stereo
+	bool audio_ok = ring_buffer_init(&ctx->audio_ring, (ctx->audio_target + ctx->audio_rate / 10) * 2);
+	if (audio_ok) {
+		ctx->resampler = resampler_new(self->resampler_quality, APU_NATIVE_RATE, ctx->audio_rate);
+		audio_ok = ctx->resampler;
+	}
+	if (audio_ok && ctx->audio_sync) {
+		ctx->audio_sem = SDL_CreateSemaphore(0);
+		audio_ok = ctx->audio_sem;
+	}
+
+	ctx->audio_dev = audio_ok ? SDL_OpenAudioDevice(NULL, false, &spec, &spec, 0) : 0;
+	if (!ctx->audio_dev) {
+		fprintf(stderr, "failed to open audio device: %s\n", SDL_GetError());
+		frontend_close_audio(ctx);
+		return false;
+	}
+	return true;
+}
+
+static int emu_thread_main(void* arg) {
+	EmuThread* ctx = (EmuThread*) arg;
+	Emulator* self = ctx->emu;
+
+	while (atomic_load_explicit(&ctx->running, memory_order_relaxed)) {
+		emu_set_buttons(self, atomic_load_explicit(&ctx->buttons, memory_order_relaxed));
+
+		Frame* frame = &ctx->frames[ctx->frame_buffer.back];
+		emu_set_framebuffer(self, frame->pixels);
+
+		if (!emu_step_frame(self)) {
+			// The presentation loop exits when it sees this
+			atomic_store(&ctx->running, false);
+			SDL_SemPost(ctx->frame_sem);
+			break;
+		}
+
+		if (ctx->audio_dev) {
+			u32 count;
+			const f32* native = emu_audio_samples(self, &count);
+			frontend_queue_audio(ctx, native, count);
+		}
+
+		memcpy(frame->dirty_lines, emu_dirty_lines(self), sizeof(frame->dirty_lines));
+		// The presenter never saw the previous frame, so its changes have to be uploaded with this one
+		i8 pending = triple_buffer_pending(&ctx->frame_buffer);
+		if (pending >= 0) {
+			for (usize i = 0; i < sizeof(frame->dirty_lines) / sizeof(*frame->dirty_lines); ++i) {
+				frame->dirty_lines[i] |= ctx->frames[pending].dirty_lines[i];
+			}
+		}
+		triple_buffer_publish(&ctx->frame_buffer);
+		SDL_SemPost(ctx->frame_sem);
+
+		if (ctx->viewer) {
+			viewer_submit(ctx->viewer, &self->bus.ppu);
+		}
+
+		if (ctx->audio_sync) {
+			// The device taking samples out of the ring paces emulation
+			while (ring_buffer_size(&ctx->audio_ring) / 2 > ctx->audio_target &&
+				atomic_load_explicit(&ctx->running, memory_order_relaxed)) {
+				SDL_SemWaitTimeout(ctx->audio_sem, 5);
+			}
+		}
+		else {
+			if (ctx->audio_dev) {
+				audio_rate_control(ctx);
+			}
+			pacer_wait(ctx->pacer);
+		}
+	}
+
+	return 0;
+}
+
+FrontendConfig frontend_config_new() {
+	FrontendConfig config = {};
+	config.scale = 4;
+	config.audio_latency_ms = 50;
+	return config;
+}
+
+// Opens a window and runs the loaded rom until it is closed, the emulator is left for emu_free
+void frontend_run(Emulator* self, const FrontendConfig* config) {
+	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+	SDL_Window* window = SDL_CreateWindow(
+		"qgbe",
+		SDL_WINDOWPOS_CENTERED,
+		SDL_WINDOWPOS_CENTERED,
+		REAL_WIDTH * 4,
+		REAL_HEIGHT * 4,
+		SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE);
+
+	SDL_Renderer* renderer = SDL_CreateRenderer(window, 0,  SDL_RENDERER_ACCELERATED);
+
+	EmuThread* ctx = (EmuThread*) calloc(1, sizeof(EmuThread));
+	if (!ctx) {
+		fprintf(stderr, "failed to allocate frame buffers\n");
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return;
+	}
+	ctx->emu = self;
+	ctx->config = config;
+	triple_buffer_init(&ctx->frame_buffer);
+	atomic_init(&ctx->running, true);
+	atomic_init(&ctx->buttons, 0);
+
+	for (u8 f = 0; f < 3; ++f) {
+		u32* backing = ctx->frames[f].pixels;
+		for (usize i = 0; i < REAL_WIDTH; ++i) {
+			backing[i] = 0x00FF00FF;
+			backing[(REAL_HEIGHT - 1) * REAL_WIDTH + i] = 0x00FF00FF;
+		}
+		for (usize i = 0; i < REAL_HEIGHT; ++i) {
+			backing[i * REAL_WIDTH] = 0x00FF00FF;
+			backing[i * REAL_WIDTH + REAL_WIDTH - 1] = 0x00FF00FF;
+		}
+	}
+
+	ctx->viewer = viewer_new(VIEWER_MAX_FPS);
+	if (!ctx->viewer) {
+		fprintf(stderr, "warning: failed to create the tile/sprite viewer thread\n");
+	}
+	Viewer* viewer = ctx->viewer;
+
+	emu_set_framebuffer(self, ctx->frames[ctx->frame_buffer.back].pixels);
+	if (!ppu_renderer_start(&self->bus.ppu, self->ppu_render_mode)) {
+		fprintf(stderr, "warning: failed to start the ppu render thread, rendering inline\n");
+	}
+
+	const u8* key_state = SDL_GetKeyboardState(NULL);
+
+	SDL_Scancode key_down = SDL_SCANCODE_DOWN;
+	SDL_Scancode key_up = SDL_SCANCODE_UP;
+	SDL_Scancode key_left = SDL_SCANCODE_LEFT;
+	SDL_Scancode key_right = SDL_SCANCODE_RIGHT;
+
+	SDL_Scancode key_start = SDL_SCANCODE_RETURN;
+	SDL_Scancode key_select = SDL_SCANCODE_BACKSPACE;
+	SDL_Scancode key_b = SDL_SCANCODE_B;
+	SDL_Scancode key_a = SDL_SCANCODE_A;
+
+	// With mute the core keeps only what games can see through the registers
+	ctx->audio_sync = config->audio_sync && !self->mute;
+	if (!self->mute && !frontend_open_audio(self, ctx)) {
+		ppu_renderer_stop(&self->bus.ppu);
+		if (viewer) {
+			viewer_free(viewer);
+		}
+		free(ctx);
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return;
+	}
+	SDL_AudioDeviceID audio_dev = ctx->audio_dev;
+
+	ctx->pacer = pacer_new(DMG_CLOCK_HZ, DMG_FRAME_CYCLES);
+	ctx->frame_sem = SDL_CreateSemaphore(0);
+	SDL_Thread* emu_thread = NULL;
+	// Everything up to here overlaps with decompressing the rom, the first step waits for it
+	if (ctx->pacer && ctx->frame_sem) {
+		emu_thread = SDL_CreateThread(emu_thread_main, "qgbe emulation", ctx);
+	}
+	if (!emu_thread) {
+		fprintf(stderr, "failed to start the emulation thread: %s\n", SDL_GetError());
+		if (ctx->frame_sem) {
+			SDL_DestroySemaphore(ctx->frame_sem);
+		}
+		if (ctx->pacer) {
+			pacer_free(ctx->pacer);
+		}
+		frontend_close_audio(ctx);
+		ppu_renderer_stop(&self->bus.ppu);
+		if (viewer) {
+			viewer_free(viewer);
+		}
+		free(ctx);
+		SDL_DestroyRenderer(renderer);
+		SDL_DestroyWindow(window);
+		SDL_Quit();
+		return;
+	}
+
+	if (audio_dev) {
+		SDL_PauseAudioDevice(audio_dev, false);
+	}
+
+	Scaler* scaler = NULL;
+	if (config->scaler != SCALER_NONE) {
+		scaler = scaler_new(config->scaler, config->scale, REAL_WIDTH, REAL_HEIGHT, scaled_frame_ready, ctx->frame_sem);
+		if (!scaler) {
+			fprintf(stderr, "warning: failed to start the scaler, presenting unscaled\n");
+		}
+	}
+	u32 scale = scaler ? scaler_factor(scaler) : 1;
+
+	SDL_Texture* tex = SDL_CreateTexture(
+		renderer,
+		SDL_PIXELFORMAT_BGRA8888,
+		SDL_TEXTUREACCESS_STREAMING,
+		(int) (REAL_WIDTH * scale),
+		(int) (REAL_HEIGHT * scale));
+
+	u64 all_lines[(REAL_HEIGHT + 63) / 64];
+	memset(all_lines, 0xFF, sizeof(all_lines));
+	if (scaler) {
+		scaler_submit(scaler, ctx->frames[ctx->frame_buffer.front].pixels, all_lines);
+	}
+	else {
+		SDL_UpdateTexture(tex, NULL, ctx->frames[ctx->frame_buffer.front].pixels, REAL_WIDTH * 4);
+	}
+
+	SDL_Window* tile_viewer_window = NULL;
+	SDL_Renderer* tile_renderer = NULL;
+	SDL_Texture* tile_view_tex = NULL;
+
+	SDL_Window* sprite_viewer_window = NULL;
+	SDL_Renderer* sprite_renderer = NULL;
+	SDL_Texture* sprite_view_tex = NULL;
+
+	bool needs_present = true;
+
+	Uint32 main_window_id = SDL_GetWindowID(window);
+	Uint32 tile_window_id = 0;
+	Uint32 sprite_window_id = 0;
+
+	Uint32 last_stats = SDL_GetTicks();
+
+	bool running = true;
+	// The emulation thread stops on its own if the rom fails to load
+	while (running && atomic_load_explicit(&ctx->running, memory_order_relaxed)) {
+		SDL_Event event;
+		while (SDL_PollEvent(&event)) {
+			if (event.type == SDL_WINDOWEVENT) {
+				if (event.window.event == SDL_WINDOWEVENT_CLOSE) {
+					if (event.window.windowID == main_window_id) {
+						running = false;
+					}
+					else if (event.window.windowID == tile_window_id) {
+						SDL_DestroyTexture(tile_view_tex);
+						SDL_DestroyRenderer(tile_renderer);
+						SDL_DestroyWindow(tile_viewer_window);
+						tile_window_id = 0;
+						viewer_set_enabled(viewer, VIEWER_TILES, false);
+					}
+					else if (event.window.windowID == sprite_window_id) {
+						SDL_DestroyTexture(sprite_view_tex);
+						SDL_DestroyRenderer(sprite_renderer);
+						SDL_DestroyWindow(sprite_viewer_window);
+						sprite_window_id = 0;
+						viewer_set_enabled(viewer, VIEWER_SPRITES, false);
+					}
+				}
+				else if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+					SDL_RenderSetLogicalSize(renderer, REAL_WIDTH * 4, REAL_HEIGHT * 4);
+					needs_present = true;
+				}
+				else if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+					needs_present = true;
+				}
+			}
+			else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_t && event.key.keysym.mod & KMOD_CTRL) {
+				if (viewer && !tile_window_id) {
+					tile_viewer_window = SDL_CreateWindow(
+						"qgbe tile viewer",
+						SDL_WINDOWPOS_UNDEFINED,
+						SDL_WINDOWPOS_UNDEFINED,
+						TILE_VIEWER_WIDTH,
+						TILE_VIEWER_HEIGHT,
+						0);
+					tile_window_id = SDL_GetWindowID(tile_viewer_window);
+					tile_renderer = SDL_CreateRenderer(tile_viewer_window, 0, SDL_RENDERER_ACCELERATED);
+					tile_view_tex = SDL_CreateTexture(
+						tile_renderer,
+						SDL_PIXELFORMAT_BGRA8888,
+						SDL_TEXTUREACCESS_STREAMING,
+						TILE_VIEWER_WIDTH,
+						TILE_VIEWER_HEIGHT);
+					viewer_set_enabled(viewer, VIEWER_TILES, true);
+				}
+			}
+			else if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_s && event.key.keysym.mod & KMOD_CTRL) {
+				if (viewer && !sprite_window_id) {
+					sprite_viewer_window = SDL_CreateWindow(
+						"qgbe sprite viewer",
+						SDL_WINDOWPOS_UNDEFINED,
+						SDL_WINDOWPOS_UNDEFINED,
+						SPRITE_VIEWER_WIDTH,
+						SPRITE_VIEWER_HEIGHT,
+						0);
+					sprite_window_id = SDL_GetWindowID(sprite_viewer_window);
+					sprite_renderer = SDL_CreateRenderer(sprite_viewer_window, 0, SDL_RENDERER_ACCELERATED);
+					sprite_view_tex = SDL_CreateTexture(
+						sprite_renderer,
+						SDL_PIXELFORMAT_BGRA8888,
+						SDL_TEXTUREACCESS_STREAMING,
+						SPRITE_VIEWER_WIDTH,
+						SPRITE_VIEWER_HEIGHT);
+					viewer_set_enabled(viewer, VIEWER_SPRITES, true);
+				}
+			}
+		}
+
+		u8 buttons = 0;
+		buttons |= key_state[key_right] ? BUTTON_RIGHT : 0;
+		buttons |= key_state[key_left] ? BUTTON_LEFT : 0;
+		buttons |= key_state[key_up] ? BUTTON_UP : 0;
+		buttons |= key_state[key_down] ? BUTTON_DOWN : 0;
+		buttons |= key_state[key_a] ? BUTTON_A : 0;
+		buttons |= key_state[key_b] ? BUTTON_B : 0;
+		buttons |= key_state[key_select] ? BUTTON_SELECT : 0;
+		buttons |= key_state[key_start] ? BUTTON_START : 0;
+		atomic_store_explicit(&ctx->buttons, buttons, memory_order_relaxed);
+
+		bool frame_dirty = false;
+		if (triple_buffer_acquire(&ctx->frame_buffer)) {
+			const Frame* frame = &ctx->frames[ctx->frame_buffer.front];
+			if (scaler) {
+				scaler_submit(scaler, frame->pixels, frame->dirty_lines);
+			}
+			else {
+				frame_dirty = upload_dirty_lines(tex, frame->pixels, frame->dirty_lines, 1);
+			}
+		}
+
+		u64 scaled_lines[(REAL_HEIGHT + 63) / 64];
+		const u32* scaled_image;
+		if (scaler && (scaled_image = scaler_acquire(scaler, scaled_lines))) {
+			frame_dirty = upload_dirty_lines(tex, scaled_image, scaled_lines, scale);
+			scaler_release(scaler);
+		}
+
+		// Nothing to show if the image didn't change
+		if (frame_dirty || needs_present) {
+			SDL_RenderClear(renderer);
+			SDL_RenderCopy(renderer, tex, NULL, NULL);
+			SDL_RenderPresent(renderer);
+			needs_present = false;
+		}
+
+		// Only presented when the viewer thread produced a new image
+		const u32* tile_image;
+		if (tile_window_id && (tile_image = viewer_acquire(viewer, VIEWER_TILES))) {
+			SDL_UpdateTexture(tile_view_tex, NULL, tile_image, TILE_VIEWER_WIDTH * 4);
+			viewer_release(viewer);
+			SDL_RenderClear(tile_renderer);
+			SDL_RenderCopy(tile_renderer, tile_view_tex, NULL, NULL);
+			SDL_RenderPresent(tile_renderer);
+		}
+
+		const u32* sprite_image;
+		if (sprite_window_id && (sprite_image = viewer_acquire(viewer, VIEWER_SPRITES))) {
+			SDL_UpdateTexture(sprite_view_tex, NULL, sprite_image, SPRITE_VIEWER_WIDTH * 4);
+			viewer_release(viewer);
+			SDL_RenderClear(sprite_renderer);
+			SDL_RenderCopy(sprite_renderer, sprite_view_tex, NULL, NULL);
+			SDL_RenderPresent(sprite_renderer);
+		}
+
+		Uint32 now = SDL_GetTicks();
+		if (now - last_stats >= STATS_INTERVAL_MS) {
+			PacerStats stats;
+			pacer_get_stats(ctx->pacer, &stats);
+			char title[128];
+			snprintf(
+				title,
+				sizeof(title),
+				"qgbe - %.2f fps, p99 %.2f ms, %u/%u late",
+				stats.mean_frame_ms > 0 ? 1000.0 / stats.mean_frame_ms : 0.0,
+				stats.p99_frame_ms,
+				stats.late_frames,
+				stats.frames);
+			SDL_SetWindowTitle(window, title);
+			last_stats = now;
+		}
+
+		// Woken up by every new frame, the timeout keeps input and window events flowing
+		SDL_SemWaitTimeout(ctx->frame_sem, 10);
+	}
+
+	atomic_store(&ctx->running, false);
+	SDL_WaitThread(emu_thread, NULL);
+	SDL_DestroySemaphore(ctx->frame_sem);
+	pacer_free(ctx->pacer);
+
+	if (tile_window_id) {
+		SDL_DestroyTexture(tile_view_tex);
+		SDL_DestroyRenderer(tile_renderer);
+		SDL_DestroyWindow(tile_viewer_window);
+	}
+	if (sprite_window_id) {
+		SDL_DestroyTexture(sprite_view_tex);
+		SDL_DestroyRenderer(sprite_renderer);
+		SDL_DestroyWindow(sprite_viewer_window);
+	}
+	ppu_renderer_stop(&self->bus.ppu);
+	if (scaler) {
+		scaler_free(scaler);
+	}
+	SDL_DestroyTexture(tex);
+	if (viewer) {
+		viewer_free(viewer);
+	}
+	frontend_close_audio(ctx);
+	free(ctx);
+	SDL_DestroyRenderer(renderer);
+	SDL_DestroyWindow(window);
+	SDL_Quit();
+}
+
+// Plays frames frames of a song loaded with emu_load_gbs, paced by the device taking samples
+// out of the ring
+bool frontend_play_gbs(Emulator* self, Gbs* gbs, const FrontendConfig* config, u32 frames) {
+	if (SDL_Init(SDL_INIT_AUDIO) != 0) {
+		fprintf(stderr, "failed to initialize SDL audio: %s\n", SDL_GetError());
+		return false;
+	}
+	EmuThread* ctx = (EmuThread*) calloc(1, sizeof(EmuThread));
+	if (ctx) {
+		ctx->emu = self;
+		ctx->config = config;
+		ctx->audio_sync = true;
+	}
+	if (!ctx || !frontend_open_audio(self, ctx)) {
+		free(ctx);
+		SDL_Quit();
+		return false;
+	}
+	SDL_PauseAudioDevice(ctx->audio_dev, false);
+
+	for (u32 frame = 0; frame < frames; ++frame) {
+		emu_step_gbs(self, gbs);
+		u32 count;
+		const f32* native = emu_audio_samples(self, &count);
+		frontend_queue_audio(ctx, native, count);
+		while (ring_buffer_size(&ctx->audio_ring) / 2 > ctx->audio_target) {
+			SDL_SemWaitTimeout(ctx->audio_sem, 5);
+		}
+	}
+	// Let the device play out what is left
+	while (ring_buffer_size(&ctx->audio_ring)) {
+		SDL_SemWaitTimeout(ctx->audio_sem, 5);
+	}
+
+	frontend_close_audio(ctx);
+	free(ctx);
+	SDL_Quit();
+	return true;
+}
\ No newline at end of file
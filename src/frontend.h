@@ -0,0 +1,18 @@
+#pragma once
+#include "emu.h"
+#include "gbs.h"
+#include "scaler.h"
+
+// The SDL window, input and audio device around the headless core
+
+typedef struct {
+	ScalerKind scaler;
+	u32 scale;
+	u32 audio_latency_ms;
+	// Pace emulation by the audio device instead of the frame timer
+	bool audio_sync;
+} FrontendConfig;
+
+FrontendConfig frontend_config_new();
+void frontend_run(Emulator* emu, const FrontendConfig* config);
+bool frontend_play_gbs(Emulator* emu, Gbs* gbs, const FrontendConfig* config, u32 frames);
@@ -0,0 +1,200 @@
+#include "gbs.h"
+#include "dmg.h"
+#include "utils/fsize.h"
+#include "utils/rom_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEADER_SIZE 0x70
+// Routines return to a halt loop here, below the lowest load address the format allows.
+// Halting keeps the timer in step, which a busy loop doesn't with instructions running long.
+#define IDLE_ADDR 0x100
+#define IDLE_SIZE 3
+#define MIN_LOAD_ADDR 0x400
+#define RAM_SIZE 0x2000
+
+// Bank 0 is fixed, 0x2000-0x3FFF selects the one at 0x4000 and there is always 8KiB of ram
+typedef struct {
+	Mapper common;
+	u32 rom_bank;
+} GbsMapper;
+static_assert(sizeof(GbsMapper) <= CART_MAPPER_SIZE);
+
+static void gbs_mapper_write(Mapper* mapper_self, u16 addr, u8 value) {
+	GbsMapper* self = container_of(mapper_self, GbsMapper, common);
+	Cart* cart = mapper_self->cart;
+
+	if (addr >= 0x2000 && addr <= 0x3FFF) {
+		u32 bank = value ? value : 1;
+		self->rom_bank = bank & (cart->num_rom_banks - 1);
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF) {
+		cart->ram[addr - 0xA000] = value;
+	}
+}
+
+static u8 gbs_mapper_read(Mapper* mapper_self, u16 addr) {
+	GbsMapper* self = container_of(mapper_self, GbsMapper, common);
+	Cart* cart = mapper_self->cart;
+
+	if (addr <= 0x3FFF) {
+		return cart->data[addr];
+	}
+	else if (addr <= 0x7FFF) {
+		return cart->data[self->rom_bank << 14 | (addr & 0x3FFF)];
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF) {
+		return cart->ram[addr - 0xA000];
+	}
+	return 0xFF;
+}
+
+static u16 read_u16(const u8* data) {
+	return data[0] | data[1] << 8;
+}
+
+// Builds a rom image with the payload at its load address, rst vectors jumping to the
+// payload's copies of them and the idle loop
+bool gbs_load(Gbs* self, Cart* cart, const char* path) {
+	usize size = fsize(path);
+	if (size <= HEADER_SIZE) {
+		return false;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	u8 header[HEADER_SIZE];
+	if (fread(header, HEADER_SIZE, 1, file) != 1 || memcmp(header, "GBS", 3) != 0 || header[3] != 1) {
+		fclose(file);
+		return false;
+	}
+
+	memset(self, 0, sizeof(Gbs));
+	self->song_count = header[0x04];
+	self->first_song = header[0x05] ? header[0x05] : 1;
+	self->load_addr = read_u16(header + 0x06);
+	self->init_addr = read_u16(header + 0x08);
+	self->play_addr = read_u16(header + 0x0A);
+	self->stack_pointer = read_u16(header + 0x0C);
+	self->tma = header[0x0E];
+	self->tac = header[0x0F];
+	memcpy(self->title, header + 0x10, 32);
+	memcpy(self->author, header + 0x30, 32);
+	memcpy(self->copyright, header + 0x50, 32);
+
+	if (self->load_addr < MIN_LOAD_ADDR || self->load_addr > 0x7FFF) {
+		fprintf(stderr, "warning: gbs load address %04X is outside of the rom area\n", self->load_addr);
+		fclose(file);
+		return false;
+	}
+	if (self->tac & 1 << 7) {
+		fprintf(stderr, "warning: gbs asks for cgb double speed, playing at normal speed\n");
+	}
+
+	usize payload = size - HEADER_SIZE;
+	usize rom_banks = 2;
+	while (rom_banks * 0x4000 < self->load_addr + payload) {
+		rom_banks *= 2;
+	}
+
+	u8* data = calloc(rom_banks, 0x4000);
+	if (!data || fread(data + self->load_addr, payload, 1, file) != 1) {
+		free(data);
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+
+	for (u8 i = 0; i < 8; ++i) {
+		u16 target = self->load_addr + i * 8;
+		data[i * 8] = 0xC3;
+		data[i * 8 + 1] = (u8) target;
+		data[i * 8 + 2] = (u8) (target >> 8);
+	}
+	// halt, jr -3
+	data[IDLE_ADDR] = 0x76;
+	data[IDLE_ADDR + 1] = 0x18;
+	data[IDLE_ADDR + 2] = 0xFD;
+
+	RomImage* image = rom_image_from_buffer(data, rom_banks * 0x4000);
+	if (!image) {
+		free(data);
+		return false;
+	}
+
+	GbsMapper* mapper = (GbsMapper*) cart->mapper_storage;
+	mapper->common.cart = cart;
+	mapper->common.read = gbs_mapper_read;
+	mapper->common.write = gbs_mapper_write;
+	mapper->rom_bank = 1;
+
+	cart->mapper = &mapper->common;
+	cart->hdr = NULL;
+	cart->image = image;
+	cart->data = data;
+	memset(cart->ram, 0, RAM_SIZE);
+	cart->num_rom_banks = rom_banks;
+	cart->rom_size = rom_banks * 0x4000;
+	cart->ram_size = RAM_SIZE;
+	return true;
+}
+
+static void gbs_call(Bus* bus, u16 addr) {
+	Cpu* cpu = &bus->cpu;
+	cpu->sp -= 2;
+	bus_write(bus, cpu->sp, IDLE_ADDR & 0xFF);
+	bus_write(bus, cpu->sp + 1, IDLE_ADDR >> 8);
+	cpu->pc = addr;
+	cpu->halted = false;
+}
+
+// song is 0-based. Interrupts stay off, play is called from gbs_run instead of a handler.
+void gbs_start_song(Gbs* self, Bus* bus, u8 song) {
+	Cpu* cpu = &bus->cpu;
+	cpu->ime = false;
+	cpu->ie = 0;
+	cpu->if_flag = 0;
+	cpu->remaining_cycles = 0;
+	memset(cpu->regs, 0, sizeof(cpu->regs));
+	self->song = song;
+	cpu->regs[REG_A] = song;
+	cpu->sp = self->stack_pointer;
+
+	bus_write(bus, 0xFF26, 0x80);
+	bus_write(bus, 0xFF25, 0xFF);
+	bus_write(bus, 0xFF24, 0x77);
+	bus_write(bus, 0xFF06, self->tma);
+	bus_write(bus, 0xFF07, self->tac);
+
+	self->vblank_cycles = 0;
+	self->play_pending = false;
+	gbs_call(bus, self->init_addr);
+}
+
+// Runs cycles M-cycles. Play calls that come due while a routine is still running wait for it.
+void gbs_run(Gbs* self, Bus* bus, u32 cycles) {
+	Cpu* cpu = &bus->cpu;
+	bool timer_driven = self->tac & 1 << 2;
+	for (u32 i = 0; i < cycles; ++i) {
+		bus_cycle(bus);
+
+		if (timer_driven) {
+			if (cpu->if_flag & IRQ_TIMER) {
+				cpu->if_flag &= ~IRQ_TIMER;
+				self->play_pending = true;
+			}
+		}
+		else if (++self->vblank_cycles == DMG_FRAME_CYCLES / 4) {
+			self->vblank_cycles = 0;
+			self->play_pending = true;
+		}
+
+		if (self->play_pending && cpu->pc >= IDLE_ADDR && cpu->pc < IDLE_ADDR + IDLE_SIZE) {
+			self->play_pending = false;
+			gbs_call(bus, self->play_addr);
+		}
+	}
+}
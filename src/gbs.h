@@ -0,0 +1,31 @@
+#pragma once
+#include "bus.h"
+#include "types.h"
+
+// Game Boy Sound files: a code payload with init/play routines and no graphics. The player
+// calls play at the rate the header asks for, from the timer or at the vblank rate.
+
+typedef struct {
+	u8 song_count;
+	// 1-based like in the file
+	u8 first_song;
+	u16 load_addr;
+	u16 init_addr;
+	u16 play_addr;
+	u16 stack_pointer;
+	u8 tma;
+	u8 tac;
+	char title[33];
+	char author[33];
+	char copyright[33];
+	// 0-based, the one gbs_start_song started
+	u8 song;
+
+	// M-cycles into the current vblank period, when play isn't timer driven
+	u32 vblank_cycles;
+	bool play_pending;
+} Gbs;
+
+bool gbs_load(Gbs* self, Cart* cart, const char* path);
+void gbs_start_song(Gbs* self, Bus* bus, u8 song);
+void gbs_run(Gbs* self, Bus* bus, u32 cycles);
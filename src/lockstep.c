@@ -0,0 +1,328 @@
+#include "lockstep.h"
+#include "cpu_alu.h"
+#include "inst.h"
+#include <stdlib.h>
+#include <string.h>
+
+// A to L, the registers with a row each
+#define LANE_REGS (REG_L + 1)
+
+struct Lockstep {
+	Emulator* instances;
+	u32 lanes;
+	// Authoritative while a frame runs, register r of lane i is regs[r * lanes + i]
+	u8* regs;
+	// 0xFF for the lanes in the current issue, their immediates for the ones that have one
+	u8* mask;
+	u8* imm;
+	// Lanes about to start an instruction this cycle that haven't yet, then the ones issued together
+	u32* pending;
+	u32* members;
+	bool* running;
+	// Opcodes there is a lane kernel for
+	bool lane_ops[0xFF + 1];
+	LockstepStats stats;
+};
+
+// What the lane kernels implement, mirrors the handlers in cpu_instrs.c for the same forms
+static bool lockstep_lane_op(const Inst* inst) {
+	bool reg_or_imm = inst->mode == M_R ? inst->rs < REG_AF : inst->mode == M_U8;
+	if (inst->type == T_NOP) {
+		return true;
+	}
+	else if (inst->type == T_LD) {
+		return reg_or_imm && inst->rd < REG_AF;
+	}
+	else if (inst->type == T_INC || inst->type == T_DEC) {
+		return inst->mode == M_R && inst->rd < REG_AF;
+	}
+	else if (inst->type == T_ADD || inst->type == T_ADC || inst->type == T_SUB || inst->type == T_SBC ||
+		inst->type == T_AND || inst->type == T_XOR || inst->type == T_OR || inst->type == T_CP) {
+		return reg_or_imm && inst->rd == REG_A;
+	}
+	else {
+		return false;
+	}
+}
+
+// Steps the instances[0..lanes-1] that the caller keeps, they have to be loaded with the same
+// rom. Returns NULL if allocating fails.
+Lockstep* lockstep_new(Emulator* instances, u32 lanes) {
+	Lockstep* self = calloc(1, sizeof(Lockstep));
+	if (!self) {
+		return NULL;
+	}
+	self->instances = instances;
+	self->lanes = lanes;
+	self->regs = malloc((usize) LANE_REGS * lanes);
+	self->mask = calloc(lanes, 1);
+	self->imm = calloc(lanes, 1);
+	self->pending = malloc(lanes * sizeof(u32));
+	self->members = malloc(lanes * sizeof(u32));
+	self->running = malloc(lanes * sizeof(bool));
+	if (!self->regs || !self->mask || !self->imm || !self->pending || !self->members || !self->running) {
+		lockstep_free(self);
+		return NULL;
+	}
+
+	for (u32 op = 0; op <= 0xFF; ++op) {
+		self->lane_ops[op] = lockstep_lane_op(&INSTRUCTIONS[op]);
+	}
+	return self;
+}
+
+void lockstep_free(Lockstep* self) {
+	free(self->regs);
+	free(self->mask);
+	free(self->imm);
+	free(self->pending);
+	free(self->members);
+	free(self->running);
+	free(self);
+}
+
+static u8* lockstep_row(Lockstep* self, Reg reg) {
+	return self->regs + (usize) reg * self->lanes;
+}
+
+static void lockstep_load_lane(Lockstep* self, u32 lane) {
+	const Cpu* cpu = &self->instances[lane].bus.cpu;
+	for (u32 reg = 0; reg < LANE_REGS; ++reg) {
+		self->regs[reg * self->lanes + lane] = cpu->regs[reg];
+	}
+}
+
+static void lockstep_store_lane(Lockstep* self, u32 lane) {
+	Cpu* cpu = &self->instances[lane].bus.cpu;
+	for (u32 reg = 0; reg < LANE_REGS; ++reg) {
+		cpu->regs[reg] = self->regs[reg * self->lanes + lane];
+	}
+}
+
+// Same checks as cpu_cycle and cpu_process_irqs, false when the cycle is spent on finishing
+// an instruction, an interrupt or being halted rather than starting an instruction
+static bool lockstep_starts_instruction(const Cpu* cpu) {
+	return !cpu->remaining_cycles && !cpu->halted && !(cpu->ime && cpu->if_flag & cpu->ie & 0x1F);
+}
+
+static void lockstep_run_scalar(Lockstep* self, u32 lane) {
+	lockstep_store_lane(self, lane);
+	cpu_cycle(&self->instances[lane].bus.cpu);
+	lockstep_load_lane(self, lane);
+	self->stats.scalar_instructions += 1;
+}
+
+// Kept apart from the loops below so that fn is a constant in each of them once inlined and
+// every loop vectorizes on its own
+static inline void lockstep_alu(
+	u32 lanes, const u8* mask, u8* a, u8* f, const u8* src, AluResult (*fn)(u8 value, u8 value2, u8 flags)) {
+	for (u32 i = 0; i < lanes; ++i) {
+		AluResult res = fn(a[i], src[i], f[i]);
+		a[i] = mask[i] ? res.value : a[i];
+		f[i] = mask[i] ? res.flags : f[i];
+	}
+}
+
+static inline void lockstep_inc_dec(u32 lanes, const u8* mask, u8* dest, u8* f, AluResult (*fn)(u8 value, u8 flags)) {
+	for (u32 i = 0; i < lanes; ++i) {
+		AluResult res = fn(dest[i], f[i]);
+		dest[i] = mask[i] ? res.value : dest[i];
+		f[i] = mask[i] ? res.flags : f[i];
+	}
+}
+
+// Runs inst for every lane in mask at once, the others keep their registers
+static void lockstep_kernel(Lockstep* self, const Inst* inst) {
+	u32 lanes = self->lanes;
+	const u8* mask = self->mask;
+	u8* a = lockstep_row(self, REG_A);
+	u8* f = lockstep_row(self, REG_F);
+	const u8* src = inst->mode == M_R ? lockstep_row(self, inst->rs) : self->imm;
+
+	if (inst->type == T_LD) {
+		u8* dest = lockstep_row(self, inst->rd);
+		for (u32 i = 0; i < lanes; ++i) {
+			dest[i] = mask[i] ? src[i] : dest[i];
+		}
+	}
+	else if (inst->type == T_INC) {
+		lockstep_inc_dec(lanes, mask, lockstep_row(self, inst->rd), f, alu_inc);
+	}
+	else if (inst->type == T_DEC) {
+		lockstep_inc_dec(lanes, mask, lockstep_row(self, inst->rd), f, alu_dec);
+	}
+	else if (inst->type == T_ADD) {
+		lockstep_alu(lanes, mask, a, f, src, alu_add);
+	}
+	else if (inst->type == T_ADC) {
+		lockstep_alu(lanes, mask, a, f, src, alu_adc);
+	}
+	else if (inst->type == T_SUB) {
+		lockstep_alu(lanes, mask, a, f, src, alu_sub);
+	}
+	else if (inst->type == T_SBC) {
+		lockstep_alu(lanes, mask, a, f, src, alu_sbc);
+	}
+	else if (inst->type == T_AND) {
+		lockstep_alu(lanes, mask, a, f, src, alu_and);
+	}
+	else if (inst->type == T_XOR) {
+		lockstep_alu(lanes, mask, a, f, src, alu_xor);
+	}
+	else if (inst->type == T_OR) {
+		lockstep_alu(lanes, mask, a, f, src, alu_or);
+	}
+	else if (inst->type == T_CP) {
+		lockstep_alu(lanes, mask, a, f, src, alu_cp);
+	}
+}
+
+// Leaves each member's cpu like cpu_cycle would after starting inst
+static void lockstep_issue(Lockstep* self, Inst* inst, u32 count) {
+	bool has_imm = inst->mode == M_U8;
+	// The fetch and the handler's cycles
+	u8 cycles = has_imm ? 2 : 1;
+
+	for (u32 i = 0; i < count; ++i) {
+		u32 lane = self->members[i];
+		Cpu* cpu = &self->instances[lane].bus.cpu;
+		self->mask[lane] = 0xFF;
+		if (has_imm) {
+			self->imm[lane] = bus_read(cpu->bus, cpu->pc + 1);
+			cpu->fetched_data = self->imm[lane];
+		}
+		else if (inst->mode == M_R) {
+			cpu->fetched_data = self->regs[inst->rs * self->lanes + lane];
+		}
+	}
+
+	lockstep_kernel(self, inst);
+
+	for (u32 i = 0; i < count; ++i) {
+		u32 lane = self->members[i];
+		Cpu* cpu = &self->instances[lane].bus.cpu;
+		self->mask[lane] = 0;
+		cpu->pc += has_imm ? 2 : 1;
+		cpu->cur_inst = inst;
+		cpu->dest_is_mem = false;
+		cpu->remaining_cycles = cycles;
+		for (u8 j = 0; j < cycles; ++j) {
+			timer_cycle(&cpu->bus->timer);
+		}
+	}
+
+	self->stats.issues += 1;
+	self->stats.lane_slots += self->lanes;
+	self->stats.lane_instructions += count;
+}
+
+// Starts the instruction of every pending lane. Each round takes the first lane's pc and
+// opcode and issues them for every lane that has the same, the rest wait for a later round.
+static void lockstep_start_instructions(Lockstep* self, u32 count) {
+	while (count) {
+		Bus* lead = &self->instances[self->pending[0]].bus;
+		u16 pc = lead->cpu.pc;
+		u8 op = bus_read(lead, pc);
+		bool lane_op = self->lane_ops[op];
+
+		u32 left = 0;
+		u32 members = 0;
+		for (u32 i = 0; i < count; ++i) {
+			u32 lane = self->pending[i];
+			Bus* bus = &self->instances[lane].bus;
+			if (bus->cpu.pc != pc) {
+				self->pending[left++] = lane;
+			}
+			else if (!lane_op) {
+				lockstep_run_scalar(self, lane);
+			}
+			// Code in ram can differ between lanes at the same pc
+			else if (i == 0 || bus_read(bus, pc) == op) {
+				self->members[members++] = lane;
+			}
+			else {
+				self->pending[left++] = lane;
+			}
+		}
+
+		if (members) {
+			lockstep_issue(self, &INSTRUCTIONS[op], members);
+		}
+		count = left;
+	}
+}
+
+// Runs a frame on every instance like emu_step_frame does, each with its own buttons. An
+// instance whose frame ends early sits out the rest of the cycles. Fails only if a rom
+// couldn't be loaded.
+bool lockstep_step_frame(Lockstep* self) {
+	for (u32 i = 0; i < self->lanes; ++i) {
+		if (!emu_begin_frame(&self->instances[i])) {
+			return false;
+		}
+		lockstep_load_lane(self, i);
+		self->running[i] = true;
+	}
+
+	u32 running = self->lanes;
+	for (usize cycles = 0; running; ++cycles) {
+		u32 pending = 0;
+		for (u32 i = 0; i < self->lanes; ++i) {
+			if (!self->running[i]) {
+				continue;
+			}
+			Emulator* emu = &self->instances[i];
+			if (emu_frame_done(emu, cycles)) {
+				self->running[i] = false;
+				running -= 1;
+				continue;
+			}
+
+			emu->bus.cart.cycles += 1;
+			if (lockstep_starts_instruction(&emu->bus.cpu)) {
+				self->pending[pending++] = i;
+			}
+			else {
+				cpu_cycle(&emu->bus.cpu);
+			}
+		}
+
+		lockstep_start_instructions(self, pending);
+
+		for (u32 i = 0; i < self->lanes; ++i) {
+			if (self->running[i]) {
+				bus_cycle_devices(&self->instances[i].bus);
+			}
+		}
+	}
+
+	for (u32 i = 0; i < self->lanes; ++i) {
+		lockstep_store_lane(self, i);
+		emu_finish_frame(&self->instances[i]);
+	}
+	return true;
+}
+
+// Counts since lockstep_new
+const LockstepStats* lockstep_stats(const Lockstep* self) {
+	return &self->stats;
+}
+
+// For totals over several groups
+void lockstep_stats_add(LockstepStats* self, const LockstepStats* other) {
+	self->issues += other->issues;
+	self->lane_slots += other->lane_slots;
+	self->lane_instructions += other->lane_instructions;
+	self->scalar_instructions += other->scalar_instructions;
+}
+
+// How full the issues were, 1 when every lane took part in all of them
+f32 lockstep_utilisation(const LockstepStats* stats) {
+	return stats->lane_slots ? (f32) stats->lane_instructions / (f32) stats->lane_slots : 0;
+}
+
+// How much of the work ran in lanes, lockstep only pays off when this is high as well
+f32 lockstep_coverage(const LockstepStats* stats) {
+	u64 total = stats->lane_instructions + stats->scalar_instructions;
+	return total ? (f32) stats->lane_instructions / (f32) total : 0;
+}
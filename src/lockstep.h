@@ -0,0 +1,30 @@
+#pragma once
+#include "emu.h"
+
+// Experimental, steps a group of instances of one rom together for workloads where most of
+// them run the same code. The 8 bit registers of the group are kept structure-of-arrays, a
+// row per register with a lane per instance. Lanes at the same pc share the decode from
+// INSTRUCTIONS, and the register and immediate forms of LD, INC, DEC and the alu ops run as
+// one masked loop over the rows for all of them. Everything else, and lanes that went off on
+// a pc of their own, runs through the interpreter one lane at a time. The bus, ppu, apu and
+// timer stay per instance, so every instance ends up exactly where emu_step_frame would put it.
+
+typedef struct {
+	// Instructions run across the lanes, the lanes that were in the group for each summed up
+	// and how many of those took part
+	u64 issues;
+	u64 lane_slots;
+	u64 lane_instructions;
+	// Instructions the interpreter ran for a single lane
+	u64 scalar_instructions;
+} LockstepStats;
+
+typedef struct Lockstep Lockstep;
+
+Lockstep* lockstep_new(Emulator* instances, u32 lanes);
+void lockstep_free(Lockstep* self);
+bool lockstep_step_frame(Lockstep* self);
+const LockstepStats* lockstep_stats(const Lockstep* self);
+void lockstep_stats_add(LockstepStats* self, const LockstepStats* other);
+f32 lockstep_utilisation(const LockstepStats* stats);
+f32 lockstep_coverage(const LockstepStats* stats);
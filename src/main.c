@@ -1,9 +1,71 @@
+#include "dmg.h"
 #include "emu.h"
+#include "frontend.h"
+#include "resampler.h"
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
-int main() {
-	Emulator emu = emu_new();
-	/*if (emu_load_boot_rom(&emu, "../roms/DMG_ROM.bin")) {
+static f64 now_seconds() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (f64) ts.tv_sec + (f64) ts.tv_nsec / 1e9;
+}
+
+// Resamples a few seconds of native rate audio in frame sized blocks for every quality
+// level and device rate, and prints the output samples per second each manages
+static int bench_resampler() {
+	static const char* QUALITY_NAMES[RESAMPLER_QUALITY_MAX] = {"fast", "medium", "best"};
+	static const u32 RATES[] = {44100, 48000, 96000};
+	// About one frame at the native rate
+	enum { BLOCK = 2194, BLOCKS = 60 * 10 };
+
+	static f32 in[BLOCK * 2];
+	static f32 out[BLOCK * 2];
+	for (u32 i = 0; i < BLOCK; ++i) {
+		// Square waves like the apu makes, left and right at different pitches
+		in[i * 2] = (i / 149) % 2 ? 0.5f : -0.5f;
+		in[i * 2 + 1] = (i / 61) % 2 ? 0.25f : -0.25f;
+	}
+
+	for (u32 quality = 0; quality < RESAMPLER_QUALITY_MAX; ++quality) {
+		for (u32 rate = 0; rate < sizeof(RATES) / sizeof(*RATES); ++rate) {
+			Resampler* resampler = resampler_new((ResamplerQuality) quality, APU_NATIVE_RATE, RATES[rate]);
+			if (!resampler) {
+				fputs("failed to create resampler\n", stderr);
+				return 1;
+			}
+
+			u64 produced = 0;
+			f64 start = now_seconds();
+			for (u32 i = 0; i < BLOCKS; ++i) {
+				produced += resampler_process(resampler, in, BLOCK, out, BLOCK);
+			}
+			f64 elapsed = now_seconds() - start;
+			resampler_free(resampler);
+
+			f64 rate_out = (f64) produced / elapsed;
+			printf(
+				"%-6s %5u Hz: %8.2f M frames/s, %6.0fx realtime\n",
+				QUALITY_NAMES[quality],
+				RATES[rate],
+				rate_out / 1e6,
+				rate_out / RATES[rate]);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	Emulator* emu = emu_new();
+	if (!emu) {
+		fputs("failed to allocate the emulator\n", stderr);
+		return 1;
+	}
+	FrontendConfig config = frontend_config_new();
+	/*if (emu_load_boot_rom(emu, "../roms/DMG_ROM.bin")) {
 		//puts("boot rom loaded");
 	}
 	else {
@@ -12,13 +74,114 @@ int main() {
 	}*/
 
 	const char* rom = "../roms/tests/dmg-acid2/dmg-acid2.gb";
+	const char* wav = NULL;
+	bool stems = false;
+	u32 frames = 60 * 60;
+	// Out of range picks the gbs file's default
+	u32 song = UINT32_MAX;
 	//const char* rom = "../roms/Tetris (World) (Rev A).gb";
 	//const char* rom = "../roms/gb-test-roms/instr_timing/instr_timing.gb";
 	//const char* rom = "../roms/tests/mooneye-test-suite/acceptance/jp_timing.gb";
 	//const char* rom = "../roms/gb-test-roms/dmg_sound/rom_singles/04-sweep.gb";
 	//const char* rom = "../roms/gb-test-roms/halt_bug.gb";
 
-	if (emu_load_rom(&emu, rom)) {
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--ppu-thread") == 0) {
+			emu->ppu_render_mode = PPU_RENDER_THREADED;
+		}
+		else if (strcmp(argv[i], "--ppu-compare") == 0) {
+			emu->ppu_render_mode = PPU_RENDER_COMPARE;
+		}
+		else if (strcmp(argv[i], "--scaler") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "nearest") == 0) {
+				config.scaler = SCALER_NEAREST;
+			}
+			else if (strcmp(name, "scale2x") == 0) {
+				config.scaler = SCALER_SCALE2X;
+			}
+			else if (strcmp(name, "scale3x") == 0) {
+				config.scaler = SCALER_SCALE3X;
+			}
+			else if (strcmp(name, "lcd") == 0) {
+				config.scaler = SCALER_LCD_GRID;
+			}
+			else {
+				fprintf(stderr, "unknown scaler %s, expected nearest, scale2x, scale3x or lcd\n", name);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+			config.scale = (u32) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--audio-latency") == 0 && i + 1 < argc) {
+			config.audio_latency_ms = (u32) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--audio-sync") == 0) {
+			config.audio_sync = true;
+		}
+		else if (strcmp(argv[i], "--mute") == 0) {
+			emu->mute = true;
+		}
+		else if (strcmp(argv[i], "--audio-rate") == 0 && i + 1 < argc) {
+			emu->audio_rate = (u32) strtoul(argv[++i], NULL, 10);
+			if (emu->audio_rate < 8000 || emu->audio_rate > 96000) {
+				fprintf(stderr, "audio rate %u out of range, expected 8000 to 96000\n", emu->audio_rate);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--resampler") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "fast") == 0) {
+				emu->resampler_quality = RESAMPLER_FAST;
+			}
+			else if (strcmp(name, "medium") == 0) {
+				emu->resampler_quality = RESAMPLER_MEDIUM;
+			}
+			else if (strcmp(name, "best") == 0) {
+				emu->resampler_quality = RESAMPLER_BEST;
+			}
+			else {
+				fprintf(stderr, "unknown resampler quality %s, expected fast, medium or best\n", name);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+			wav = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stems") == 0) {
+			stems = true;
+		}
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frames = (u32) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--rtc-speed") == 0 && i + 1 < argc) {
+			emu->rtc_speed = (u32) strtoul(argv[++i], NULL, 10);
+		}
+		else if (strcmp(argv[i], "--song") == 0 && i + 1 < argc) {
+			song = (u32) strtoul(argv[++i], NULL, 10) - 1;
+		}
+		else if (strcmp(argv[i], "--bench-resampler") == 0) {
+			return bench_resampler();
+		}
+		else {
+			rom = argv[i];
+		}
+	}
+
+	usize rom_len = strlen(rom);
+	if (rom_len >= 4 && strcmp(rom + rom_len - 4, ".gbs") == 0) {
+		Gbs gbs;
+		if (!emu_load_gbs(emu, &gbs, rom, song)) {
+			return 1;
+		}
+		printf("%s - %s (%s), song %u/%u\n", gbs.title, gbs.author, gbs.copyright, gbs.song + 1, gbs.song_count);
+		bool ok = wav ? emu_render_gbs(emu, &gbs, wav, stems, frames) : frontend_play_gbs(emu, &gbs, &config, frames);
+		emu_free(emu);
+		return ok ? 0 : 1;
+	}
+
+	if (emu_load_rom(emu, rom)) {
 		//puts("rom loaded");
 	}
 	else {
@@ -26,5 +189,19 @@ int main() {
 		return 1;
 	}
 
-	emu_run(&emu);
+	if (wav) {
+		f64 start = now_seconds();
+		bool ok = emu_render_audio(emu, wav, stems, frames);
+		emu_free(emu);
+		if (!ok) {
+			return 1;
+		}
+		f64 elapsed = now_seconds() - start;
+		f64 seconds = (f64) frames * DMG_FRAME_CYCLES / DMG_CLOCK_HZ;
+		printf("rendered %.1f s of audio in %.2f s, %.1fx realtime\n", seconds, elapsed, seconds / elapsed);
+		return 0;
+	}
+
+	frontend_run(emu, &config);
+	emu_free(emu);
 }
\ No newline at end of file
@@ -1,5 +1,4 @@
 #include "mbc1.h"
-#include <stdlib.h>
 
 typedef struct {
 	Mapper common;
@@ -9,15 +8,13 @@ typedef struct {
 	u8 banking_mode;
 	bool extended_rom;
 } Mbc1;
+static_assert(sizeof(Mbc1) <= CART_MAPPER_SIZE);
 
 void mbc1_write(Mapper* self, u16 addr, u8 value);
 u8 mbc1_read(Mapper* self, u16 addr);
 
-Mapper* mbc1_new(Cart* self) {
-	Mbc1* mapper = malloc(sizeof(Mbc1));
-	if (!mapper) {
-		return NULL;
-	}
+void mbc1_init(Cart* self) {
+	Mbc1* mapper = (Mbc1*) self->mapper_storage;
 	mapper->common.cart = self;
 	mapper->common.read = mbc1_read;
 	mapper->common.write = mbc1_write;
@@ -26,7 +23,7 @@ Mapper* mbc1_new(Cart* self) {
 	mapper->ram_bank = 0;
 	mapper->banking_mode = 0;
 	mapper->extended_rom = self->rom_size >= 1024 * 1024;
-	return &mapper->common;
+	self->mapper = &mapper->common;
 }
 
 void mbc1_write(Mapper* mapper_self, u16 addr, u8 value) {
@@ -65,12 +62,15 @@ void mbc1_write(Mapper* mapper_self, u16 addr, u8 value) {
 	}
 	else if (addr >= 0xA000 && addr <= 0xBFFF && self->enable_ram) {
 		Cart* cart = mapper_self->cart;
+		usize offset;
 		if (self->banking_mode == 0 || self->extended_rom) {
-			cart->ram[(addr - 0xA000) & 0x1FFF] = value;
+			offset = (addr - 0xA000) & 0x1FFF;
 		}
 		else {
-			cart->ram[((addr - 0xA000) & 0x1FFF) | self->ram_bank << 13] = value;
+			offset = ((addr - 0xA000) & 0x1FFF) | self->ram_bank << 13;
 		}
+		cart->ram[offset] = value;
+		cart_ram_dirty(cart, offset);
 	}
 }
 
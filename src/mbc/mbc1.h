@@ -1,4 +1,4 @@
 #pragma once
 #include "cart.h"
 
-Mapper* mbc1_new(Cart* self);
+void mbc1_init(Cart* self);
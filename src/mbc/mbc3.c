@@ -1,28 +1,228 @@
 #include "mbc3.h"
-#include <stdlib.h>
+#include "dmg.h"
+#include <string.h>
+
+#define CYCLES_PER_SECOND (DMG_CLOCK_HZ / 4)
+
+#define RTC_DH_DAY_HIGH (1 << 0)
+#define RTC_DH_HALT (1 << 6)
+#define RTC_DH_CARRY (1 << 7)
 
+typedef struct {
+	u8 seconds;
+	u8 minutes;
+	u8 hours;
+	u8 days_low;
+	u8 days_high;
+} RtcRegs;
+
+// The clock isn't ticked, it's brought up to date from the cart's cycle count whenever
+// it's latched or written
 typedef struct {
 	Mapper common;
+	bool enable_ram;
+	u8 rom_bank;
+	// 0-7 select a ram bank, 0x08-0x0C an rtc register
+	u8 ram_bank;
+	u8 last_latch_write;
+	bool has_rtc;
+	RtcRegs rtc;
+	RtcRegs latched;
+	u64 rtc_last_sync;
+	// Cycles towards the next second, times rtc_speed
+	u64 rtc_subsecond;
+	u32 rtc_speed;
 } Mbc3;
+static_assert(sizeof(Mbc3) <= CART_MAPPER_SIZE);
 
 u8 mbc3_read(Mapper* mapper_self, u16 addr);
 void mbc3_write(Mapper* mapper_self, u16 addr, u8 value);
 
-Mapper* mbc3_new(Cart* self) {
-	Mbc3* mapper = malloc(sizeof(Mbc3));
-	if (!mapper) {
-		return NULL;
-	}
+void mbc3_init(Cart* self, bool has_rtc) {
+	Mbc3* mapper = (Mbc3*) self->mapper_storage;
+	memset(mapper, 0, sizeof(Mbc3));
 	mapper->common.cart = self;
 	mapper->common.read = mbc3_read;
 	mapper->common.write = mbc3_write;
-	return &mapper->common;
+	mapper->rom_bank = 1;
+	mapper->last_latch_write = 0xFF;
+	mapper->has_rtc = has_rtc;
+	mapper->rtc_last_sync = self->cycles;
+	mapper->rtc_speed = 1;
+	self->mapper = &mapper->common;
 }
 
-u8 mbc3_read(Mapper* mapper_self, u16 addr) {
-	return 0;
+// Counts the invalid values games can write the same way as valid ones, they just carry late
+static void mbc3_rtc_advance(Mbc3* self, u64 seconds) {
+	RtcRegs* rtc = &self->rtc;
+	u64 total = rtc->seconds + seconds;
+	rtc->seconds = total % 60;
+	total = rtc->minutes + total / 60;
+	rtc->minutes = total % 60;
+	total = rtc->hours + total / 60;
+	rtc->hours = total % 24;
+	total = (rtc->days_low | (rtc->days_high & RTC_DH_DAY_HIGH) << 8) + total / 24;
+	if (total > 511) {
+		rtc->days_high |= RTC_DH_CARRY;
+	}
+	total %= 512;
+	rtc->days_low = (u8) total;
+	rtc->days_high = (rtc->days_high & ~RTC_DH_DAY_HIGH) | (u8) (total >> 8);
+}
+
+static void mbc3_rtc_sync(Mbc3* self) {
+	u64 now = self->common.cart->cycles;
+	if (!(self->rtc.days_high & RTC_DH_HALT)) {
+		u64 elapsed = (now - self->rtc_last_sync) * self->rtc_speed + self->rtc_subsecond;
+		self->rtc_subsecond = elapsed % CYCLES_PER_SECOND;
+		mbc3_rtc_advance(self, elapsed / CYCLES_PER_SECOND);
+	}
+	self->rtc_last_sync = now;
+}
+
+// Multiplies how fast the clock runs against emulated time
+void mbc3_set_rtc_speed(Mapper* mapper_self, u32 speed) {
+	Mbc3* self = container_of(mapper_self, Mbc3, common);
+	mbc3_rtc_sync(self);
+	self->rtc_speed = speed ? speed : 1;
+}
+
+static void put_u32(u8* out, u32 value) {
+	for (u8 i = 0; i < 4; ++i) {
+		out[i] = (u8) (value >> (i * 8));
+	}
+}
+
+static u32 get_u32(const u8* data) {
+	return data[0] | data[1] << 8 | data[2] << 16 | (u32) data[3] << 24;
+}
+
+static void put_regs(u8* out, const RtcRegs* regs) {
+	put_u32(out, regs->seconds);
+	put_u32(out + 4, regs->minutes);
+	put_u32(out + 8, regs->hours);
+	put_u32(out + 12, regs->days_low);
+	put_u32(out + 16, regs->days_high);
+}
+
+static void get_regs(RtcRegs* regs, const u8* data) {
+	regs->seconds = (u8) get_u32(data) & 0x3F;
+	regs->minutes = (u8) get_u32(data + 4) & 0x3F;
+	regs->hours = (u8) get_u32(data + 8) & 0x1F;
+	regs->days_low = (u8) get_u32(data + 12);
+	regs->days_high = (u8) get_u32(data + 16) & (RTC_DH_DAY_HIGH | RTC_DH_HALT | RTC_DH_CARRY);
+}
+
+// now is the host's unix time, the clock keeps running while the emulator isn't
+void mbc3_save_rtc(Mapper* mapper_self, u8* out, u64 now) {
+	Mbc3* self = container_of(mapper_self, Mbc3, common);
+	mbc3_rtc_sync(self);
+	put_regs(out, &self->rtc);
+	put_regs(out + 20, &self->latched);
+	put_u32(out + 40, (u32) now);
+	put_u32(out + 44, (u32) (now >> 32));
+}
+
+void mbc3_load_rtc(Mapper* mapper_self, const u8* data, u64 now) {
+	Mbc3* self = container_of(mapper_self, Mbc3, common);
+	get_regs(&self->rtc, data);
+	get_regs(&self->latched, data + 20);
+	u64 saved = get_u32(data + 40) | (u64) get_u32(data + 44) << 32;
+	self->rtc_last_sync = self->common.cart->cycles;
+	self->rtc_subsecond = 0;
+	if (now > saved && !(self->rtc.days_high & RTC_DH_HALT)) {
+		mbc3_rtc_advance(self, now - saved);
+	}
 }
 
 void mbc3_write(Mapper* mapper_self, u16 addr, u8 value) {
+	Mbc3* self = container_of(mapper_self, Mbc3, common);
+	Cart* cart = mapper_self->cart;
+
+	if (addr <= 0x1FFF) {
+		self->enable_ram = (value & 0xF) == 0xA;
+	}
+	else if (addr <= 0x3FFF) {
+		value &= 0x7F;
+		self->rom_bank = (value ? value : 1) & (cart->num_rom_banks - 1);
+	}
+	else if (addr <= 0x5FFF) {
+		self->ram_bank = value & 0xF;
+	}
+	else if (addr <= 0x7FFF) {
+		if (self->last_latch_write == 0 && value == 1 && self->has_rtc) {
+			mbc3_rtc_sync(self);
+			self->latched = self->rtc;
+		}
+		self->last_latch_write = value;
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF && self->enable_ram) {
+		if (self->ram_bank <= 7) {
+			if (cart->ram_size) {
+				usize offset = (self->ram_bank << 13 | (addr - 0xA000)) & (cart->ram_size - 1);
+				cart->ram[offset] = value;
+				cart_ram_dirty(cart, offset);
+			}
+		}
+		else if (self->has_rtc && self->ram_bank <= 0x0C) {
+			mbc3_rtc_sync(self);
+			RtcRegs* rtc = &self->rtc;
+			if (self->ram_bank == 0x08) {
+				rtc->seconds = value & 0x3F;
+				// Writing the seconds restarts the prescaler
+				self->rtc_subsecond = 0;
+			}
+			else if (self->ram_bank == 0x09) {
+				rtc->minutes = value & 0x3F;
+			}
+			else if (self->ram_bank == 0x0A) {
+				rtc->hours = value & 0x1F;
+			}
+			else if (self->ram_bank == 0x0B) {
+				rtc->days_low = value;
+			}
+			else {
+				rtc->days_high = value & (RTC_DH_DAY_HIGH | RTC_DH_HALT | RTC_DH_CARRY);
+			}
+		}
+	}
+}
+
+u8 mbc3_read(Mapper* mapper_self, u16 addr) {
+	Mbc3* self = container_of(mapper_self, Mbc3, common);
+	Cart* cart = mapper_self->cart;
+
+	if (addr <= 0x3FFF) {
+		return cart->data[addr];
+	}
+	else if (addr <= 0x7FFF) {
+		return cart->data[((u32) self->rom_bank << 14 | (addr & 0x3FFF)) & (cart->rom_size - 1)];
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF && self->enable_ram) {
+		if (self->ram_bank <= 7) {
+			if (cart->ram_size) {
+				return cart->ram[(self->ram_bank << 13 | (addr - 0xA000)) & (cart->ram_size - 1)];
+			}
+		}
+		else if (self->has_rtc && self->ram_bank <= 0x0C) {
+			const RtcRegs* latched = &self->latched;
+			if (self->ram_bank == 0x08) {
+				return latched->seconds;
+			}
+			else if (self->ram_bank == 0x09) {
+				return latched->minutes;
+			}
+			else if (self->ram_bank == 0x0A) {
+				return latched->hours;
+			}
+			else if (self->ram_bank == 0x0B) {
+				return latched->days_low;
+			}
+			else {
+				return latched->days_high;
+			}
+		}
+	}
 
+	return 0xFF;
 }
@@ -1,4 +1,11 @@
 #pragma once
 #include "cart.h"
 
-Mapper* mbc3_new(Cart* self);
+// Live and latched registers as 32-bit words, then a 64-bit unix timestamp, all little endian.
+// The layout other emulators append to the battery ram as well.
+#define MBC3_RTC_SAVE_SIZE 48
+
+void mbc3_init(Cart* self, bool has_rtc);
+void mbc3_set_rtc_speed(Mapper* mapper_self, u32 speed);
+void mbc3_save_rtc(Mapper* mapper_self, u8* out, u64 now);
+void mbc3_load_rtc(Mapper* mapper_self, const u8* data, u64 now);
@@ -0,0 +1,101 @@
+#include "mbc5.h"
+#include <string.h>
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+
+// Banking is resolved on register writes, reads only add the current bank's offset. Offsets
+// rather than pointers keep the state valid when the cart is copied.
+typedef struct {
+	Mapper common;
+	bool enable_ram;
+	// 9 bits, bank 0 can be mapped at 0x4000 too
+	u16 rom_bank;
+	u8 ram_bank;
+	// Bit 3 of the ram bank drives the motor on rumble carts instead
+	u8 ram_bank_mask;
+	// Smaller than a bank for 2KiB ram
+	u16 ram_offset_mask;
+	usize rom_bank_offset;
+	usize ram_bank_offset;
+	// False while ram is disabled or absent
+	bool ram_mapped;
+} Mbc5;
+static_assert(sizeof(Mbc5) <= CART_MAPPER_SIZE);
+
+void mbc5_write(Mapper* self, u16 addr, u8 value);
+u8 mbc5_read(Mapper* self, u16 addr);
+
+static void mbc5_map_rom(Mbc5* self) {
+	Cart* cart = self->common.cart;
+	usize bank = self->rom_bank & (cart->num_rom_banks - 1);
+	self->rom_bank_offset = bank * ROM_BANK_SIZE;
+}
+
+static void mbc5_map_ram(Mbc5* self) {
+	Cart* cart = self->common.cart;
+	self->ram_mapped = self->enable_ram && cart->ram_size;
+	if (!self->ram_mapped) {
+		return;
+	}
+	usize num_ram_banks = cart->ram_size > RAM_BANK_SIZE ? cart->ram_size / RAM_BANK_SIZE : 1;
+	usize bank = (self->ram_bank & self->ram_bank_mask) & (num_ram_banks - 1);
+	self->ram_bank_offset = bank * RAM_BANK_SIZE;
+}
+
+void mbc5_init(Cart* self, bool has_rumble) {
+	Mbc5* mapper = (Mbc5*) self->mapper_storage;
+	memset(mapper, 0, sizeof(Mbc5));
+	mapper->common.cart = self;
+	mapper->common.read = mbc5_read;
+	mapper->common.write = mbc5_write;
+	mapper->rom_bank = 1;
+	mapper->ram_bank_mask = has_rumble ? 0x7 : 0xF;
+	mapper->ram_offset_mask = self->ram_size && self->ram_size < RAM_BANK_SIZE ? self->ram_size - 1 : RAM_BANK_SIZE - 1;
+	mbc5_map_rom(mapper);
+	mbc5_map_ram(mapper);
+	self->mapper = &mapper->common;
+}
+
+void mbc5_write(Mapper* mapper_self, u16 addr, u8 value) {
+	Mbc5* self = container_of(mapper_self, Mbc5, common);
+
+	if (addr <= 0x1FFF) {
+		// Unlike mbc1, only exactly 0x0A enables the ram
+		self->enable_ram = value == 0x0A;
+		mbc5_map_ram(self);
+	}
+	else if (addr <= 0x2FFF) {
+		self->rom_bank = (self->rom_bank & 0x100) | value;
+		mbc5_map_rom(self);
+	}
+	else if (addr <= 0x3FFF) {
+		self->rom_bank = (self->rom_bank & 0xFF) | (value & 1) << 8;
+		mbc5_map_rom(self);
+	}
+	else if (addr <= 0x5FFF) {
+		self->ram_bank = value & 0xF;
+		mbc5_map_ram(self);
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF && self->ram_mapped) {
+		usize offset = self->ram_bank_offset + ((addr - 0xA000) & self->ram_offset_mask);
+		mapper_self->cart->ram[offset] = value;
+		cart_ram_dirty(mapper_self->cart, offset);
+	}
+}
+
+u8 mbc5_read(Mapper* mapper_self, u16 addr) {
+	Mbc5* self = container_of(mapper_self, Mbc5, common);
+
+	if (addr <= 0x3FFF) {
+		return mapper_self->cart->data[addr];
+	}
+	else if (addr <= 0x7FFF) {
+		return mapper_self->cart->data[self->rom_bank_offset + (addr - 0x4000)];
+	}
+	else if (addr >= 0xA000 && addr <= 0xBFFF && self->ram_mapped) {
+		return mapper_self->cart->ram[self->ram_bank_offset + ((addr - 0xA000) & self->ram_offset_mask)];
+	}
+
+	return 0xFF;
+}
@@ -0,0 +1,4 @@
+#pragma once
+#include "cart.h"
+
+void mbc5_init(Cart* self, bool has_rumble);
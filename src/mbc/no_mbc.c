@@ -1,18 +1,14 @@
 #include "no_mbc.h"
-#include <stdlib.h>
 
 void no_mbc_write(Mapper* self, u16 addr, u8 value);
 u8 no_mbc_read(Mapper* self, u16 addr);
 
-Mapper* no_mbc_new(Cart* self) {
-	Mapper* mapper = malloc(sizeof(Mapper));
-	if (!mapper) {
-		return NULL;
-	}
+void no_mbc_init(Cart* self) {
+	Mapper* mapper = (Mapper*) self->mapper_storage;
 	mapper->cart = self;
 	mapper->read = no_mbc_read;
 	mapper->write = no_mbc_write;
-	return mapper;
+	self->mapper = mapper;
 }
 
 void no_mbc_write(Mapper* self, u16 addr, u8 value) {
@@ -21,6 +17,7 @@ void no_mbc_write(Mapper* self, u16 addr, u8 value) {
 	}
 	// call invariant: addr >= 0xA000 && addr <= 0xBFFF && ram_size
 	self->cart->ram[addr - 0xA000] = value;
+	cart_ram_dirty(self->cart, addr - 0xA000);
 }
 
 u8 no_mbc_read(Mapper* self, u16 addr) {
@@ -1,4 +1,4 @@
 #pragma once
 #include "cart.h"
 
-Mapper* no_mbc_new(Cart* self);
+void no_mbc_init(Cart* self);
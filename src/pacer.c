@@ -0,0 +1,214 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pacer.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+// Waits for the bulk of the frame with clock_nanosleep and spins for the last part,
+// the spin length follows how much the sleeps have been overshooting recently.
+
+#define SPIN_MIN_NS 100000
+#define SPIN_MAX_NS 2000000
+#define SPIN_MARGIN_NS 50000
+// Frames that woke up later than this count as late
+#define LATE_NS 1000000
+// Further behind than this (e.g. the process was stopped) just restart from now
+#define MAX_BEHIND_FRAMES 4
+
+struct Pacer {
+	u64 period_ns;
+	// Fractional part of the period in units of 1/clock_hz ns
+	u64 period_rem;
+	u64 clock_hz;
+	u64 rem_acc;
+
+	u64 deadline_ns;
+	u64 last_wake_ns;
+	u64 spin_ns;
+
+	// Stats are written by the pacing thread and read by the frontend
+	mtx_t lock;
+	u32 frame_samples[PACER_WINDOW];
+	u32 late_samples[PACER_WINDOW];
+	u32 pos;
+	u32 count;
+	u64 frame_sum;
+	u64 late_sum;
+	u32 frame_histogram[PACER_BUCKETS];
+	u32 late_histogram[PACER_BUCKETS];
+};
+
+static u64 now_ns() {
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	timespec_get(&ts, TIME_UTC);
+#endif
+	return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(u64 target) {
+#if defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME)
+	struct timespec ts = {
+		.tv_sec = (time_t) (target / 1000000000),
+		.tv_nsec = (long) (target % 1000000000)
+	};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+	u64 now = now_ns();
+	if (target > now) {
+		u64 wait = target - now;
+		struct timespec ts = {
+			.tv_sec = (time_t) (wait / 1000000000),
+			.tv_nsec = (long) (wait % 1000000000)
+		};
+		thrd_sleep(&ts, NULL);
+	}
+#endif
+}
+
+static u32 bucket(u32 ns) {
+	u32 index = ns / PACER_BUCKET_NS;
+	return index < PACER_BUCKETS ? index : PACER_BUCKETS - 1;
+}
+
+Pacer* pacer_new(u64 clock_hz, u64 frame_cycles) {
+	Pacer* self = calloc(1, sizeof(Pacer));
+	if (!self) {
+		return NULL;
+	}
+	if (mtx_init(&self->lock, mtx_plain) != thrd_success) {
+		free(self);
+		return NULL;
+	}
+
+	self->period_ns = frame_cycles * 1000000000 / clock_hz;
+	self->period_rem = frame_cycles * 1000000000 % clock_hz;
+	self->clock_hz = clock_hz;
+	self->spin_ns = SPIN_MIN_NS;
+	return self;
+}
+
+void pacer_free(Pacer* self) {
+	mtx_destroy(&self->lock);
+	free(self);
+}
+
+static void pacer_advance(Pacer* self) {
+	self->deadline_ns += self->period_ns;
+	self->rem_acc += self->period_rem;
+	if (self->rem_acc >= self->clock_hz) {
+		self->rem_acc -= self->clock_hz;
+		self->deadline_ns += 1;
+	}
+}
+
+static void pacer_record(Pacer* self, u64 frame_ns, u64 late_ns) {
+	u32 frame = frame_ns > UINT32_MAX ? UINT32_MAX : (u32) frame_ns;
+	u32 late = late_ns > UINT32_MAX ? UINT32_MAX : (u32) late_ns;
+
+	mtx_lock(&self->lock);
+	if (self->count == PACER_WINDOW) {
+		u32 old_frame = self->frame_samples[self->pos];
+		u32 old_late = self->late_samples[self->pos];
+		self->frame_sum -= old_frame;
+		self->late_sum -= old_late;
+		self->frame_histogram[bucket(old_frame)] -= 1;
+		self->late_histogram[bucket(old_late)] -= 1;
+	}
+	else {
+		self->count += 1;
+	}
+
+	self->frame_samples[self->pos] = frame;
+	self->late_samples[self->pos] = late;
+	self->frame_sum += frame;
+	self->late_sum += late;
+	self->frame_histogram[bucket(frame)] += 1;
+	self->late_histogram[bucket(late)] += 1;
+	self->pos = (self->pos + 1) % PACER_WINDOW;
+	mtx_unlock(&self->lock);
+}
+
+// Blocks until the end of the current emulated frame
+void pacer_wait(Pacer* self) {
+	u64 now = now_ns();
+	if (!self->deadline_ns) {
+		self->deadline_ns = now;
+		self->last_wake_ns = now;
+		pacer_advance(self);
+		return;
+	}
+
+	if (now + self->spin_ns < self->deadline_ns) {
+		u64 target = self->deadline_ns - self->spin_ns;
+		sleep_until(target);
+		now = now_ns();
+
+		u64 over = now > target ? now - target : 0;
+		u64 spin = self->spin_ns - self->spin_ns / 16;
+		if (over + SPIN_MARGIN_NS > spin) {
+			spin = over + SPIN_MARGIN_NS;
+		}
+		self->spin_ns = spin < SPIN_MIN_NS ? SPIN_MIN_NS : spin > SPIN_MAX_NS ? SPIN_MAX_NS : spin;
+	}
+	while (now < self->deadline_ns) {
+		now = now_ns();
+	}
+
+	pacer_record(self, now - self->last_wake_ns, now - self->deadline_ns);
+	self->last_wake_ns = now;
+
+	pacer_advance(self);
+	if (now > self->deadline_ns + MAX_BEHIND_FRAMES * self->period_ns) {
+		self->deadline_ns = now;
+		pacer_advance(self);
+	}
+}
+
+void pacer_get_stats(Pacer* self, PacerStats* stats) {
+	memset(stats, 0, sizeof(PacerStats));
+
+	mtx_lock(&self->lock);
+	stats->frames = self->count;
+	memcpy(stats->frame_histogram, self->frame_histogram, sizeof(stats->frame_histogram));
+	memcpy(stats->late_histogram, self->late_histogram, sizeof(stats->late_histogram));
+	if (!self->count) {
+		mtx_unlock(&self->lock);
+		return;
+	}
+
+	u32 max_frame = 0;
+	u32 max_late = 0;
+	for (u32 i = 0; i < self->count; ++i) {
+		if (self->frame_samples[i] > max_frame) {
+			max_frame = self->frame_samples[i];
+		}
+		if (self->late_samples[i] > max_late) {
+			max_late = self->late_samples[i];
+		}
+		if (self->late_samples[i] > LATE_NS) {
+			stats->late_frames += 1;
+		}
+	}
+	stats->mean_frame_ms = (f64) self->frame_sum / (f64) self->count / 1000000.0;
+	stats->mean_late_ms = (f64) self->late_sum / (f64) self->count / 1000000.0;
+	stats->max_frame_ms = (f64) max_frame / 1000000.0;
+	stats->max_late_ms = (f64) max_late / 1000000.0;
+
+	// Upper edge of the bucket containing the 99th percentile
+	u32 wanted = (self->count * 99 + 99) / 100;
+	u32 seen = 0;
+	for (u32 i = 0; i < PACER_BUCKETS; ++i) {
+		seen += self->frame_histogram[i];
+		if (seen >= wanted) {
+			stats->p99_frame_ms = (f64) ((i + 1) * PACER_BUCKET_NS) / 1000000.0;
+			break;
+		}
+	}
+	mtx_unlock(&self->lock);
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include "types.h"
+
+// Histogram buckets are 250us wide, the last one collects everything above
+#define PACER_BUCKET_NS 250000
+#define PACER_BUCKETS 128
+// Number of most recent frames the statistics cover
+#define PACER_WINDOW 512
+
+typedef struct {
+	u32 frames;
+	u32 late_frames;
+	f64 mean_frame_ms;
+	f64 max_frame_ms;
+	f64 p99_frame_ms;
+	f64 mean_late_ms;
+	f64 max_late_ms;
+	u32 frame_histogram[PACER_BUCKETS];
+	u32 late_histogram[PACER_BUCKETS];
+} PacerStats;
+
+typedef struct Pacer Pacer;
+
+Pacer* pacer_new(u64 clock_hz, u64 frame_cycles);
+void pacer_free(Pacer* self);
+void pacer_wait(Pacer* self);
+void pacer_get_stats(Pacer* self, PacerStats* stats);
@@ -1,14 +1,12 @@
 #include "ppu.h"
 #include "bus.h"
+#include "ppu_thread.h"
 #include <assert.h>
 #include <string.h>
 
-#define LCD_WIDTH 160
-#define LCD_HEIGHT 144
-
 #define SCANLINE_CYCLES 456
 
-static u32 PALETTE_COLORS[] = {
+static const u32 PALETTE_COLORS[] = {
 	[0] = 0xFFFFFFFF,
 	[1] = 0xD3D3D3FF,
 	[2] = 0x5A5A5AFF,
@@ -49,6 +47,9 @@ static void ppu_change_mode(Ppu* self, PpuMode mode) {
 			if (!self->wy_triggered) {
 				self->bg_fifo_discard = self->scx % 8;
 			}
+			if (self->renderer) {
+				ppu_renderer_begin_line(self->renderer, self);
+			}
 			break;
 		case PPU_MODE_H_BLANK:
 			irq = self->stat & STAT_IRQ_H_BLANK;
@@ -56,6 +57,9 @@ static void ppu_change_mode(Ppu* self, PpuMode mode) {
 				self->window_tile_x = 0;
 				self->window_y += 1;
 			}
+			if (self->renderer) {
+				ppu_renderer_end_line(self->renderer);
+			}
 			break;
 		case PPU_MODE_V_BLANK:
 			assert(self->ly == LCD_HEIGHT);
@@ -64,6 +68,9 @@ static void ppu_change_mode(Ppu* self, PpuMode mode) {
 			cpu_request_irq(&self->bus->cpu, IRQ_VBLANK);
 			self->window_tile_x = 0;
 			self->window_y = 0;
+			if (self->renderer) {
+				ppu_renderer_end_frame(self->renderer);
+			}
 			break;
 	}
 
@@ -154,13 +161,20 @@ static void ppu_draw(Ppu* self) {
 			y_off = 32 * (((self->ly + self->scy) / 8) & 0xFF);
 		}
 
-		self->bg_tile_num = self->vram[tile_map_area + ((x_off + y_off) & 0x3FF)];
+		if (!self->timing_only) {
+			self->bg_tile_num = self->vram[tile_map_area + ((x_off + y_off) & 0x3FF)];
+		}
 
 		self->bg_tile_data_area = self->lcdc & 1 << 4 ? 0 : 0x1000;
 
 		self->bg_fetch_state = FETCH_STATE_TILE_LOW;
 	}
 	else if (self->bg_fetch_state == FETCH_STATE_TILE_LOW) {
+		if (self->timing_only) {
+			self->bg_fetch_state = FETCH_STATE_TILE_HIGH;
+			return;
+		}
+
 		u8 fine_y;
 		if (self->wx_triggered) {
 			fine_y = self->window_y % 8;
@@ -178,19 +192,21 @@ static void ppu_draw(Ppu* self) {
 		self->bg_fetch_state = FETCH_STATE_TILE_HIGH;
 	}
 	else if (self->bg_fetch_state == FETCH_STATE_TILE_HIGH) {
-		u8 fine_y;
-		if (self->wx_triggered) {
-			fine_y = self->window_y % 8;
-		}
-		else {
-			fine_y = (self->ly + self->scy) % 8;
-		}
+		if (!self->timing_only) {
+			u8 fine_y;
+			if (self->wx_triggered) {
+				fine_y = self->window_y % 8;
+			}
+			else {
+				fine_y = (self->ly + self->scy) % 8;
+			}
 
-		if (self->bg_tile_data_area == 0x1000) {
-			self->bg_tile_high = self->vram[self->bg_tile_data_area + fine_y * 2 + 16 * (i8) self->bg_tile_num + 1];
-		}
-		else {
-			self->bg_tile_high = self->vram[self->bg_tile_data_area + fine_y * 2 + 16 * self->bg_tile_num + 1];
+			if (self->bg_tile_data_area == 0x1000) {
+				self->bg_tile_high = self->vram[self->bg_tile_data_area + fine_y * 2 + 16 * (i8) self->bg_tile_num + 1];
+			}
+			else {
+				self->bg_tile_high = self->vram[self->bg_tile_data_area + fine_y * 2 + 16 * self->bg_tile_num + 1];
+			}
 		}
 
 		self->bg_fetch_state = FETCH_STATE_PUSH;
@@ -202,7 +218,7 @@ static void ppu_draw(Ppu* self) {
 	else if (self->bg_fetch_state == FETCH_STATE_PUSH) {
 		if (self->bg_fifo_size == 0) {
 			self->bg_fifo = 0;
-			for (u8 i = 0; i < 8; ++i) {
+			for (u8 i = 0; i < 8 && !self->timing_only; ++i) {
 				self->bg_fifo <<= 3;
 				self->bg_fifo |= (self->bg_tile_low >> 7) << 2 | ((self->bg_tile_high >> 7) << 1);
 				self->bg_tile_low <<= 1;
@@ -258,6 +274,67 @@ static void ppu_v_blank(Ppu* self) {
 	}
 }
 
+// A whole tile can be pushed as one span when nothing can interrupt it
+// on its way to the lcd: no sprite overlaps it and the window can't trigger inside it.
+// Register writes that affect the output flush the span first (see ppu_flush_span).
+static bool ppu_span_possible(Ppu* self) {
+	if (self->bg_fifo_size != 8 || self->bg_fifo_discard || self->lcd_x + 8 > LCD_WIDTH) {
+		return false;
+	}
+
+	if (self->wy_triggered && self->lcdc & 1 << 5) {
+		i16 window_x = (i16) self->wx - 7;
+		if (window_x >= self->lcd_x && window_x < self->lcd_x + 8) {
+			return false;
+		}
+	}
+
+	if (self->lcdc & 1 << 1) {
+		for (u8 i = 0; i < self->sprite_count; ++i) {
+			u8 x = self->sprites[i].x;
+			if (x >= self->lcd_x + 16) {
+				break;
+			}
+			if (x > self->lcd_x) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+void ppu_flush_span(Ppu* self) {
+	if (!self->span_active) {
+		return;
+	}
+	self->span_active = false;
+
+	u8 count = self->lcd_x - self->span_x;
+	u32* row = &self->texture[self->ly * LCD_WIDTH + self->span_x];
+
+	if (self->lcdc & 1 << 0) {
+		// Indexed by the two fifo bits of a pixel (low bit first, high bit second)
+		u32 colors[4];
+		for (u8 bits = 0; bits < 4; ++bits) {
+			u8 color_id = bits >> 1 | (bits & 1) << 1;
+			colors[bits] = PALETTE_COLORS[self->bg_palette >> (2 * color_id) & 0b11];
+		}
+		for (u8 i = 0; i < count; ++i) {
+			row[i] = colors[self->bg_fifo >> (22 - 3 * i) & 0b11];
+		}
+	}
+	else {
+		u32 color = PALETTE_COLORS[self->bg_palette & 0b11];
+		for (u8 i = 0; i < count; ++i) {
+			row[i] = color;
+		}
+	}
+
+	// The rest of the tile (if any) continues through the per pixel path
+	self->bg_fifo <<= 3 * count;
+}
+
 static void ppu_lcd_push(Ppu* self) {
 	if (!self->fetching_sprite && self->bg_fifo_size) {
 		if (self->bg_fifo_discard) {
@@ -267,6 +344,26 @@ static void ppu_lcd_push(Ppu* self) {
 			return;
 		}
 
+		if (self->timing_only) {
+			self->lcd_x += 1;
+			self->bg_fifo_size -= 1;
+			return;
+		}
+
+		if (!self->span_active && ppu_span_possible(self)) {
+			self->span_active = true;
+			self->span_x = self->lcd_x;
+		}
+
+		if (self->span_active) {
+			self->lcd_x += 1;
+			self->bg_fifo_size -= 1;
+			if (!self->bg_fifo_size) {
+				ppu_flush_span(self);
+			}
+			return;
+		}
+
 		assert(self->ly < LCD_HEIGHT);
 		assert(self->lcd_x < LCD_WIDTH);
 
@@ -288,18 +385,110 @@ static void ppu_lcd_push(Ppu* self) {
 	}
 }
 
+static void ppu_finish_line(Ppu* self) {
+	const u32* row = &self->texture[self->ly * LCD_WIDTH];
+	u64 hash = 0xCBF29CE484222325;
+	for (u8 i = 0; i < LCD_WIDTH; ++i) {
+		hash = (hash ^ row[i]) * 0x100000001B3;
+	}
+
+	if (hash != self->line_hashes[self->ly]) {
+		self->line_hashes[self->ly] = hash;
+		self->dirty_lines[self->ly / 64] |= 1ULL << (self->ly % 64);
+	}
+}
+
+void ppu_draw_dot(Ppu* self) {
+	ppu_draw(self);
+	ppu_lcd_push(self);
+	if (self->lcd_x == LCD_WIDTH && !self->timing_only) {
+		ppu_finish_line(self);
+	}
+}
+
+bool ppu_line_dirty(const Ppu* self, u8 line) {
+	return self->dirty_lines[line / 64] & 1ULL << (line % 64);
+}
+
+void ppu_clear_dirty_lines(Ppu* self) {
+	memset(self->dirty_lines, 0, sizeof(self->dirty_lines));
+}
+
+void ppu_apply_write(Ppu* self, u16 addr, u8 value) {
+	if (addr <= 0x9FFF) {
+		self->vram[addr - 0x8000] = value;
+	}
+	else if (addr <= 0xFE9F) {
+		self->oam[addr - 0xFE00] = value;
+	}
+	else if (addr == 0xFF40) {
+		ppu_flush_span(self);
+		self->lcdc = value;
+	}
+	else if (addr == 0xFF41) {
+		self->stat &= 0b111;
+		self->stat |= value & ~0b111;
+	}
+	else if (addr == 0xFF42) {
+		self->scy = value;
+	}
+	else if (addr == 0xFF43) {
+		self->scx = value;
+	}
+	else if (addr == 0xFF45) {
+		self->lyc = value;
+	}
+	else if (addr == 0xFF47) {
+		ppu_flush_span(self);
+		self->bg_palette = value;
+	}
+	else if (addr == 0xFF48) {
+		self->ob_palette0 = value;
+	}
+	else if (addr == 0xFF49) {
+		self->ob_palette1 = value;
+	}
+	else if (addr == 0xFF4A) {
+		self->wy = value;
+	}
+	else if (addr == 0xFF4B) {
+		self->wx = value;
+	}
+}
+
+void ppu_write(Ppu* self, u16 addr, u8 value) {
+	bool was_on = self->lcdc & 1 << 7;
+	// Stat and lyc don't affect the pixels, the renderer gets them with the line state
+	if (self->renderer && addr != 0xFF41 && addr != 0xFF45) {
+		ppu_renderer_log(self->renderer, self->dots, addr, value);
+	}
+	ppu_apply_write(self, addr, value);
+
+	// The renderer's line has to end with the lcd or the writes done while it's off are
+	// never published
+	if (self->renderer && addr == 0xFF40 && ppu_get_mode(self) == PPU_MODE_DRAW) {
+		bool is_on = self->lcdc & 1 << 7;
+		if (was_on && !is_on) {
+			ppu_renderer_abort_line(self->renderer, self->dots);
+		}
+		else if (!was_on && is_on) {
+			ppu_renderer_resume_line(self->renderer, self->dots);
+		}
+	}
+}
+
 void ppu_clock(Ppu* self) {
 	if (!(self->lcdc & 1 << 7)) {
 		return;
 	}
+	self->dots += 1;
 
 	switch (ppu_get_mode(self)) {
 		case PPU_MODE_OAM_SCAN:
 			ppu_oam_scan(self);
 			break;
 		case PPU_MODE_DRAW:
-			ppu_draw(self);
-			ppu_lcd_push(self);
+			ppu_draw_dot(self);
 			if (self->lcd_x == LCD_WIDTH) {
 				ppu_change_mode(self, PPU_MODE_H_BLANK);
 			}
@@ -1,6 +1,9 @@
 #pragma once
 #include "types.h"
 
+#define LCD_WIDTH 160
+#define LCD_HEIGHT 144
+
 typedef struct {
 	u8 x;
 	u8 y;
@@ -24,11 +27,14 @@ typedef enum {
 
 typedef struct Ppu {
 	struct Bus* bus;
+	struct PpuRenderer* renderer;
 	u32* texture;
 	u32 cycle;
+	// Dots clocked while the lcd is on, used to timestamp writes for the renderer
+	u32 dots;
+	// Only keep mode 3 timing, the pixels are produced by the renderer thread
+	bool timing_only;
 	OamEntry sprites[10];
-	u8 vram[1024 * 8];
-	u8 oam[160];
 	u8 lcdc;
 	u8 ly;
 	u8 lyc;
@@ -50,6 +56,9 @@ typedef struct Ppu {
 	u8 bg_fifo_size;
 	u8 bg_fifo_discard;
 	FetchState bg_fetch_state;
+	// Pixels pushed since span_x are only written to the texture once the span ends
+	bool span_active;
+	u8 span_x;
 
 	u32 sprite_fifo;
 	u8 sprite_fifo_size;
@@ -68,9 +77,36 @@ typedef struct Ppu {
 	bool wy_triggered;
 
 	bool fetching_sprite;
+
+	// Keep these last, everything before them is the per line state copied to the renderer
+	u8 vram[1024 * 8];
+	u8 oam[160];
+
+	// Hash of every line in the last frame, lines whose hash changed are marked dirty
+	u64 line_hashes[LCD_HEIGHT];
+	u64 dirty_lines[(LCD_HEIGHT + 63) / 64];
 } Ppu;
 
+#define PPU_LINE_STATE_SIZE offsetof(Ppu, vram)
+
+// Copy of the state the tile and sprite viewers are generated from
+typedef struct {
+	u8 tile_data[0x1800];
+	u8 oam[160];
+	u8 lcdc;
+	u8 bg_palette;
+	u8 ob_palette0;
+	u8 ob_palette1;
+} PpuTileData;
+
 void ppu_reset(Ppu* self);
 void ppu_clock(Ppu* self);
-void ppu_generate_tile_map(Ppu* self, u32 width, u32 height, u32* data);
-void ppu_generate_sprite_map(Ppu* self, u32 width, u32 height, u32* data);
+void ppu_flush_span(Ppu* self);
+void ppu_write(Ppu* self, u16 addr, u8 value);
+void ppu_apply_write(Ppu* self, u16 addr, u8 value);
+void ppu_draw_dot(Ppu* self);
+bool ppu_line_dirty(const Ppu* self, u8 line);
+void ppu_clear_dirty_lines(Ppu* self);
+void ppu_copy_tile_data(const Ppu* self, PpuTileData* data);
+void ppu_generate_tile_map(const PpuTileData* self, const PpuTileData* prev, u32 width, u32 height, u32* data);
+void ppu_generate_sprite_map(const PpuTileData* self, const PpuTileData* prev, u32 width, u32 height, u32* data);
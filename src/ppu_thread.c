@@ -0,0 +1,330 @@
+#include "ppu_thread.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Register/memory writes done by the cpu are logged with the dot they happened on,
+// the worker replays them on its own copy of the ppu while redrawing each line.
+// Entries are published to the worker at the end of each line (never in the middle of one)
+// so a line is always replayed with all of its writes available.
+
+#define LOG_CAPACITY (1 << 16)
+#define LOG_PUBLISH_THRESHOLD 1024
+#define LINE_CAPACITY 256
+
+typedef enum : u8 {
+	LOG_WRITE,
+	LOG_LINE,
+	// The lcd was turned off in the middle of the line, drawing stops until it's turned back on
+	LOG_LINE_ABORT,
+	LOG_LINE_RESUME,
+	LOG_FRAME
+} LogType;
+
+typedef struct {
+	u32 dots;
+	// Line state index for LOG_LINE
+	u16 addr;
+	u8 value;
+	LogType type;
+} LogEntry;
+
+struct PpuRenderer {
+	Ppu shadow;
+	PpuRenderMode mode;
+	// Only used when comparing, otherwise lines go to the texture the ppu had at the start of the line
+	u32* compare_texture;
+
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t work_cond;
+	cnd_t done_cond;
+	atomic_bool stop;
+
+	// Owned by the emulation thread
+	usize head;
+	usize published;
+	usize line_seq;
+	usize frame_seq;
+	bool in_line;
+	bool line_aborted;
+
+	atomic_size_t tail;
+	atomic_size_t consumed;
+	atomic_size_t lines_consumed;
+	atomic_size_t frames_done;
+
+	LogEntry log[LOG_CAPACITY];
+	u8 lines[LINE_CAPACITY][PPU_LINE_STATE_SIZE];
+};
+
+static void ppu_renderer_publish(PpuRenderer* self) {
+	if (self->published == self->head) {
+		return;
+	}
+	self->published = self->head;
+	atomic_store_explicit(&self->tail, self->head, memory_order_release);
+	mtx_lock(&self->lock);
+	cnd_signal(&self->work_cond);
+	mtx_unlock(&self->lock);
+}
+
+static void ppu_renderer_push(PpuRenderer* self, LogEntry entry) {
+	// A line only spans a few dozen writes (turning the lcd off ends it), so the log never
+	// fills up while one is open and publishing makes room eventually.
+	while (self->head - atomic_load_explicit(&self->consumed, memory_order_acquire) == LOG_CAPACITY) {
+		if (!self->in_line) {
+			ppu_renderer_publish(self);
+		}
+		thrd_yield();
+	}
+
+	self->log[self->head % LOG_CAPACITY] = entry;
+	self->head += 1;
+
+	if (!self->in_line && self->head - self->published >= LOG_PUBLISH_THRESHOLD) {
+		ppu_renderer_publish(self);
+	}
+}
+
+void ppu_renderer_log(PpuRenderer* self, u32 dots, u16 addr, u8 value) {
+	ppu_renderer_push(self, (LogEntry) {
+		.dots = dots,
+		.addr = addr,
+		.value = value,
+		.type = LOG_WRITE
+	});
+}
+
+void ppu_renderer_begin_line(PpuRenderer* self, const Ppu* ppu) {
+	ppu_renderer_publish(self);
+	while (self->line_seq - atomic_load_explicit(&self->lines_consumed, memory_order_acquire) == LINE_CAPACITY) {
+		thrd_yield();
+	}
+
+	u16 index = self->line_seq % LINE_CAPACITY;
+	memcpy(self->lines[index], ppu, PPU_LINE_STATE_SIZE);
+	self->line_seq += 1;
+	self->in_line = true;
+	self->line_aborted = false;
+
+	ppu_renderer_push(self, (LogEntry) {
+		.dots = ppu->dots,
+		.addr = index,
+		.type = LOG_LINE
+	});
+}
+
+void ppu_renderer_end_line(PpuRenderer* self) {
+	self->in_line = false;
+	ppu_renderer_publish(self);
+}
+
+// Mode 3 stops where it is when the lcd is turned off and carries on once it's turned back
+// on. The line is closed in between so the writes done meanwhile get published.
+void ppu_renderer_abort_line(PpuRenderer* self, u32 dots) {
+	if (!self->in_line) {
+		return;
+	}
+	ppu_renderer_push(self, (LogEntry) {.dots = dots, .type = LOG_LINE_ABORT});
+	self->line_aborted = true;
+	ppu_renderer_end_line(self);
+}
+
+void ppu_renderer_resume_line(PpuRenderer* self, u32 dots) {
+	if (!self->line_aborted) {
+		return;
+	}
+	self->line_aborted = false;
+	self->in_line = true;
+	ppu_renderer_push(self, (LogEntry) {.dots = dots, .type = LOG_LINE_RESUME});
+}
+
+void ppu_renderer_end_frame(PpuRenderer* self) {
+	self->frame_seq += 1;
+	ppu_renderer_push(self, (LogEntry) {.type = LOG_FRAME});
+	ppu_renderer_publish(self);
+}
+
+static u64 frame_hash(const u32* texture) {
+	u64 hash = 0xCBF29CE484222325;
+	for (usize i = 0; i < LCD_WIDTH * LCD_HEIGHT; ++i) {
+		hash ^= texture[i];
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+void ppu_renderer_wait_frame(Ppu* ppu) {
+	PpuRenderer* self = ppu->renderer;
+
+	mtx_lock(&self->lock);
+	while (atomic_load_explicit(&self->frames_done, memory_order_acquire) != self->frame_seq) {
+		cnd_wait(&self->done_cond, &self->lock);
+	}
+	mtx_unlock(&self->lock);
+
+	if (self->mode == PPU_RENDER_THREADED) {
+		for (usize i = 0; i < sizeof(ppu->dirty_lines) / sizeof(*ppu->dirty_lines); ++i) {
+			ppu->dirty_lines[i] |= self->shadow.dirty_lines[i];
+		}
+		ppu_clear_dirty_lines(&self->shadow);
+	}
+
+	if (self->mode == PPU_RENDER_COMPARE) {
+		u64 expected = frame_hash(ppu->texture);
+		u64 got = frame_hash(self->compare_texture);
+		if (expected != got) {
+			fprintf(stderr, "ppu: frame %zu differs between inline and threaded rendering (%016llX != %016llX)\n",
+					self->frame_seq, (unsigned long long) expected, (unsigned long long) got);
+		}
+	}
+}
+
+// Draws the rest of the shadow's line, returns where the log continues after it
+static usize ppu_renderer_draw_dots(PpuRenderer* self, u32 dots, usize pos, usize tail) {
+	Ppu* shadow = &self->shadow;
+	while (shadow->lcd_x < LCD_WIDTH) {
+		for (; pos != tail; ++pos) {
+			const LogEntry* entry = &self->log[pos % LOG_CAPACITY];
+			if ((entry->type != LOG_WRITE && entry->type != LOG_LINE_ABORT) || (i32) (entry->dots - dots) > 0) {
+				break;
+			}
+			// The inline ppu stops drawing at the same dot
+			if (entry->type == LOG_LINE_ABORT) {
+				return pos + 1;
+			}
+			ppu_apply_write(shadow, entry->addr, entry->value);
+		}
+
+		ppu_draw_dot(shadow);
+		dots += 1;
+	}
+
+	return pos;
+}
+
+static usize ppu_renderer_draw_line(PpuRenderer* self, u32 dots, u16 index, usize pos, usize tail) {
+	Ppu* shadow = &self->shadow;
+	memcpy(shadow, self->lines[index], PPU_LINE_STATE_SIZE);
+	shadow->renderer = NULL;
+	shadow->timing_only = false;
+	if (self->mode == PPU_RENDER_COMPARE) {
+		shadow->texture = self->compare_texture;
+	}
+	atomic_fetch_add_explicit(&self->lines_consumed, 1, memory_order_release);
+
+	return ppu_renderer_draw_dots(self, dots, pos, tail);
+}
+
+static int ppu_renderer_main(void* arg) {
+	PpuRenderer* self = (PpuRenderer*) arg;
+
+	usize pos = 0;
+	while (true) {
+		usize tail = atomic_load_explicit(&self->tail, memory_order_acquire);
+		if (pos == tail) {
+			mtx_lock(&self->lock);
+			while (atomic_load_explicit(&self->tail, memory_order_acquire) == pos && !atomic_load(&self->stop)) {
+				cnd_wait(&self->work_cond, &self->lock);
+			}
+			mtx_unlock(&self->lock);
+
+			if (atomic_load_explicit(&self->tail, memory_order_acquire) == pos) {
+				break;
+			}
+			continue;
+		}
+
+		while (pos != tail) {
+			LogEntry entry = self->log[pos % LOG_CAPACITY];
+			pos += 1;
+
+			if (entry.type == LOG_WRITE) {
+				ppu_apply_write(&self->shadow, entry.addr, entry.value);
+			}
+			else if (entry.type == LOG_LINE) {
+				pos = ppu_renderer_draw_line(self, entry.dots, entry.addr, pos, tail);
+			}
+			else if (entry.type == LOG_LINE_RESUME) {
+				pos = ppu_renderer_draw_dots(self, entry.dots, pos, tail);
+			}
+			else if (entry.type == LOG_FRAME) {
+				mtx_lock(&self->lock);
+				atomic_fetch_add_explicit(&self->frames_done, 1, memory_order_release);
+				cnd_broadcast(&self->done_cond);
+				mtx_unlock(&self->lock);
+			}
+
+			atomic_store_explicit(&self->consumed, pos, memory_order_release);
+		}
+	}
+
+	return 0;
+}
+
+bool ppu_renderer_start(Ppu* ppu, PpuRenderMode mode) {
+	if (mode == PPU_RENDER_INLINE || ppu->renderer) {
+		return true;
+	}
+
+	PpuRenderer* self = calloc(1, sizeof(PpuRenderer));
+	if (!self) {
+		return false;
+	}
+	self->mode = mode;
+
+	if (mode == PPU_RENDER_COMPARE) {
+		self->compare_texture = calloc(1, LCD_WIDTH * LCD_HEIGHT * 4);
+		if (!self->compare_texture) {
+			free(self);
+			return false;
+		}
+	}
+
+	memcpy(&self->shadow, ppu, sizeof(Ppu));
+	self->shadow.renderer = NULL;
+	self->shadow.timing_only = false;
+
+	mtx_init(&self->lock, mtx_plain);
+	cnd_init(&self->work_cond);
+	cnd_init(&self->done_cond);
+	if (thrd_create(&self->thread, ppu_renderer_main, self) != thrd_success) {
+		mtx_destroy(&self->lock);
+		cnd_destroy(&self->work_cond);
+		cnd_destroy(&self->done_cond);
+		free(self->compare_texture);
+		free(self);
+		return false;
+	}
+
+	ppu->renderer = self;
+	ppu->timing_only = mode == PPU_RENDER_THREADED;
+	return true;
+}
+
+void ppu_renderer_stop(Ppu* ppu) {
+	PpuRenderer* self = ppu->renderer;
+	if (!self) {
+		return;
+	}
+
+	self->in_line = false;
+	ppu_renderer_publish(self);
+	mtx_lock(&self->lock);
+	atomic_store(&self->stop, true);
+	cnd_signal(&self->work_cond);
+	mtx_unlock(&self->lock);
+	thrd_join(self->thread, NULL);
+
+	mtx_destroy(&self->lock);
+	cnd_destroy(&self->work_cond);
+	cnd_destroy(&self->done_cond);
+	free(self->compare_texture);
+	free(self);
+
+	ppu->renderer = NULL;
+	ppu->timing_only = false;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "ppu.h"
+
+typedef enum {
+	// Pixels are produced by the ppu itself while it is clocked
+	PPU_RENDER_INLINE,
+	// The ppu only keeps timing, scanlines are rendered by a worker thread
+	PPU_RENDER_THREADED,
+	// Render on both and compare the frame hashes, for debugging the threaded path
+	PPU_RENDER_COMPARE
+} PpuRenderMode;
+
+typedef struct PpuRenderer PpuRenderer;
+
+bool ppu_renderer_start(Ppu* ppu, PpuRenderMode mode);
+void ppu_renderer_stop(Ppu* ppu);
+void ppu_renderer_log(PpuRenderer* self, u32 dots, u16 addr, u8 value);
+void ppu_renderer_begin_line(PpuRenderer* self, const Ppu* ppu);
+void ppu_renderer_end_line(PpuRenderer* self);
+void ppu_renderer_abort_line(PpuRenderer* self, u32 dots);
+void ppu_renderer_resume_line(PpuRenderer* self, u32 dots);
+void ppu_renderer_end_frame(PpuRenderer* self);
+void ppu_renderer_wait_frame(Ppu* ppu);
@@ -1,118 +1,124 @@
 #include "ppu.h"
+#include <string.h>
 
-static u32 PALETTE_COLORS[] = {
+static const u32 PALETTE_COLORS[] = {
 	[0] = 0xFFFFFFFF,
 	[1] = 0xD3D3D3FF,
 	[2] = 0x5A5A5AFF,
 	[3] = 0x000000FF
 };
 
-void ppu_generate_tile_map(Ppu* self, u32 width, u32 height, u32* data) {
-	u16 tile_index = 0;
+#define TILE_COUNT (128 * 3)
+#define SPRITE_COUNT 40
 
+void ppu_copy_tile_data(const Ppu* self, PpuTileData* data) {
+	memcpy(data->tile_data, self->vram, sizeof(data->tile_data));
+	memcpy(data->oam, self->oam, sizeof(data->oam));
+	data->lcdc = self->lcdc;
+	data->bg_palette = self->bg_palette;
+	data->ob_palette0 = self->ob_palette0;
+	data->ob_palette1 = self->ob_palette1;
+}
+
+// Largest scale at which `count` cells of 8 x cell_height pixels still fit
+static u16 viewer_scale(u32 width, u32 height, u8 cell_height, usize count) {
 	u16 scale = 1;
-	usize x_tiles;
 	while (true) {
 		scale += 1;
-		x_tiles = width / (scale * 8);
-		usize y_tiles = height / (scale * 8);
-		if (y_tiles * x_tiles < 128 * 3) {
-			scale -= 1;
-			x_tiles = width / (scale * 8);
-			break;
+		usize x_cells = width / (scale * 8);
+		usize y_cells = height / (scale * cell_height);
+		if (y_cells * x_cells < count) {
+			return scale - 1;
 		}
 	}
+}
 
-	for (u32 y = 0; y < height; ++y) {
-		u32 tmp_tile_index = tile_index;
-		u16 x_tiles_placed = 0;
-		for (u32 x = 0; x < width; ++x) {
-			u16 off = 16 * tmp_tile_index + (y / scale % 8) * 2;
-			u8 tile_low = self->vram[off];
-			u8 tile_high = self->vram[off + 1];
-
-			tile_low <<= x / scale % 8;
-			tile_high <<= x / scale % 8;
-			u8 color_id = (tile_low >> 7) | (tile_high >> 7) << 1;
-			u8 color_idx = self->bg_palette >> (2 * color_id) & 0b11;
-
-			data[y * width + x] = PALETTE_COLORS[color_idx];
-
-			if (x % (scale * 8) == scale * 8 - 1) {
-				x_tiles_placed += 1;
-				tmp_tile_index += 1;
-			}
+// Draws one 8 pixel wide cell, rows past the first 8 repeat the tile
+static void draw_tile(u32* data, u32 width, u32 x, u32 y, u16 scale, u8 rows, const u8* tile, u8 palette) {
+	u32 colors[4];
+	for (u8 i = 0; i < 4; ++i) {
+		colors[i] = PALETTE_COLORS[palette >> (2 * i) & 0b11];
+	}
 
-			if (x_tiles_placed == x_tiles) {
-				break;
+	for (u8 row = 0; row < rows; ++row) {
+		u8 tile_low = tile[(row % 8) * 2];
+		u8 tile_high = tile[(row % 8) * 2 + 1];
+
+		u32* line = &data[(y + row * scale) * width + x];
+		for (u8 col = 0; col < 8; ++col) {
+			u32 color = colors[(tile_low >> 7) | (tile_high >> 7) << 1];
+			tile_low <<= 1;
+			tile_high <<= 1;
+			for (u16 i = 0; i < scale; ++i) {
+				line[col * scale + i] = color;
 			}
 		}
+		for (u16 i = 1; i < scale; ++i) {
+			memcpy(line + i * width, line, 8 * scale * sizeof(u32));
+		}
+	}
+}
+
+// Only the tiles that changed since prev are redrawn, prev may be NULL to draw everything
+void ppu_generate_tile_map(const PpuTileData* self, const PpuTileData* prev, u32 width, u32 height, u32* data) {
+	u16 scale = viewer_scale(width, height, 8, TILE_COUNT);
+	usize x_tiles = width / (scale * 8);
+
+	if (prev && prev->bg_palette != self->bg_palette) {
+		prev = NULL;
+	}
+	if (!prev) {
+		memset(data, 0, width * height * sizeof(u32));
+	}
 
-		if (y % (scale * 8) == scale * 8 - 1) {
-			tile_index += x_tiles;
+	for (u16 i = 0; i < TILE_COUNT; ++i) {
+		const u8* tile = &self->tile_data[i * 16];
+		if (prev && memcmp(tile, &prev->tile_data[i * 16], 16) == 0) {
+			continue;
 		}
 
-		if (tile_index >= 128 * 3) {
+		u32 x = (i % x_tiles) * scale * 8;
+		u32 y = (i / x_tiles) * scale * 8;
+		if (y + scale * 8 > height) {
 			break;
 		}
+		draw_tile(data, width, x, y, scale, 8, tile, self->bg_palette);
 	}
 }
 
-void ppu_generate_sprite_map(Ppu* self, u32 width, u32 height, u32* data) {
+void ppu_generate_sprite_map(const PpuTileData* self, const PpuTileData* prev, u32 width, u32 height, u32* data) {
 	u8 sprite_height = self->lcdc & 1 << 2 ? 16 : 8;
+	u16 scale = viewer_scale(width, height, sprite_height, SPRITE_COUNT);
+	usize x_sprites = width / (scale * 8);
 
-	u16 scale = 1;
-	usize x_sprites;
-	usize y_sprites;
-	while (true) {
-		scale += 1;
-		x_sprites = width / (scale * 8);
-		y_sprites = height / (scale * sprite_height);
-		if (y_sprites * x_sprites < 40) {
-			scale -= 1;
-			x_sprites = width / (scale * 8);
-			// y_sprites = height / (scale * sprite_height);
-			break;
-		}
+	if (prev && (prev->ob_palette0 != self->ob_palette0 ||
+				 prev->ob_palette1 != self->ob_palette1 ||
+				 (prev->lcdc ^ self->lcdc) & 1 << 2)) {
+		prev = NULL;
+	}
+	// The layout depends on the sprite height
+	if (!prev) {
+		memset(data, 0, width * height * sizeof(u32));
 	}
 
-	u16 oam_index = 0;
-	for (u32 y = 0; y < height; ++y) {
-		u16 tmp_oam_index = oam_index;
-		u8 x_sprites_placed = 0;
-		for (u32 x = 0; x < width; ++x) {
-			u8 tile_index = self->oam[tmp_oam_index + 2];
-			u8 flags = self->oam[tmp_oam_index + 3];
-
-			u16 off = 16 * tile_index + (y / scale % 8) * 2;
-			u8 tile_low = self->vram[off];
-			u8 tile_high = self->vram[off + 1];
-
-			tile_low <<= x / scale % 8;
-			tile_high <<= x / scale % 8;
-			u8 color_id = (tile_low >> 7) | (tile_high >> 7) << 1;
-
-			u8 palette = flags & 1 << 4 ? self->ob_palette1 : self->ob_palette0;
-			u8 color_idx = palette >> (2 * color_id) & 0b11;
-
-			data[y * width + x] = PALETTE_COLORS[color_idx];
-
-			if (x % (scale * 8) == scale * 8 - 1) {
-				x_sprites_placed += 1;
-				tmp_oam_index += 4;
-			}
-
-			if (x_sprites_placed == x_sprites || tmp_oam_index >= 40 * 4) {
-				break;
-			}
-		}
+	for (u8 i = 0; i < SPRITE_COUNT; ++i) {
+		u8 tile_index = self->oam[i * 4 + 2];
+		u8 flags = self->oam[i * 4 + 3];
+		const u8* tile = &self->tile_data[tile_index * 16];
 
-		if (y % (scale * sprite_height) == scale * sprite_height - 1) {
-			oam_index += x_sprites * 4;
+		if (prev &&
+			prev->oam[i * 4 + 2] == tile_index &&
+			prev->oam[i * 4 + 3] == flags &&
+			memcmp(tile, &prev->tile_data[tile_index * 16], 16) == 0) {
+			continue;
 		}
 
-		if (oam_index >= 40 * 4) {
+		u32 x = (i % x_sprites) * scale * 8;
+		u32 y = (i / x_sprites) * scale * sprite_height;
+		if (y + scale * sprite_height > height) {
 			break;
 		}
+		u8 palette = flags & 1 << 4 ? self->ob_palette1 : self->ob_palette0;
+		draw_tile(data, width, x, y, scale, sprite_height, tile, palette);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,260 @@
+#include "resampler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RESAMPLER_X86
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+// Stereo polyphase windowed-sinc resampler. The filter is tabulated at PHASES fractional
+// positions and linearly interpolated in between, so any ratio works and it can change
+// while running (rate control). Input is kept planar so every output sample is two
+// dot products per channel over contiguous memory.
+
+#define PHASE_BITS 8
+#define PHASES (1 << PHASE_BITS)
+// Input frames buffered at most, on top of the filter length
+#define HISTORY 4096
+
+#define PI 3.14159265358979323846
+
+typedef void (*DotFn)(const f32* left, const f32* right, const f32* c0, const f32* c1, u32 taps, f32 out[4]);
+
+struct Resampler {
+	u32 taps;
+	// PHASES + 1 rows of taps coefficients, the last one is the first shifted by a frame
+	f32* coeffs;
+	f32* history[2];
+	u32 count;
+	// Position of the next output's window start in history and the step per output, 32.32
+	u64 pos;
+	u64 step;
+	DotFn dot;
+};
+
+static const u32 QUALITY_TAPS[RESAMPLER_QUALITY_MAX] = {
+	[RESAMPLER_FAST] = 16,
+	[RESAMPLER_MEDIUM] = 32,
+	[RESAMPLER_BEST] = 64
+};
+
+static const f64 QUALITY_ROLLOFF[RESAMPLER_QUALITY_MAX] = {
+	[RESAMPLER_FAST] = 0.80,
+	[RESAMPLER_MEDIUM] = 0.90,
+	[RESAMPLER_BEST] = 0.95
+};
+
+static void dot_scalar(const f32* left, const f32* right, const f32* c0, const f32* c1, u32 taps, f32 out[4]) {
+	f32 l0 = 0;
+	f32 l1 = 0;
+	f32 r0 = 0;
+	f32 r1 = 0;
+	for (u32 i = 0; i < taps; ++i) {
+		l0 += left[i] * c0[i];
+		l1 += left[i] * c1[i];
+		r0 += right[i] * c0[i];
+		r1 += right[i] * c1[i];
+	}
+	out[0] = l0;
+	out[1] = l1;
+	out[2] = r0;
+	out[3] = r1;
+}
+
+#ifdef __SSE__
+static f32 hsum_sse(__m128 v) {
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+static void dot_sse(const f32* left, const f32* right, const f32* c0, const f32* c1, u32 taps, f32 out[4]) {
+	__m128 l0 = _mm_setzero_ps();
+	__m128 l1 = _mm_setzero_ps();
+	__m128 r0 = _mm_setzero_ps();
+	__m128 r1 = _mm_setzero_ps();
+	for (u32 i = 0; i < taps; i += 4) {
+		__m128 l = _mm_loadu_ps(left + i);
+		__m128 r = _mm_loadu_ps(right + i);
+		__m128 k0 = _mm_loadu_ps(c0 + i);
+		__m128 k1 = _mm_loadu_ps(c1 + i);
+		l0 = _mm_add_ps(l0, _mm_mul_ps(l, k0));
+		l1 = _mm_add_ps(l1, _mm_mul_ps(l, k1));
+		r0 = _mm_add_ps(r0, _mm_mul_ps(r, k0));
+		r1 = _mm_add_ps(r1, _mm_mul_ps(r, k1));
+	}
+	out[0] = hsum_sse(l0);
+	out[1] = hsum_sse(l1);
+	out[2] = hsum_sse(r0);
+	out[3] = hsum_sse(r1);
+}
+#endif
+
+#ifdef RESAMPLER_X86
+TARGET_AVX static f32 hsum_avx(__m256 v) {
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	__m128 shuf = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+	sum = _mm_add_ps(sum, shuf);
+	shuf = _mm_movehl_ps(shuf, sum);
+	return _mm_cvtss_f32(_mm_add_ss(sum, shuf));
+}
+
+TARGET_AVX static void dot_avx(const f32* left, const f32* right, const f32* c0, const f32* c1, u32 taps, f32 out[4]) {
+	__m256 l0 = _mm256_setzero_ps();
+	__m256 l1 = _mm256_setzero_ps();
+	__m256 r0 = _mm256_setzero_ps();
+	__m256 r1 = _mm256_setzero_ps();
+	for (u32 i = 0; i < taps; i += 8) {
+		__m256 l = _mm256_loadu_ps(left + i);
+		__m256 r = _mm256_loadu_ps(right + i);
+		__m256 k0 = _mm256_loadu_ps(c0 + i);
+		__m256 k1 = _mm256_loadu_ps(c1 + i);
+		l0 = _mm256_add_ps(l0, _mm256_mul_ps(l, k0));
+		l1 = _mm256_add_ps(l1, _mm256_mul_ps(l, k1));
+		r0 = _mm256_add_ps(r0, _mm256_mul_ps(r, k0));
+		r1 = _mm256_add_ps(r1, _mm256_mul_ps(r, k1));
+	}
+	out[0] = hsum_avx(l0);
+	out[1] = hsum_avx(l1);
+	out[2] = hsum_avx(r0);
+	out[3] = hsum_avx(r1);
+}
+#endif
+
+static DotFn dot_best = dot_scalar;
+static once_flag dot_once = ONCE_FLAG_INIT;
+
+static void select_dot() {
+#ifdef __SSE__
+	dot_best = dot_sse;
+#endif
+#ifdef RESAMPLER_X86
+	if (__builtin_cpu_supports("avx")) {
+		dot_best = dot_avx;
+	}
+#endif
+}
+
+// Blackman-Harris windowed sinc with the cutoff in cycles per input frame
+static void resampler_fill_coeffs(Resampler* self, f64 cutoff) {
+	u32 taps = self->taps;
+	for (u32 phase = 0; phase <= PHASES; ++phase) {
+		f32* row = self->coeffs + phase * taps;
+		f64 frac = (f64) phase / PHASES;
+		f64 sum = 0;
+		for (u32 i = 0; i < taps; ++i) {
+			f64 t = (f64) (taps / 2 - 1) + frac - (f64) i;
+			f64 x = 2.0 * cutoff * t;
+			f64 sinc = x == 0 ? 1.0 : sin(PI * x) / (PI * x);
+			f64 n = (t + (f64) taps / 2) / (f64) taps;
+			f64 window = 0.35875 - 0.48829 * cos(2 * PI * n) + 0.14128 * cos(4 * PI * n) - 0.01168 * cos(6 * PI * n);
+			f64 value = n <= 0 || n >= 1 ? 0 : 2.0 * cutoff * sinc * window;
+			row[i] = (f32) value;
+			sum += value;
+		}
+		// Unity gain at DC for every phase
+		for (u32 i = 0; i < taps; ++i) {
+			row[i] = (f32) (row[i] / sum);
+		}
+	}
+}
+
+Resampler* resampler_new(ResamplerQuality quality, f64 in_rate, f64 out_rate) {
+	if (quality >= RESAMPLER_QUALITY_MAX) {
+		return NULL;
+	}
+
+	Resampler* self = calloc(1, sizeof(Resampler));
+	if (!self) {
+		return NULL;
+	}
+	self->taps = QUALITY_TAPS[quality];
+	self->coeffs = malloc((PHASES + 1) * self->taps * sizeof(f32));
+	self->history[0] = calloc(HISTORY + self->taps, sizeof(f32));
+	self->history[1] = calloc(HISTORY + self->taps, sizeof(f32));
+	if (!self->coeffs || !self->history[0] || !self->history[1]) {
+		resampler_free(self);
+		return NULL;
+	}
+
+	call_once(&dot_once, select_dot);
+	self->dot = dot_best;
+
+	f64 ratio = out_rate < in_rate ? out_rate / in_rate : 1.0;
+	resampler_fill_coeffs(self, 0.5 * ratio * QUALITY_ROLLOFF[quality]);
+	resampler_set_rates(self, in_rate, out_rate);
+	return self;
+}
+
+void resampler_free(Resampler* self) {
+	free(self->coeffs);
+	free(self->history[0]);
+	free(self->history[1]);
+	free(self);
+}
+
+// Only changes the step, the filter stays the one designed for the rates given to resampler_new
+void resampler_set_rates(Resampler* self, f64 in_rate, f64 out_rate) {
+	self->step = (u64) (in_rate / out_rate * 4294967296.0);
+}
+
+// Upper bound of the frames resampler_process can output for in_count input frames
+u32 resampler_max_output(const Resampler* self, u32 in_count) {
+	return (u32) (((u64) (self->count + in_count) << 32) / self->step) + 1;
+}
+
+// Converts interleaved stereo frames, out needs room for resampler_max_output(in_count) frames
+u32 resampler_process(Resampler* self, const f32* in, u32 in_count, f32* out, u32 out_capacity) {
+	u32 taps = self->taps;
+	u32 produced = 0;
+	while (true) {
+		u32 space = HISTORY + taps - self->count;
+		u32 count = in_count < space ? in_count : space;
+		f32* left = self->history[0] + self->count;
+		f32* right = self->history[1] + self->count;
+		for (u32 i = 0; i < count; ++i) {
+			left[i] = in[i * 2];
+			right[i] = in[i * 2 + 1];
+		}
+		in += count * 2;
+		in_count -= count;
+		self->count += count;
+
+		while (produced < out_capacity) {
+			u32 start = (u32) (self->pos >> 32);
+			if (start + taps > self->count) {
+				break;
+			}
+			u32 frac = (u32) self->pos;
+			u32 phase = frac >> (32 - PHASE_BITS);
+			f32 t = (f32) (frac & ((1U << (32 - PHASE_BITS)) - 1)) * (1.0f / (f32) (1U << (32 - PHASE_BITS)));
+
+			const f32* c0 = self->coeffs + phase * taps;
+			f32 sums[4];
+			self->dot(self->history[0] + start, self->history[1] + start, c0, c0 + taps, taps, sums);
+			out[produced * 2] = sums[0] + (sums[1] - sums[0]) * t;
+			out[produced * 2 + 1] = sums[2] + (sums[3] - sums[2]) * t;
+			produced += 1;
+			self->pos += self->step;
+		}
+
+		u32 consumed = (u32) (self->pos >> 32);
+		if (consumed > self->count) {
+			consumed = self->count;
+		}
+		memmove(self->history[0], self->history[0] + consumed, (self->count - consumed) * sizeof(f32));
+		memmove(self->history[1], self->history[1] + consumed, (self->count - consumed) * sizeof(f32));
+		self->count -= consumed;
+		self->pos -= (u64) consumed << 32;
+
+		if (!in_count || produced == out_capacity) {
+			break;
+		}
+	}
+	return produced;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "types.h"
+
+typedef enum {
+	// 16 taps, passband up to 80% of the output nyquist
+	RESAMPLER_FAST,
+	// 32 taps, 90%
+	RESAMPLER_MEDIUM,
+	// 64 taps, 95%
+	RESAMPLER_BEST,
+	RESAMPLER_QUALITY_MAX
+} ResamplerQuality;
+
+typedef struct Resampler Resampler;
+
+Resampler* resampler_new(ResamplerQuality quality, f64 in_rate, f64 out_rate);
+void resampler_free(Resampler* self);
+void resampler_set_rates(Resampler* self, f64 in_rate, f64 out_rate);
+u32 resampler_max_output(const Resampler* self, u32 in_count);
+u32 resampler_process(Resampler* self, const f32* in, u32 in_count, f32* out, u32 out_capacity);
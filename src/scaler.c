@@ -0,0 +1,526 @@
+#include "scaler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCALER_X86
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Post-processing of finished frames on a worker thread. The source is kept with a one pixel
+// border of repeated edge pixels so the kernels can read neighbours without bounds checks,
+// only source lines that (or whose neighbours) changed are scaled again.
+
+typedef void (*ScaleRowFn)(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride);
+
+struct Scaler {
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t cond;
+	mtx_t image_lock;
+	bool stop;
+	bool pending;
+
+	ScaleRowFn scale_row;
+	u32 factor;
+	u32 width;
+	u32 height;
+	u32 dirty_words;
+	void (*on_ready)(void* arg);
+	void* arg;
+
+	// Protected by lock
+	u32* submitted;
+	u64* submitted_dirty;
+
+	// Owned by the worker thread
+	u32* padded;
+	u64* dirty;
+
+	// Protected by image_lock
+	u32* image;
+	u64* image_dirty;
+	bool updated;
+};
+
+static bool line_dirty(const u64* dirty, u32 line) {
+	return dirty[line / 64] & 1ULL << (line % 64);
+}
+
+// 3/4 brightness, alpha is the low byte and stays as is
+static u32 darken(u32 pixel) {
+	u32 dark = (pixel >> 1 & 0x7F7F7F7F) + (pixel >> 2 & 0x3F3F3F3F);
+	return (dark & 0xFFFFFF00) | (pixel & 0xFF);
+}
+
+static void nearest_row_scalar(const u32* src, u32 width, u32 factor, u32* dst) {
+	for (u32 x = 0; x < width; ++x) {
+		for (u32 i = 0; i < factor; ++i) {
+			*dst++ = src[x];
+		}
+	}
+}
+
+#ifdef __SSE2__
+static void nearest_row_sse2(const u32* src, u32 width, u32 factor, u32* dst) {
+	u32 x = 0;
+	if (factor == 2) {
+		for (; x + 4 <= width; x += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+			_mm_storeu_si128((__m128i*) (dst + x * 2), _mm_unpacklo_epi32(v, v));
+			_mm_storeu_si128((__m128i*) (dst + x * 2 + 4), _mm_unpackhi_epi32(v, v));
+		}
+	}
+	else if (factor == 4) {
+		for (; x + 4 <= width; x += 4) {
+			__m128i v = _mm_loadu_si128((const __m128i*) (src + x));
+			_mm_storeu_si128((__m128i*) (dst + x * 4), _mm_shuffle_epi32(v, 0x00));
+			_mm_storeu_si128((__m128i*) (dst + x * 4 + 4), _mm_shuffle_epi32(v, 0x55));
+			_mm_storeu_si128((__m128i*) (dst + x * 4 + 8), _mm_shuffle_epi32(v, 0xAA));
+			_mm_storeu_si128((__m128i*) (dst + x * 4 + 12), _mm_shuffle_epi32(v, 0xFF));
+		}
+	}
+	nearest_row_scalar(src + x, width - x, factor, dst + x * factor);
+}
+#endif
+
+#ifdef SCALER_X86
+TARGET_AVX2 static void nearest_row_avx2(const u32* src, u32 width, u32 factor, u32* dst) {
+	u32 x = 0;
+	if (factor == 2 || factor == 4) {
+		const u32 per_store = 8 / factor;
+		for (; x + 8 <= width; x += 8) {
+			__m256i v = _mm256_loadu_si256((const __m256i*) (src + x));
+			for (u32 i = 0; i < factor; ++i) {
+				u32 first = i * per_store;
+				__m256i index = factor == 2 ?
+					_mm256_setr_epi32(first, first, first + 1, first + 1, first + 2, first + 2, first + 3, first + 3) :
+					_mm256_setr_epi32(first, first, first, first, first + 1, first + 1, first + 1, first + 1);
+				_mm256_storeu_si256((__m256i*) (dst + x * factor + i * 8), _mm256_permutevar8x32_epi32(v, index));
+			}
+		}
+	}
+	nearest_row_scalar(src + x, width - x, factor, dst + x * factor);
+}
+#endif
+
+static void (*nearest_row)(const u32* src, u32 width, u32 factor, u32* dst) = nearest_row_scalar;
+
+static void scale_nearest(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride) {
+	nearest_row(src, width, factor, dst);
+	for (u32 i = 1; i < factor; ++i) {
+		memcpy(dst + i * dst_stride, dst, width * factor * 4);
+	}
+}
+
+static void darken_row_scalar(u32* row, u32 count) {
+	for (u32 i = 0; i < count; ++i) {
+		row[i] = darken(row[i]);
+	}
+}
+
+#ifdef __SSE2__
+static void darken_row_sse2(u32* row, u32 count) {
+	const __m128i mask1 = _mm_set1_epi32(0x7F7F7F7F);
+	const __m128i mask2 = _mm_set1_epi32(0x3F3F3F3F);
+	const __m128i alpha = _mm_set1_epi32(0xFF);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (row + i));
+		__m128i dark = _mm_add_epi32(
+			_mm_and_si128(_mm_srli_epi32(v, 1), mask1),
+			_mm_and_si128(_mm_srli_epi32(v, 2), mask2));
+		dark = _mm_or_si128(_mm_andnot_si128(alpha, dark), _mm_and_si128(alpha, v));
+		_mm_storeu_si128((__m128i*) (row + i), dark);
+	}
+	darken_row_scalar(row + i, count - i);
+}
+#endif
+
+#ifdef SCALER_X86
+TARGET_AVX2 static void darken_row_avx2(u32* row, u32 count) {
+	const __m256i mask1 = _mm256_set1_epi32(0x7F7F7F7F);
+	const __m256i mask2 = _mm256_set1_epi32(0x3F3F3F3F);
+	const __m256i alpha = _mm256_set1_epi32(0xFF);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (row + i));
+		__m256i dark = _mm256_add_epi32(
+			_mm256_and_si256(_mm256_srli_epi32(v, 1), mask1),
+			_mm256_and_si256(_mm256_srli_epi32(v, 2), mask2));
+		dark = _mm256_or_si256(_mm256_andnot_si256(alpha, dark), _mm256_and_si256(alpha, v));
+		_mm256_storeu_si256((__m256i*) (row + i), dark);
+	}
+	darken_row_scalar(row + i, count - i);
+}
+#endif
+
+static void (*darken_row)(u32* row, u32 count) = darken_row_scalar;
+
+static void scale_lcd_grid(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride) {
+	nearest_row(src, width, factor, dst);
+	for (u32 x = factor - 1; x < width * factor; x += factor) {
+		dst[x] = darken(dst[x]);
+	}
+	for (u32 i = 1; i < factor; ++i) {
+		memcpy(dst + i * dst_stride, dst, width * factor * 4);
+	}
+	darken_row(dst + (factor - 1) * dst_stride, width * factor);
+}
+
+// Scale2x/AdvMAME2x, with B above, D left, F right and H below the source pixel E
+static void scale2x_scalar(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride) {
+	const u32* above = src - stride;
+	const u32* below = src + stride;
+	for (u32 x = 0; x < width; ++x) {
+		u32 b = above[x];
+		u32 d = (src - 1)[x];
+		u32 e = src[x];
+		u32 f = src[x + 1];
+		u32 h = below[x];
+
+		u32* out = dst + x * 2;
+		if (b != h && d != f) {
+			out[0] = d == b ? d : e;
+			out[1] = b == f ? f : e;
+			out[dst_stride] = d == h ? d : e;
+			out[dst_stride + 1] = h == f ? f : e;
+		}
+		else {
+			out[0] = e;
+			out[1] = e;
+			out[dst_stride] = e;
+			out[dst_stride + 1] = e;
+		}
+	}
+}
+
+#ifdef __SSE2__
+static __m128i select_sse2(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static void scale2x_sse2(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride) {
+	const u32* above = src - stride;
+	const u32* below = src + stride;
+	u32 x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i b = _mm_loadu_si128((const __m128i*) (above + x));
+		__m128i d = _mm_loadu_si128((const __m128i*) (src - 1 + x));
+		__m128i e = _mm_loadu_si128((const __m128i*) (src + x));
+		__m128i f = _mm_loadu_si128((const __m128i*) (src + x + 1));
+		__m128i h = _mm_loadu_si128((const __m128i*) (below + x));
+
+		__m128i active = _mm_andnot_si128(
+			_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)),
+			_mm_set1_epi32(-1));
+		__m128i e0 = select_sse2(_mm_and_si128(active, _mm_cmpeq_epi32(d, b)), d, e);
+		__m128i e1 = select_sse2(_mm_and_si128(active, _mm_cmpeq_epi32(b, f)), f, e);
+		__m128i e2 = select_sse2(_mm_and_si128(active, _mm_cmpeq_epi32(d, h)), d, e);
+		__m128i e3 = select_sse2(_mm_and_si128(active, _mm_cmpeq_epi32(h, f)), f, e);
+
+		u32* out = dst + x * 2;
+		_mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi32(e0, e1));
+		_mm_storeu_si128((__m128i*) (out + 4), _mm_unpackhi_epi32(e0, e1));
+		_mm_storeu_si128((__m128i*) (out + dst_stride), _mm_unpacklo_epi32(e2, e3));
+		_mm_storeu_si128((__m128i*) (out + dst_stride + 4), _mm_unpackhi_epi32(e2, e3));
+	}
+	scale2x_scalar(src + x, stride, width - x, factor, dst + x * 2, dst_stride);
+}
+#endif
+
+#ifdef SCALER_X86
+TARGET_AVX2 static __m256i select_avx2(__m256i mask, __m256i a, __m256i b) {
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+TARGET_AVX2 static void scale2x_avx2(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride) {
+	const u32* above = src - stride;
+	const u32* below = src + stride;
+	u32 x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256i b = _mm256_loadu_si256((const __m256i*) (above + x));
+		__m256i d = _mm256_loadu_si256((const __m256i*) (src - 1 + x));
+		__m256i e = _mm256_loadu_si256((const __m256i*) (src + x));
+		__m256i f = _mm256_loadu_si256((const __m256i*) (src + x + 1));
+		__m256i h = _mm256_loadu_si256((const __m256i*) (below + x));
+
+		__m256i active = _mm256_andnot_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi32(b, h), _mm256_cmpeq_epi32(d, f)),
+			_mm256_set1_epi32(-1));
+		__m256i e0 = select_avx2(_mm256_and_si256(active, _mm256_cmpeq_epi32(d, b)), d, e);
+		__m256i e1 = select_avx2(_mm256_and_si256(active, _mm256_cmpeq_epi32(b, f)), f, e);
+		__m256i e2 = select_avx2(_mm256_and_si256(active, _mm256_cmpeq_epi32(d, h)), d, e);
+		__m256i e3 = select_avx2(_mm256_and_si256(active, _mm256_cmpeq_epi32(h, f)), f, e);
+
+		// The unpacks work within 128-bit lanes, put the halves back in order
+		__m256i top_lo = _mm256_unpacklo_epi32(e0, e1);
+		__m256i top_hi = _mm256_unpackhi_epi32(e0, e1);
+		__m256i bottom_lo = _mm256_unpacklo_epi32(e2, e3);
+		__m256i bottom_hi = _mm256_unpackhi_epi32(e2, e3);
+
+		u32* out = dst + x * 2;
+		_mm256_storeu_si256((__m256i*) out, _mm256_permute2x128_si256(top_lo, top_hi, 0x20));
+		_mm256_storeu_si256((__m256i*) (out + 8), _mm256_permute2x128_si256(top_lo, top_hi, 0x31));
+		_mm256_storeu_si256((__m256i*) (out + dst_stride), _mm256_permute2x128_si256(bottom_lo, bottom_hi, 0x20));
+		_mm256_storeu_si256((__m256i*) (out + dst_stride + 8), _mm256_permute2x128_si256(bottom_lo, bottom_hi, 0x31));
+	}
+	scale2x_scalar(src + x, stride, width - x, factor, dst + x * 2, dst_stride);
+}
+#endif
+
+// Scale3x/AdvMAME3x, A B C / D E F / G H I around the source pixel E
+static void scale3x(const u32* src, u32 stride, u32 width, u32 factor, u32* dst, u32 dst_stride) {
+	const u32* above = src - stride;
+	const u32* below = src + stride;
+	for (u32 x = 0; x < width; ++x) {
+		u32 a = (above - 1)[x];
+		u32 b = above[x];
+		u32 c = above[x + 1];
+		u32 d = (src - 1)[x];
+		u32 e = src[x];
+		u32 f = src[x + 1];
+		u32 g = (below - 1)[x];
+		u32 h = below[x];
+		u32 i = below[x + 1];
+
+		u32* out0 = dst + x * 3;
+		u32* out1 = out0 + dst_stride;
+		u32* out2 = out1 + dst_stride;
+		if (b != h && d != f) {
+			out0[0] = d == b ? d : e;
+			out0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+			out0[2] = b == f ? f : e;
+			out1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+			out1[1] = e;
+			out1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+			out2[0] = d == h ? d : e;
+			out2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+			out2[2] = h == f ? f : e;
+		}
+		else {
+			for (u8 j = 0; j < 3; ++j) {
+				out0[j] = e;
+				out1[j] = e;
+				out2[j] = e;
+			}
+		}
+	}
+}
+
+static int scaler_main(void* arg) {
+	Scaler* self = (Scaler*) arg;
+	u32 stride = self->width + 2;
+	u32 dst_stride = self->width * self->factor;
+
+	while (true) {
+		mtx_lock(&self->lock);
+		while (!self->pending && !self->stop) {
+			cnd_wait(&self->cond, &self->lock);
+		}
+		if (self->stop) {
+			mtx_unlock(&self->lock);
+			break;
+		}
+		for (u32 y = 0; y < self->height; ++y) {
+			memcpy(self->padded + (y + 1) * stride + 1, self->submitted + y * self->width, self->width * 4);
+		}
+		memcpy(self->dirty, self->submitted_dirty, self->dirty_words * 8);
+		memset(self->submitted_dirty, 0, self->dirty_words * 8);
+		self->pending = false;
+		mtx_unlock(&self->lock);
+
+		// Repeat the edges into the border
+		for (u32 y = 1; y <= self->height; ++y) {
+			u32* row = self->padded + y * stride;
+			row[0] = row[1];
+			row[self->width + 1] = row[self->width];
+		}
+		memcpy(self->padded, self->padded + stride, stride * 4);
+		memcpy(self->padded + (self->height + 1) * stride, self->padded + self->height * stride, stride * 4);
+
+		mtx_lock(&self->image_lock);
+		bool any = false;
+		for (u32 y = 0; y < self->height; ++y) {
+			bool redo = line_dirty(self->dirty, y) ||
+				(y > 0 && line_dirty(self->dirty, y - 1)) ||
+				(y + 1 < self->height && line_dirty(self->dirty, y + 1));
+			if (!redo) {
+				continue;
+			}
+			self->scale_row(
+				self->padded + (y + 1) * stride + 1,
+				stride,
+				self->width,
+				self->factor,
+				self->image + y * self->factor * dst_stride,
+				dst_stride);
+			self->image_dirty[y / 64] |= 1ULL << (y % 64);
+			any = true;
+		}
+		if (any) {
+			self->updated = true;
+		}
+		mtx_unlock(&self->image_lock);
+
+		if (any && self->on_ready) {
+			self->on_ready(self->arg);
+		}
+	}
+
+	return 0;
+}
+
+static ScaleRowFn scale2x = scale2x_scalar;
+static once_flag kernels_once = ONCE_FLAG_INIT;
+
+// Picks the widest kernels the cpu supports, done once for all scalers
+static void select_kernels() {
+#ifdef __SSE2__
+	scale2x = scale2x_sse2;
+	nearest_row = nearest_row_sse2;
+	darken_row = darken_row_sse2;
+#endif
+#ifdef SCALER_X86
+	if (__builtin_cpu_supports("avx2")) {
+		scale2x = scale2x_avx2;
+		nearest_row = nearest_row_avx2;
+		darken_row = darken_row_avx2;
+	}
+#endif
+}
+
+static void scaler_free_buffers(Scaler* self) {
+	free(self->submitted);
+	free(self->submitted_dirty);
+	free(self->padded);
+	free(self->dirty);
+	free(self->image);
+	free(self->image_dirty);
+}
+
+// on_ready is called from the worker thread whenever a new image can be acquired
+Scaler* scaler_new(
+	ScalerKind kind,
+	u32 factor,
+	u32 width,
+	u32 height,
+	void (*on_ready)(void* arg),
+	void* arg) {
+	if (kind == SCALER_NONE || kind >= SCALER_MAX) {
+		return NULL;
+	}
+	if (kind == SCALER_SCALE2X) {
+		factor = 2;
+	}
+	else if (kind == SCALER_SCALE3X) {
+		factor = 3;
+	}
+	else if (factor < 2 || factor > SCALER_MAX_FACTOR) {
+		return NULL;
+	}
+
+	Scaler* self = calloc(1, sizeof(Scaler));
+	if (!self) {
+		return NULL;
+	}
+	self->factor = factor;
+	self->width = width;
+	self->height = height;
+	self->dirty_words = (height + 63) / 64;
+	self->on_ready = on_ready;
+	self->arg = arg;
+
+	call_once(&kernels_once, select_kernels);
+	if (kind == SCALER_NEAREST) {
+		self->scale_row = scale_nearest;
+	}
+	else if (kind == SCALER_SCALE2X) {
+		self->scale_row = scale2x;
+	}
+	else if (kind == SCALER_SCALE3X) {
+		self->scale_row = scale3x;
+	}
+	else if (kind == SCALER_LCD_GRID) {
+		self->scale_row = scale_lcd_grid;
+	}
+
+	self->submitted = malloc(width * height * 4);
+	self->submitted_dirty = calloc(self->dirty_words, 8);
+	self->padded = calloc((width + 2) * (height + 2), 4);
+	self->dirty = calloc(self->dirty_words, 8);
+	self->image = calloc(width * factor * height * factor, 4);
+	self->image_dirty = calloc(self->dirty_words, 8);
+	if (!self->submitted || !self->submitted_dirty || !self->padded ||
+		!self->dirty || !self->image || !self->image_dirty) {
+		scaler_free_buffers(self);
+		free(self);
+		return NULL;
+	}
+
+	mtx_init(&self->lock, mtx_plain);
+	mtx_init(&self->image_lock, mtx_plain);
+	cnd_init(&self->cond);
+	if (thrd_create(&self->thread, scaler_main, self) != thrd_success) {
+		mtx_destroy(&self->lock);
+		mtx_destroy(&self->image_lock);
+		cnd_destroy(&self->cond);
+		scaler_free_buffers(self);
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void scaler_free(Scaler* self) {
+	mtx_lock(&self->lock);
+	self->stop = true;
+	cnd_signal(&self->cond);
+	mtx_unlock(&self->lock);
+	thrd_join(self->thread, NULL);
+
+	mtx_destroy(&self->lock);
+	mtx_destroy(&self->image_lock);
+	cnd_destroy(&self->cond);
+	scaler_free_buffers(self);
+	free(self);
+}
+
+u32 scaler_factor(const Scaler* self) {
+	return self->factor;
+}
+
+// Copies the frame, dirty lines accumulate until the worker picks them up
+void scaler_submit(Scaler* self, const u32* pixels, const u64* dirty_lines) {
+	mtx_lock(&self->lock);
+	memcpy(self->submitted, pixels, self->width * self->height * 4);
+	for (u32 i = 0; i < self->dirty_words; ++i) {
+		self->submitted_dirty[i] |= dirty_lines[i];
+	}
+	self->pending = true;
+	cnd_signal(&self->cond);
+	mtx_unlock(&self->lock);
+}
+
+// Returns the image if it changed since it was last acquired, must be followed by scaler_release.
+// dirty_lines receives the source lines whose output rows changed.
+const u32* scaler_acquire(Scaler* self, u64* dirty_lines) {
+	if (mtx_trylock(&self->image_lock) != thrd_success) {
+		return NULL;
+	}
+	if (!self->updated) {
+		mtx_unlock(&self->image_lock);
+		return NULL;
+	}
+	self->updated = false;
+	memcpy(dirty_lines, self->image_dirty, self->dirty_words * 8);
+	memset(self->image_dirty, 0, self->dirty_words * 8);
+	return self->image;
+}
+
+void scaler_release(Scaler* self) {
+	mtx_unlock(&self->image_lock);
+}
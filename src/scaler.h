@@ -0,0 +1,30 @@
+#pragma once
+#include "types.h"
+
+typedef enum {
+	SCALER_NONE,
+	// Integer nearest-neighbour
+	SCALER_NEAREST,
+	SCALER_SCALE2X,
+	SCALER_SCALE3X,
+	// Nearest-neighbour with the last row/column of every pixel darkened
+	SCALER_LCD_GRID,
+	SCALER_MAX
+} ScalerKind;
+
+#define SCALER_MAX_FACTOR 8
+
+typedef struct Scaler Scaler;
+
+Scaler* scaler_new(
+	ScalerKind kind,
+	u32 factor,
+	u32 width,
+	u32 height,
+	void (*on_ready)(void* arg),
+	void* arg);
+void scaler_free(Scaler* self);
+u32 scaler_factor(const Scaler* self);
+void scaler_submit(Scaler* self, const u32* pixels, const u64* dirty_lines);
+const u32* scaler_acquire(Scaler* self, u64* dirty_lines);
+void scaler_release(Scaler* self);
@@ -16,7 +16,7 @@ u8 timer_read(Timer* self, u16 addr) {
 	}
 }
 
-static u8 DIV_BIT_POS[] = {
+static const u8 DIV_BIT_POS[] = {
 	[0b00] = 9,
 	[0b01] = 3,
 	[0b10] = 5,
@@ -55,6 +55,7 @@ void timer_cycle(Timer* self) {
 
 void timer_write(Timer* self, u16 addr, u8 value) {
 	if (addr == 0xFF04) {
+		apu_div_reset(&self->bus->apu, self->div);
 		self->div = 0;
 	}
 	else if (addr == 0xFF05) {
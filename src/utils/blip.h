@@ -0,0 +1,28 @@
+#pragma once
+#include "types.h"
+
+// Band-limited step synthesis: amplitude changes are added at exact clock timestamps and
+// come out as samples at the output rate without the aliasing of point sampling.
+
+#define BLIP_PHASE_BITS 6
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_WIDTH 16
+// Samples are shifted left by this many bits
+#define BLIP_SAMPLE_BITS 15
+// Room for two frames at APU_NATIVE_RATE on top of the unread ones
+#define BLIP_BUFFER_SIZE 16384
+
+typedef struct {
+	// Output samples per clock and the position of the current frame start, 32.32 fixed point
+	u64 factor;
+	u64 offset;
+	i32 integrator;
+	i32 samples[BLIP_BUFFER_SIZE + BLIP_WIDTH];
+} Blip;
+
+void blip_init(Blip* self, u64 clock_rate, u32 sample_rate);
+void blip_clear(Blip* self);
+void blip_add_delta(Blip* self, u32 time, i32 delta);
+void blip_end_frame(Blip* self, u32 time);
+u32 blip_samples_avail(const Blip* self);
+u32 blip_read_samples(Blip* self, i32* out, u32 count, u32 stride);
@@ -0,0 +1,377 @@
+#include "inflate.h"
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#define INPUT_SIZE 0x10000
+// Codes up to this long decode with one table lookup, longer ones with a search by length
+#define FAST_BITS 9
+#define MAX_BITS 15
+#define NUM_LIT_SYMBOLS 288
+#define NUM_DIST_SYMBOLS 32
+
+// Canonical huffman code. fast holds length << 9 | symbol for short codes, 0 otherwise.
+typedef struct {
+	u16 fast[1 << FAST_BITS];
+	u16 first_code[MAX_BITS + 1];
+	u16 first_symbol[MAX_BITS + 1];
+	// Shifted to 16 bits for the search
+	u32 max_code[MAX_BITS + 2];
+	u8 size[NUM_LIT_SYMBOLS];
+	u16 value[NUM_LIT_SYMBOLS];
+} Huffman;
+
+typedef struct {
+	FILE* file;
+	// Compressed bytes not read from the file yet
+	u64 in_left;
+	u8 in[INPUT_SIZE];
+	u32 in_pos;
+	u32 in_len;
+	// Zero bytes fed after the end of the input, consuming any of them means it was truncated
+	u32 overrun;
+	u64 bits;
+	u32 bit_count;
+
+	u8* out;
+	usize out_pos;
+	usize out_size;
+	usize reported;
+	InflateProgress progress;
+	void* progress_arg;
+
+	Huffman lit;
+	Huffman dist;
+} Inflater;
+
+static const u16 LENGTH_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const u8 LENGTH_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const u16 DIST_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const u8 DIST_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order the code length code lengths are stored in
+static const u8 CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static u32 reverse_bits(u32 value, u32 count) {
+	u32 result = 0;
+	for (u32 i = 0; i < count; ++i) {
+		result = result << 1 | (value & 1);
+		value >>= 1;
+	}
+	return result;
+}
+
+static bool huffman_build(Huffman* self, const u8* lengths, u32 count) {
+	u32 sizes[MAX_BITS + 1] = {};
+	u32 next_code[MAX_BITS + 1];
+	memset(self->fast, 0, sizeof(self->fast));
+	for (u32 i = 0; i < count; ++i) {
+		sizes[lengths[i]] += 1;
+	}
+	sizes[0] = 0;
+
+	u32 code = 0;
+	u32 symbol = 0;
+	for (u32 i = 1; i <= MAX_BITS; ++i) {
+		next_code[i] = code;
+		self->first_code[i] = (u16) code;
+		self->first_symbol[i] = (u16) symbol;
+		code += sizes[i];
+		// Oversubscribed, incomplete codes are allowed for the single distance code case
+		if (sizes[i] && code - 1 >= 1u << i) {
+			return false;
+		}
+		self->max_code[i] = code << (16 - i);
+		code <<= 1;
+		symbol += sizes[i];
+	}
+	self->max_code[MAX_BITS + 1] = 0x10000;
+
+	for (u32 i = 0; i < count; ++i) {
+		u32 size = lengths[i];
+		if (!size) {
+			continue;
+		}
+		u32 index = next_code[size] - self->first_code[size] + self->first_symbol[size];
+		self->size[index] = (u8) size;
+		self->value[index] = (u16) i;
+		if (size <= FAST_BITS) {
+			for (u32 j = reverse_bits(next_code[size], size); j < 1 << FAST_BITS; j += 1 << size) {
+				self->fast[j] = (u16) (size << 9 | i);
+			}
+		}
+		next_code[size] += 1;
+	}
+	return true;
+}
+
+// Tops the bit buffer up to at least 32 bits
+static void inflater_refill(Inflater* self) {
+	while (self->bit_count <= 56) {
+		if (self->in_pos == self->in_len) {
+			usize want = self->in_left < INPUT_SIZE ? (usize) self->in_left : INPUT_SIZE;
+			self->in_len = want ? (u32) fread(self->in, 1, want, self->file) : 0;
+			self->in_left -= self->in_len;
+			self->in_pos = 0;
+			if (!self->in_len) {
+				if (self->bit_count >= 32) {
+					return;
+				}
+				self->overrun += 1;
+				self->bit_count += 8;
+				continue;
+			}
+		}
+		self->bits |= (u64) self->in[self->in_pos++] << self->bit_count;
+		self->bit_count += 8;
+	}
+}
+
+static u32 inflater_bits(Inflater* self, u32 count) {
+	if (self->bit_count < count) {
+		inflater_refill(self);
+	}
+	u32 value = (u32) (self->bits & ((1ull << count) - 1));
+	self->bits >>= count;
+	self->bit_count -= count;
+	return value;
+}
+
+// Returns a symbol or -1 for an invalid code
+static i32 inflater_decode(Inflater* self, const Huffman* huffman) {
+	if (self->bit_count < 16) {
+		inflater_refill(self);
+	}
+	u16 fast = huffman->fast[self->bits & ((1 << FAST_BITS) - 1)];
+	if (fast) {
+		u32 size = fast >> 9;
+		self->bits >>= size;
+		self->bit_count -= size;
+		return fast & 0x1FF;
+	}
+
+	u32 code = reverse_bits((u32) self->bits & 0xFFFF, 16);
+	u32 size = FAST_BITS + 1;
+	while (code >= huffman->max_code[size]) {
+		size += 1;
+	}
+	if (size > MAX_BITS) {
+		return -1;
+	}
+	u32 index = (code >> (16 - size)) - huffman->first_code[size] + huffman->first_symbol[size];
+	if (index >= NUM_LIT_SYMBOLS || huffman->size[index] != size) {
+		return -1;
+	}
+	self->bits >>= size;
+	self->bit_count -= size;
+	return huffman->value[index];
+}
+
+static bool inflater_report(Inflater* self) {
+	self->reported = self->out_pos;
+	return !self->progress || self->progress(self->progress_arg, self->out_pos);
+}
+
+static bool inflater_stored(Inflater* self) {
+	inflater_bits(self, self->bit_count % 8);
+	u32 len = inflater_bits(self, 16);
+	u32 nlen = inflater_bits(self, 16);
+	if ((len ^ 0xFFFF) != nlen || len > self->out_size - self->out_pos) {
+		return false;
+	}
+	for (u32 i = 0; i < len; ++i) {
+		self->out[self->out_pos++] = (u8) inflater_bits(self, 8);
+	}
+	return true;
+}
+
+static bool inflater_dynamic_tables(Inflater* self) {
+	u32 lit_count = inflater_bits(self, 5) + 257;
+	u32 dist_count = inflater_bits(self, 5) + 1;
+	u32 code_length_count = inflater_bits(self, 4) + 4;
+
+	u8 code_length_lengths[19] = {};
+	for (u32 i = 0; i < code_length_count; ++i) {
+		code_length_lengths[CODE_LENGTH_ORDER[i]] = (u8) inflater_bits(self, 3);
+	}
+	Huffman code_lengths;
+	if (!huffman_build(&code_lengths, code_length_lengths, 19)) {
+		return false;
+	}
+
+	// The literal and distance lengths are one sequence, repeats can cross between them
+	u8 lengths[NUM_LIT_SYMBOLS + NUM_DIST_SYMBOLS];
+	u32 count = 0;
+	while (count < lit_count + dist_count) {
+		i32 symbol = inflater_decode(self, &code_lengths);
+		if (symbol < 0) {
+			return false;
+		}
+		if (symbol < 16) {
+			lengths[count++] = (u8) symbol;
+			continue;
+		}
+
+		u8 value = 0;
+		u32 repeat;
+		if (symbol == 16) {
+			if (!count) {
+				return false;
+			}
+			value = lengths[count - 1];
+			repeat = inflater_bits(self, 2) + 3;
+		}
+		else if (symbol == 17) {
+			repeat = inflater_bits(self, 3) + 3;
+		}
+		else {
+			repeat = inflater_bits(self, 7) + 11;
+		}
+		if (count + repeat > lit_count + dist_count) {
+			return false;
+		}
+		memset(lengths + count, value, repeat);
+		count += repeat;
+	}
+
+	return lengths[256] && huffman_build(&self->lit, lengths, lit_count) &&
+		huffman_build(&self->dist, lengths + lit_count, dist_count);
+}
+
+static void inflater_fixed_tables(Inflater* self) {
+	u8 lengths[NUM_LIT_SYMBOLS];
+	memset(lengths, 8, 144);
+	memset(lengths + 144, 9, 112);
+	memset(lengths + 256, 7, 24);
+	memset(lengths + 280, 8, 8);
+	huffman_build(&self->lit, lengths, NUM_LIT_SYMBOLS);
+	memset(lengths, 5, NUM_DIST_SYMBOLS);
+	huffman_build(&self->dist, lengths, NUM_DIST_SYMBOLS);
+}
+
+static bool inflater_codes(Inflater* self) {
+	u8* out = self->out;
+	while (true) {
+		if (self->out_pos - self->reported >= INFLATE_PROGRESS_STEP && !inflater_report(self)) {
+			return false;
+		}
+
+		i32 symbol = inflater_decode(self, &self->lit);
+		if (symbol < 0) {
+			return false;
+		}
+		if (symbol < 256) {
+			if (self->out_pos == self->out_size) {
+				return false;
+			}
+			out[self->out_pos++] = (u8) symbol;
+			continue;
+		}
+		if (symbol == 256) {
+			return true;
+		}
+
+		symbol -= 257;
+		if (symbol >= 29) {
+			return false;
+		}
+		usize len = LENGTH_BASE[symbol] + inflater_bits(self, LENGTH_EXTRA[symbol]);
+		i32 dist_symbol = inflater_decode(self, &self->dist);
+		if (dist_symbol < 0 || dist_symbol >= 30) {
+			return false;
+		}
+		usize dist = DIST_BASE[dist_symbol] + inflater_bits(self, DIST_EXTRA[dist_symbol]);
+		if (dist > self->out_pos || len > self->out_size - self->out_pos) {
+			return false;
+		}
+
+		// Byte by byte, the source may overlap what is being written
+		const u8* src = out + self->out_pos - dist;
+		u8* dest = out + self->out_pos;
+		for (usize i = 0; i < len; ++i) {
+			dest[i] = src[i];
+		}
+		self->out_pos += len;
+	}
+}
+
+// Decodes the deflate stream in the next in_size bytes of file into out. produced gets the
+// decoded length, which can't exceed out_size.
+bool inflate_file(FILE* file, u64 in_size, u8* out, usize out_size, usize* produced, InflateProgress progress, void* arg) {
+	Inflater* self = calloc(1, sizeof(Inflater));
+	if (!self) {
+		return false;
+	}
+	self->file = file;
+	self->in_left = in_size;
+	self->out = out;
+	self->out_size = out_size;
+	self->progress = progress;
+	self->progress_arg = arg;
+
+	bool ok = true;
+	bool final = false;
+	while (ok && !final) {
+		final = inflater_bits(self, 1);
+		u32 type = inflater_bits(self, 2);
+		if (type == 0) {
+			ok = inflater_stored(self);
+		}
+		else if (type == 1) {
+			inflater_fixed_tables(self);
+			ok = inflater_codes(self);
+		}
+		else if (type == 2) {
+			ok = inflater_dynamic_tables(self) && inflater_codes(self);
+		}
+		else {
+			ok = false;
+		}
+		if (ok && self->out_pos - self->reported >= INFLATE_PROGRESS_STEP) {
+			ok = inflater_report(self);
+		}
+	}
+	// Padding bytes past the end of the input were consumed
+	if (self->overrun * 8 > self->bit_count) {
+		ok = false;
+	}
+	if (ok) {
+		ok = inflater_report(self);
+	}
+
+	*produced = self->out_pos;
+	free(self);
+	return ok;
+}
+
+static u32 crc_table[256];
+static once_flag crc_once = ONCE_FLAG_INIT;
+
+static void crc_init(void) {
+	for (u32 i = 0; i < 256; ++i) {
+		u32 crc = i;
+		for (u32 j = 0; j < 8; ++j) {
+			crc = crc & 1 ? 0xEDB88320 ^ crc >> 1 : crc >> 1;
+		}
+		crc_table[i] = crc;
+	}
+}
+
+// The zip/gzip crc, start with 0
+u32 inflate_crc32(u32 crc, const u8* data, usize size) {
+	call_once(&crc_once, crc_init);
+	crc = ~crc;
+	for (usize i = 0; i < size; ++i) {
+		crc = crc_table[(crc ^ data[i]) & 0xFF] ^ crc >> 8;
+	}
+	return ~crc;
+}
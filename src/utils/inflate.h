@@ -0,0 +1,15 @@
+#pragma once
+#include "types.h"
+#include <stdio.h>
+
+// Raw DEFLATE (RFC 1951) decoding from a file straight into the final buffer, which doubles
+// as the window so nothing is copied twice
+
+// Gets the length of out that is final, every INFLATE_PROGRESS_STEP bytes and once at the end.
+// Returning false aborts decoding.
+typedef bool (*InflateProgress)(void* arg, usize produced);
+
+#define INFLATE_PROGRESS_STEP 0x10000
+
+bool inflate_file(FILE* file, u64 in_size, u8* out, usize out_size, usize* produced, InflateProgress progress, void* arg);
+u32 inflate_crc32(u32 crc, const u8* data, usize size);
@@ -0,0 +1,66 @@
+#include "ring_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+bool ring_buffer_init(RingBuffer* self, u32 min_capacity) {
+	u32 capacity = 1;
+	while (capacity < min_capacity) {
+		capacity <<= 1;
+	}
+
+	self->data = malloc(capacity * sizeof(f32));
+	if (!self->data) {
+		return false;
+	}
+	self->capacity = capacity;
+	atomic_init(&self->read, 0);
+	atomic_init(&self->write, 0);
+	return true;
+}
+
+void ring_buffer_free(RingBuffer* self) {
+	free(self->data);
+	self->data = NULL;
+}
+
+// Safe to call from either side, the other one may change it right after
+u32 ring_buffer_size(RingBuffer* self) {
+	u32 write = atomic_load_explicit(&self->write, memory_order_acquire);
+	u32 read = atomic_load_explicit(&self->read, memory_order_acquire);
+	return write - read;
+}
+
+// Producer side, returns how many fit
+u32 ring_buffer_write(RingBuffer* self, const f32* data, u32 count) {
+	u32 write = atomic_load_explicit(&self->write, memory_order_relaxed);
+	u32 read = atomic_load_explicit(&self->read, memory_order_acquire);
+	u32 free_space = self->capacity - (write - read);
+	if (count > free_space) {
+		count = free_space;
+	}
+
+	u32 start = write & (self->capacity - 1);
+	u32 first = self->capacity - start < count ? self->capacity - start : count;
+	memcpy(self->data + start, data, first * sizeof(f32));
+	memcpy(self->data, data + first, (count - first) * sizeof(f32));
+
+	atomic_store_explicit(&self->write, write + count, memory_order_release);
+	return count;
+}
+
+// Consumer side, returns how many were available
+u32 ring_buffer_read(RingBuffer* self, f32* data, u32 count) {
+	u32 read = atomic_load_explicit(&self->read, memory_order_relaxed);
+	u32 write = atomic_load_explicit(&self->write, memory_order_acquire);
+	if (count > write - read) {
+		count = write - read;
+	}
+
+	u32 start = read & (self->capacity - 1);
+	u32 first = self->capacity - start < count ? self->capacity - start : count;
+	memcpy(data, self->data + start, first * sizeof(f32));
+	memcpy(data + first, self->data, (count - first) * sizeof(f32));
+
+	atomic_store_explicit(&self->read, read + count, memory_order_release);
+	return count;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "types.h"
+#include <stdatomic.h>
+
+// Lock-free ring of samples for exactly one producer and one consumer thread
+typedef struct {
+	f32* data;
+	// Power of two
+	u32 capacity;
+	// Only ever increase, wrapping around at 2^32
+	atomic_uint read;
+	atomic_uint write;
+} RingBuffer;
+
+bool ring_buffer_init(RingBuffer* self, u32 min_capacity);
+void ring_buffer_free(RingBuffer* self);
+u32 ring_buffer_size(RingBuffer* self);
+u32 ring_buffer_write(RingBuffer* self, const f32* data, u32 count);
+u32 ring_buffer_read(RingBuffer* self, f32* data, u32 count);
@@ -0,0 +1,526 @@
+#define _POSIX_C_SOURCE 200809L
+#include "rom_image.h"
+#include "inflate.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#if defined(__unix__) || defined(__unix) || defined(__linux__) || defined(__linux) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Buffers get the alignment mappings have, which keeps every 16KiB bank page aligned
+#define PAGE_SIZE 4096
+// The biggest cartridge there is, 512 banks
+#define MAX_ROM_SIZE (8 * 1024 * 1024)
+
+// Where the rom is inside a gzip or zip file
+typedef struct {
+	u64 offset;
+	u64 in_size;
+	usize out_size;
+	u32 crc;
+	bool deflated;
+} Member;
+
+struct RomImage {
+	const u8* data;
+	usize size;
+	// Unmapped instead of freed on the last release
+	bool mapped;
+	// Guarded by cache_lock
+	u32 refs;
+
+	// Set for compressed roms, which a thread decompresses into data after open returns
+	bool streamed;
+	thrd_t loader;
+	FILE* file;
+	Member member;
+	u32 crc;
+	mtx_t lock;
+	cnd_t cond;
+	// Bytes of data that are final, guarded by lock like done and failed
+	usize available;
+	bool done;
+	bool failed;
+	atomic_bool cancel;
+
+	// Cache key, only images opened from regular files are in the cache
+	char* path;
+	u64 dev;
+	u64 ino;
+	u64 file_size;
+	i64 mtime;
+	RomImage* next;
+};
+
+static RomImage* cache;
+static mtx_t cache_lock;
+static once_flag cache_once = ONCE_FLAG_INIT;
+
+static void cache_init(void) {
+	mtx_init(&cache_lock, mtx_plain);
+}
+
+// Reads a whole stream for sources that can't be mapped, like pipes
+static RomImage* rom_image_read(const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+
+	usize capacity = 0x8000;
+	usize size = 0;
+	u8* data = aligned_alloc(PAGE_SIZE, capacity);
+	while (data) {
+		size += fread(data + size, 1, capacity - size, file);
+		if (size < capacity) {
+			break;
+		}
+		u8* new_data = aligned_alloc(PAGE_SIZE, capacity * 2);
+		if (new_data) {
+			memcpy(new_data, data, size);
+		}
+		free(data);
+		data = new_data;
+		capacity *= 2;
+	}
+	bool failed = !data || ferror(file);
+	fclose(file);
+	if (failed || !size) {
+		free(data);
+		return NULL;
+	}
+
+	RomImage* self = rom_image_from_buffer(data, size);
+	if (!self) {
+		free(data);
+	}
+	return self;
+}
+
+#ifdef HAVE_MMAP
+static RomImage* rom_image_map(const char* path, const struct stat* s) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	void* data = mmap(NULL, (usize) s->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return NULL;
+	}
+
+	RomImage* self = calloc(1, sizeof(RomImage));
+	if (!self) {
+		munmap(data, (usize) s->st_size);
+		return NULL;
+	}
+	self->data = data;
+	self->size = (usize) s->st_size;
+	self->mapped = true;
+	self->refs = 1;
+	return self;
+}
+
+static bool rom_image_set_key(RomImage* self, const char* path, const struct stat* s) {
+	self->path = malloc(strlen(path) + 1);
+	if (!self->path) {
+		return false;
+	}
+	strcpy(self->path, path);
+	self->dev = (u64) s->st_dev;
+	self->ino = (u64) s->st_ino;
+	self->file_size = (u64) s->st_size;
+	self->mtime = (i64) s->st_mtime;
+	return true;
+}
+#endif
+
+static u16 get_u16(const u8* data) {
+	return data[0] | data[1] << 8;
+}
+
+static u32 get_u32(const u8* data) {
+	return data[0] | data[1] << 8 | data[2] << 16 | (u32) data[3] << 24;
+}
+
+static bool skip_string(FILE* file) {
+	int c;
+	while ((c = fgetc(file)) > 0) {}
+	return c == 0;
+}
+
+// The deflate stream follows the header, the crc and size mod 2^32 are at the very end
+static bool parse_gzip(FILE* file, u64 file_size, Member* member) {
+	u8 header[10];
+	if (fseek(file, 0, SEEK_SET) != 0 || fread(header, sizeof(header), 1, file) != 1 || header[2] != 8) {
+		return false;
+	}
+	u8 flags = header[3];
+	// FEXTRA
+	if (flags & 1 << 2) {
+		u8 extra[2];
+		if (fread(extra, 2, 1, file) != 1 || fseek(file, get_u16(extra), SEEK_CUR) != 0) {
+			return false;
+		}
+	}
+	// FNAME, FCOMMENT
+	if ((flags & 1 << 3 && !skip_string(file)) || (flags & 1 << 4 && !skip_string(file))) {
+		return false;
+	}
+	// FHCRC
+	if (flags & 1 << 1 && fseek(file, 2, SEEK_CUR) != 0) {
+		return false;
+	}
+
+	long offset = ftell(file);
+	u8 trailer[8];
+	if (offset < 0 || (u64) offset + 8 > file_size || fseek(file, -8, SEEK_END) != 0 || fread(trailer, 8, 1, file) != 1) {
+		return false;
+	}
+	member->offset = (u64) offset;
+	member->in_size = file_size - (u64) offset - 8;
+	member->crc = get_u32(trailer);
+	member->out_size = get_u32(trailer + 4);
+	member->deflated = true;
+	return true;
+}
+
+static bool is_rom_name(const u8* name, u32 len) {
+	return (len > 3 && memcmp(name + len - 3, ".gb", 3) == 0) ||
+		(len > 4 && memcmp(name + len - 4, ".gbc", 4) == 0) ||
+		(len > 3 && memcmp(name + len - 3, ".GB", 3) == 0) ||
+		(len > 4 && memcmp(name + len - 4, ".GBC", 4) == 0);
+}
+
+// Sizes come from the central directory, local headers may leave them to a trailing descriptor.
+// The first .gb/.gbc entry is used, or the first file if there is none.
+static bool parse_zip(FILE* file, u64 file_size, Member* member) {
+	// End of central directory record, followed by a comment of up to 64KiB
+	u8 tail[22 + 0xFFFF];
+	u64 tail_size = file_size < sizeof(tail) ? file_size : sizeof(tail);
+	if (tail_size < 22 || fseek(file, (long) (file_size - tail_size), SEEK_SET) != 0 || fread(tail, tail_size, 1, file) != 1) {
+		return false;
+	}
+	const u8* eocd = NULL;
+	for (u64 i = tail_size - 22 + 1; i-- > 0;) {
+		if (memcmp(tail + i, "PK\5\6", 4) == 0) {
+			eocd = tail + i;
+			break;
+		}
+	}
+	if (!eocd) {
+		return false;
+	}
+
+	u16 entries = get_u16(eocd + 10);
+	if (fseek(file, get_u32(eocd + 16), SEEK_SET) != 0) {
+		return false;
+	}
+	bool found = false;
+	for (u16 i = 0; i < entries; ++i) {
+		u8 entry[46];
+		u8 name[256];
+		if (fread(entry, sizeof(entry), 1, file) != 1 || memcmp(entry, "PK\1\2", 4) != 0) {
+			return false;
+		}
+		u16 name_len = get_u16(entry + 28);
+		u32 skip = get_u16(entry + 30) + get_u16(entry + 32);
+		u16 read_len = name_len < sizeof(name) ? name_len : sizeof(name);
+		if (fread(name, 1, read_len, file) != read_len || fseek(file, (long) (name_len - read_len + skip), SEEK_CUR) != 0) {
+			return false;
+		}
+		// Directories
+		if (name_len && name[read_len - 1] == '/') {
+			continue;
+		}
+
+		bool rom = is_rom_name(name, read_len);
+		if (found && !rom) {
+			continue;
+		}
+		// Encrypted
+		if (get_u16(entry + 8) & 1) {
+			fprintf(stderr, "warning: encrypted zip entries aren't supported\n");
+			return false;
+		}
+		u16 method = get_u16(entry + 10);
+		if (method != 0 && method != 8) {
+			fprintf(stderr, "warning: zip compression method %u isn't supported\n", method);
+			return false;
+		}
+		member->deflated = method == 8;
+		member->crc = get_u32(entry + 16);
+		member->in_size = get_u32(entry + 20);
+		member->out_size = get_u32(entry + 24);
+		member->offset = get_u32(entry + 42);
+		found = true;
+		if (rom) {
+			break;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+
+	u8 local[30];
+	if (fseek(file, (long) member->offset, SEEK_SET) != 0 || fread(local, sizeof(local), 1, file) != 1 || memcmp(local, "PK\3\4", 4) != 0) {
+		return false;
+	}
+	member->offset += sizeof(local) + get_u16(local + 26) + get_u16(local + 28);
+	return member->offset + member->in_size <= file_size;
+}
+
+static bool rom_image_progress(void* arg, usize produced) {
+	RomImage* self = (RomImage*) arg;
+	self->crc = inflate_crc32(self->crc, self->data + self->available, produced - self->available);
+
+	mtx_lock(&self->lock);
+	self->available = produced;
+	cnd_broadcast(&self->cond);
+	mtx_unlock(&self->lock);
+	return !atomic_load_explicit(&self->cancel, memory_order_relaxed);
+}
+
+static int rom_image_load_main(void* arg) {
+	RomImage* self = (RomImage*) arg;
+	u8* data = (u8*) self->data;
+	const Member* member = &self->member;
+
+	bool ok = fseek(self->file, (long) member->offset, SEEK_SET) == 0;
+	usize produced = 0;
+	if (ok && member->deflated) {
+		ok = inflate_file(self->file, member->in_size, data, self->size, &produced, rom_image_progress, self);
+	}
+	else if (ok) {
+		// Stored, read in steps so waiters can start early all the same
+		while (ok && produced < self->size) {
+			usize chunk = self->size - produced < INFLATE_PROGRESS_STEP ? self->size - produced : INFLATE_PROGRESS_STEP;
+			ok = fread(data + produced, chunk, 1, self->file) == 1;
+			produced += chunk;
+			ok = ok && rom_image_progress(self, produced);
+		}
+	}
+	fclose(self->file);
+	self->file = NULL;
+
+	ok = ok && produced == self->size && self->crc == member->crc;
+	if (!ok && !atomic_load_explicit(&self->cancel, memory_order_relaxed)) {
+		fprintf(stderr, "warning: failed to decompress the rom, the archive is damaged\n");
+	}
+
+	mtx_lock(&self->lock);
+	self->done = true;
+	self->failed = !ok;
+	cnd_broadcast(&self->cond);
+	mtx_unlock(&self->lock);
+	return 0;
+}
+
+// Starts decompressing a gzip or zip file, returns NULL for anything else. Takes ownership of file.
+static RomImage* rom_image_decompress(FILE* file) {
+	u8 magic[4];
+	if (fread(magic, sizeof(magic), 1, file) != 1 || fseek(file, 0, SEEK_END) != 0) {
+		fclose(file);
+		return NULL;
+	}
+	long file_size = ftell(file);
+
+	Member member;
+	bool parsed;
+	if (magic[0] == 0x1F && magic[1] == 0x8B) {
+		parsed = file_size > 0 && parse_gzip(file, (u64) file_size, &member);
+	}
+	else if (memcmp(magic, "PK\3\4", 4) == 0) {
+		parsed = file_size > 0 && parse_zip(file, (u64) file_size, &member);
+	}
+	else {
+		fclose(file);
+		return NULL;
+	}
+	if (!parsed || !member.out_size) {
+		fprintf(stderr, "warning: no rom found in the archive\n");
+		fclose(file);
+		return NULL;
+	}
+	// The size comes from the archive, don't trust it with the allocation
+	if (member.out_size > MAX_ROM_SIZE) {
+		fprintf(stderr, "warning: the rom in the archive is %zu bytes, more than any cartridge\n", member.out_size);
+		fclose(file);
+		return NULL;
+	}
+
+	// Rounded up for aligned_alloc, the padding isn't part of the image
+	usize capacity = (member.out_size + PAGE_SIZE - 1) & ~(usize) (PAGE_SIZE - 1);
+	u8* data = aligned_alloc(PAGE_SIZE, capacity);
+	RomImage* self = data ? rom_image_from_buffer(data, member.out_size) : NULL;
+	if (!self) {
+		free(data);
+		fclose(file);
+		return NULL;
+	}
+	self->streamed = true;
+	self->file = file;
+	self->member = member;
+	atomic_init(&self->cancel, false);
+	mtx_init(&self->lock, mtx_plain);
+	cnd_init(&self->cond);
+	if (thrd_create(&self->loader, rom_image_load_main, self) != thrd_success) {
+		mtx_destroy(&self->lock);
+		cnd_destroy(&self->cond);
+		fclose(file);
+		free(data);
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+// Compressed files are decompressed, other files are mapped or read
+static RomImage* rom_image_load(const char* path, bool mappable) {
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+	u8 magic[4];
+	bool compressed = fread(magic, sizeof(magic), 1, file) == 1 &&
+		((magic[0] == 0x1F && magic[1] == 0x8B) || memcmp(magic, "PK\3\4", 4) == 0);
+	// Archives have to be seekable for their directory and sizes
+	if (compressed && fseek(file, 0, SEEK_SET) == 0) {
+		return rom_image_decompress(file);
+	}
+	fclose(file);
+
+#ifdef HAVE_MMAP
+	if (mappable) {
+		struct stat s;
+		RomImage* self = stat(path, &s) == 0 ? rom_image_map(path, &s) : NULL;
+		if (self) {
+			return self;
+		}
+	}
+#else
+	(void) mappable;
+#endif
+	return rom_image_read(path);
+}
+
+
+// Returns the cached image when the same file is already open, otherwise maps, reads or
+// starts decompressing it. Compressed images have to be waited for with rom_image_wait.
+RomImage* rom_image_open(const char* path) {
+	call_once(&cache_once, cache_init);
+
+#ifdef HAVE_MMAP
+	struct stat s;
+	if (stat(path, &s) == 0 && S_ISREG(s.st_mode) && s.st_size > 0) {
+		mtx_lock(&cache_lock);
+		RomImage* self = cache;
+		// A rewritten file gets a new entry, carts using the old contents keep theirs
+		while (self && (self->dev != (u64) s.st_dev || self->ino != (u64) s.st_ino ||
+			self->file_size != (u64) s.st_size || self->mtime != (i64) s.st_mtime || strcmp(self->path, path) != 0)) {
+			self = self->next;
+		}
+		if (self) {
+			self->refs += 1;
+		}
+		else if ((self = rom_image_load(path, true))) {
+			if (rom_image_set_key(self, path, &s)) {
+				self->next = cache;
+				cache = self;
+			}
+		}
+		mtx_unlock(&cache_lock);
+		return self;
+	}
+#endif
+
+	return rom_image_load(path, false);
+}
+
+// Blocks until the first size bytes are decompressed, returns false if they never will be
+bool rom_image_wait(RomImage* self, usize size) {
+	if (!self->streamed) {
+		return size <= self->size;
+	}
+	mtx_lock(&self->lock);
+	while (!self->done && self->available < size) {
+		cnd_wait(&self->cond, &self->lock);
+	}
+	bool ok = !self->failed && self->available >= size;
+	mtx_unlock(&self->lock);
+	return ok;
+}
+
+// Takes ownership of data, which has to come from malloc or aligned_alloc
+RomImage* rom_image_from_buffer(u8* data, usize size) {
+	call_once(&cache_once, cache_init);
+
+	RomImage* self = calloc(1, sizeof(RomImage));
+	if (!self) {
+		return NULL;
+	}
+	self->data = data;
+	self->size = size;
+	self->refs = 1;
+	return self;
+}
+
+// Another reference for a cart copied from the one holding this
+RomImage* rom_image_retain(RomImage* self) {
+	mtx_lock(&cache_lock);
+	self->refs += 1;
+	mtx_unlock(&cache_lock);
+	return self;
+}
+
+void rom_image_release(RomImage* self) {
+	mtx_lock(&cache_lock);
+	bool last = --self->refs == 0;
+	if (last && self->path) {
+		RomImage** link = &cache;
+		while (*link != self) {
+			link = &(*link)->next;
+		}
+		*link = self->next;
+	}
+	mtx_unlock(&cache_lock);
+	if (!last) {
+		return;
+	}
+
+	if (self->streamed) {
+		atomic_store_explicit(&self->cancel, true, memory_order_relaxed);
+		thrd_join(self->loader, NULL);
+		mtx_destroy(&self->lock);
+		cnd_destroy(&self->cond);
+	}
+
+#ifdef HAVE_MMAP
+	if (self->mapped) {
+		munmap((void*) self->data, self->size);
+	}
+	else {
+		free((void*) self->data);
+	}
+#else
+	free((void*) self->data);
+#endif
+	free(self->path);
+	free(self);
+}
+
+const u8* rom_image_data(const RomImage* self) {
+	return self->data;
+}
+
+usize rom_image_size(const RomImage* self) {
+	return self->size;
+}
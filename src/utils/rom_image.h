@@ -0,0 +1,16 @@
+#pragma once
+#include "types.h"
+
+// Read-only rom contents shared by every cart loaded from the same file. Regular files are
+// mapped and cached per path and inode, so any number of instances use one set of pages.
+// gzip and zip files are decompressed on a thread, so the size is known right away but the
+// contents only after rom_image_wait.
+typedef struct RomImage RomImage;
+
+RomImage* rom_image_open(const char* path);
+RomImage* rom_image_from_buffer(u8* data, usize size);
+RomImage* rom_image_retain(RomImage* self);
+void rom_image_release(RomImage* self);
+bool rom_image_wait(RomImage* self, usize size);
+const u8* rom_image_data(const RomImage* self);
+usize rom_image_size(const RomImage* self);
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+#include "save_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include <time.h>
+
+#if defined(__unix__) || defined(__unix) || defined(__linux__) || defined(__linux) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Games write their saves over several frames, waiting a bit collects them into one msync
+#define FLUSH_INTERVAL_MS 1000
+
+#ifdef HAVE_MMAP
+
+struct SaveFile {
+	int fd;
+	u8* data;
+	usize size;
+	usize page_size;
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t cond;
+	// Not yet flushed, empty when start >= end
+	usize dirty_start;
+	usize dirty_end;
+	bool closing;
+};
+
+static bool save_file_msync(SaveFile* self, usize start, usize end) {
+	// msync wants a page aligned address
+	start &= ~(self->page_size - 1);
+	if (msync(self->data + start, end - start, MS_SYNC) != 0) {
+		fprintf(stderr, "warning: failed to write the save file\n");
+		return false;
+	}
+	return true;
+}
+
+static int save_file_main(void* arg) {
+	SaveFile* self = (SaveFile*) arg;
+
+	mtx_lock(&self->lock);
+	while (true) {
+		while (self->dirty_start >= self->dirty_end && !self->closing) {
+			cnd_wait(&self->cond, &self->lock);
+		}
+		if (self->closing) {
+			break;
+		}
+
+		struct timespec deadline;
+		timespec_get(&deadline, TIME_UTC);
+		deadline.tv_sec += FLUSH_INTERVAL_MS / 1000;
+		deadline.tv_nsec += (FLUSH_INTERVAL_MS % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		while (!self->closing && cnd_timedwait(&self->cond, &self->lock, &deadline) == thrd_success) {}
+
+		usize start = self->dirty_start;
+		usize end = self->dirty_end;
+		self->dirty_start = 0;
+		self->dirty_end = 0;
+		mtx_unlock(&self->lock);
+		save_file_msync(self, start, end);
+		mtx_lock(&self->lock);
+	}
+	mtx_unlock(&self->lock);
+	return 0;
+}
+
+// Maps path, creating it or growing it with zeroes to at least size bytes. existing_size
+// gets the size the file had before, 0 if it was just created.
+SaveFile* save_file_open(const char* path, usize size, usize* existing_size) {
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		return NULL;
+	}
+	struct stat s;
+	if (fstat(fd, &s) != 0 || ((usize) s.st_size < size && ftruncate(fd, (off_t) size) != 0)) {
+		close(fd);
+		return NULL;
+	}
+	void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	SaveFile* self = calloc(1, sizeof(SaveFile));
+	if (!self) {
+		munmap(data, size);
+		close(fd);
+		return NULL;
+	}
+	self->fd = fd;
+	self->data = data;
+	self->size = size;
+	self->page_size = (usize) sysconf(_SC_PAGESIZE);
+
+	mtx_init(&self->lock, mtx_plain);
+	cnd_init(&self->cond);
+	if (thrd_create(&self->thread, save_file_main, self) != thrd_success) {
+		mtx_destroy(&self->lock);
+		cnd_destroy(&self->cond);
+		munmap(data, size);
+		close(fd);
+		free(self);
+		return NULL;
+	}
+	*existing_size = (usize) s.st_size;
+	return self;
+}
+
+u8* save_file_data(SaveFile* self) {
+	return self->data;
+}
+
+// Only merges the range into the pending one, never waits for a flush in progress
+void save_file_mark_dirty(SaveFile* self, usize start, usize end) {
+	mtx_lock(&self->lock);
+	if (self->dirty_start >= self->dirty_end) {
+		self->dirty_start = start;
+		self->dirty_end = end;
+		cnd_signal(&self->cond);
+	}
+	else {
+		if (start < self->dirty_start) {
+			self->dirty_start = start;
+		}
+		if (end > self->dirty_end) {
+			self->dirty_end = end;
+		}
+	}
+	mtx_unlock(&self->lock);
+}
+
+// Writes everything out now, on the calling thread
+bool save_file_sync(SaveFile* self) {
+	mtx_lock(&self->lock);
+	self->dirty_start = 0;
+	self->dirty_end = 0;
+	mtx_unlock(&self->lock);
+	return save_file_msync(self, 0, self->size);
+}
+
+bool save_file_close(SaveFile* self) {
+	mtx_lock(&self->lock);
+	self->closing = true;
+	cnd_signal(&self->cond);
+	mtx_unlock(&self->lock);
+	thrd_join(self->thread, NULL);
+
+	bool ok = save_file_msync(self, 0, self->size);
+	munmap(self->data, self->size);
+	if (close(self->fd) != 0) {
+		ok = false;
+	}
+	mtx_destroy(&self->lock);
+	cnd_destroy(&self->cond);
+	free(self);
+	return ok;
+}
+
+#else
+
+// Without mmap the caller keeps the ram in memory and writes the file itself
+
+struct SaveFile {
+	u8 unused;
+};
+
+SaveFile* save_file_open(const char*, usize, usize*) {
+	return NULL;
+}
+
+u8* save_file_data(SaveFile*) {
+	return NULL;
+}
+
+void save_file_mark_dirty(SaveFile*, usize, usize) {}
+
+bool save_file_sync(SaveFile*) {
+	return false;
+}
+
+bool save_file_close(SaveFile*) {
+	return false;
+}
+
+#endif
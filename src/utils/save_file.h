@@ -0,0 +1,13 @@
+#pragma once
+#include "types.h"
+
+// Battery ram kept in a shared mapping of the save file. Written ranges are handed over
+// with save_file_mark_dirty and a background thread msyncs them, at most FLUSH_INTERVAL_MS
+// after they were marked, so the emulation thread never waits on the disk.
+typedef struct SaveFile SaveFile;
+
+SaveFile* save_file_open(const char* path, usize size, usize* existing_size);
+u8* save_file_data(SaveFile* self);
+void save_file_mark_dirty(SaveFile* self, usize start, usize end);
+bool save_file_sync(SaveFile* self);
+bool save_file_close(SaveFile* self);
@@ -0,0 +1,149 @@
+#include "thread_pool.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <threads.h>
+
+#if defined(__unix__) || defined(__unix) || defined(__linux__) || defined(__linux) || defined(__APPLE__)
+#define HAVE_SYSCONF
+#include <unistd.h>
+#endif
+
+// A worker's remaining tasks, begin in the low half and end in the high one. The owner takes
+// from the front and thieves from the back, both with one compare exchange on the pair.
+// A non-empty range never comes back once its first task is taken, so there is no ABA.
+typedef struct {
+	alignas(64) _Atomic u64 range;
+} Queue;
+
+typedef struct {
+	Queue* queues;
+	u32 threads;
+	ThreadPoolTask fn;
+	void* arg;
+} Pool;
+
+typedef struct {
+	Pool* pool;
+	u32 index;
+} Worker;
+
+static u64 range_pack(u32 begin, u32 end) {
+	return (u64) end << 32 | begin;
+}
+
+static bool queue_pop(Queue* self, u32* task) {
+	u64 range = atomic_load_explicit(&self->range, memory_order_relaxed);
+	while ((u32) range < (u32) (range >> 32)) {
+		if (atomic_compare_exchange_weak_explicit(&self->range, &range, range + 1, memory_order_relaxed, memory_order_relaxed)) {
+			*task = (u32) range;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Takes the back half, or the last task if there is only one left
+static bool queue_steal(Queue* self, u32* begin, u32* end) {
+	u64 range = atomic_load_explicit(&self->range, memory_order_relaxed);
+	while ((u32) range < (u32) (range >> 32)) {
+		u32 victim_begin = (u32) range;
+		u32 victim_end = (u32) (range >> 32);
+		u32 mid = victim_begin + (victim_end - victim_begin) / 2;
+		if (atomic_compare_exchange_weak_explicit(
+				&self->range, &range, range_pack(victim_begin, mid), memory_order_relaxed, memory_order_relaxed)) {
+			*begin = mid;
+			*end = victim_end;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Runs until every queue is empty. Tasks a thief took but hasn't published yet aren't
+// visible, that's fine as the thief runs them itself.
+static int pool_worker(void* arg) {
+	Worker* worker = arg;
+	Pool* pool = worker->pool;
+	Queue* own = &pool->queues[worker->index];
+
+	bool has_work = true;
+	while (has_work) {
+		u32 task;
+		if (queue_pop(own, &task)) {
+			pool->fn(pool->arg, worker->index, task);
+			continue;
+		}
+
+		// Starting after our own index spreads the thieves over the victims
+		has_work = false;
+		for (u32 i = 1; i < pool->threads && !has_work; ++i) {
+			u32 begin;
+			u32 end;
+			if (queue_steal(&pool->queues[(worker->index + i) % pool->threads], &begin, &end)) {
+				atomic_store_explicit(&own->range, range_pack(begin, end), memory_order_relaxed);
+				has_work = true;
+			}
+		}
+	}
+	return 0;
+}
+
+// Online cores, 1 where that can't be found out
+u32 thread_pool_default_size() {
+#ifdef HAVE_SYSCONF
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (u32) cores : 1;
+#else
+	return 1;
+#endif
+}
+
+// Calls fn once for every task in 0..tasks-1 and returns when all are done. The calling
+// thread is worker 0. Only fails if nothing could be allocated, threads that can't be
+// started just leave their share to the others.
+bool thread_pool_run(u32 threads, u32 tasks, ThreadPoolTask fn, void* arg) {
+	if (!tasks) {
+		return true;
+	}
+	if (threads > tasks) {
+		threads = tasks;
+	}
+	if (!threads) {
+		threads = 1;
+	}
+
+	Pool pool = {.threads = threads, .fn = fn, .arg = arg};
+	pool.queues = aligned_alloc(alignof(Queue), threads * sizeof(Queue));
+	Worker* workers = malloc(threads * sizeof(Worker));
+	thrd_t* handles = malloc(threads * sizeof(thrd_t));
+	bool* started = calloc(threads, sizeof(bool));
+	if (!pool.queues || !workers || !handles || !started) {
+		free(pool.queues);
+		free(workers);
+		free(handles);
+		free(started);
+		return false;
+	}
+
+	for (u32 i = 0; i < threads; ++i) {
+		u32 begin = (u32) ((u64) tasks * i / threads);
+		u32 end = (u32) ((u64) tasks * (i + 1) / threads);
+		atomic_init(&pool.queues[i].range, range_pack(begin, end));
+		workers[i] = (Worker) {.pool = &pool, .index = i};
+	}
+	for (u32 i = 1; i < threads; ++i) {
+		started[i] = thrd_create(&handles[i], pool_worker, &workers[i]) == thrd_success;
+	}
+	pool_worker(&workers[0]);
+	for (u32 i = 1; i < threads; ++i) {
+		if (started[i]) {
+			thrd_join(handles[i], NULL);
+		}
+	}
+
+	free(pool.queues);
+	free(workers);
+	free(handles);
+	free(started);
+	return true;
+}
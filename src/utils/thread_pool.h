@@ -0,0 +1,12 @@
+#pragma once
+#include "types.h"
+
+// Runs a fixed number of tasks on a set of threads. Every worker starts with an even share
+// of the task indices and once its own run out steals half of what another has left, so
+// slow tasks even out without all the workers taking turns on one shared queue.
+
+// worker is below the thread count, for per-worker scratch state
+typedef void (*ThreadPoolTask)(void* arg, u32 worker, u32 task);
+
+u32 thread_pool_default_size();
+bool thread_pool_run(u32 threads, u32 tasks, ThreadPoolTask fn, void* arg);
@@ -0,0 +1,30 @@
+#include "triple_buffer.h"
+
+#define FRESH (1 << 2)
+
+void triple_buffer_init(TripleBuffer* self) {
+	self->back = 0;
+	atomic_init(&self->middle, 1);
+	self->front = 2;
+}
+
+// Producer side, the buffer published but not yet taken by the consumer or -1
+i8 triple_buffer_pending(TripleBuffer* self) {
+	unsigned int middle = atomic_load_explicit(&self->middle, memory_order_acquire);
+	return middle & FRESH ? (i8) (middle & ~FRESH) : -1;
+}
+
+void triple_buffer_publish(TripleBuffer* self) {
+	unsigned int old = atomic_exchange_explicit(&self->middle, self->back | FRESH, memory_order_acq_rel);
+	self->back = old & ~FRESH;
+}
+
+// Consumer side, returns true if front now holds a newer buffer
+bool triple_buffer_acquire(TripleBuffer* self) {
+	if (!(atomic_load_explicit(&self->middle, memory_order_relaxed) & FRESH)) {
+		return false;
+	}
+	unsigned int old = atomic_exchange_explicit(&self->middle, self->front, memory_order_acq_rel);
+	self->front = old & ~FRESH;
+	return true;
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "types.h"
+#include <stdatomic.h>
+
+// Lock-free handoff of the latest of three buffers from one producer to one consumer.
+// The producer always owns `back`, the consumer `front`, the third one is in between.
+typedef struct {
+	atomic_uint middle;
+	u8 back;
+	u8 front;
+} TripleBuffer;
+
+void triple_buffer_init(TripleBuffer* self);
+i8 triple_buffer_pending(TripleBuffer* self);
+void triple_buffer_publish(TripleBuffer* self);
+bool triple_buffer_acquire(TripleBuffer* self);
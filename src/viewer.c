@@ -0,0 +1,204 @@
+#include "viewer.h"
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+// The tile/sprite viewers are generated on their own thread from a copy of vram/oam,
+// the emulation thread only takes that copy (at most max_fps times per second)
+// and uploads the image once it changed.
+
+struct Viewer {
+	thrd_t thread;
+	mtx_t lock;
+	cnd_t cond;
+	mtx_t image_lock;
+	bool stop;
+	bool pending;
+
+	// Protected by lock
+	PpuTileData submitted;
+	bool enabled[VIEWER_MAX];
+
+	// Owned by the viewer thread
+	PpuTileData cur;
+	PpuTileData prev;
+	bool prev_valid[VIEWER_MAX];
+
+	// Protected by image_lock
+	u32* images[VIEWER_MAX];
+	bool updated[VIEWER_MAX];
+
+	u64 interval_ns;
+	// Reset by the presentation thread, read by the emulation thread
+	_Atomic(u64) last_submit_ns;
+};
+
+static const u32 VIEWER_WIDTHS[VIEWER_MAX] = {
+	[VIEWER_TILES] = TILE_VIEWER_WIDTH,
+	[VIEWER_SPRITES] = SPRITE_VIEWER_WIDTH
+};
+
+static const u32 VIEWER_HEIGHTS[VIEWER_MAX] = {
+	[VIEWER_TILES] = TILE_VIEWER_HEIGHT,
+	[VIEWER_SPRITES] = SPRITE_VIEWER_HEIGHT
+};
+
+static u64 now_ns() {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (u64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int viewer_main(void* arg) {
+	Viewer* self = (Viewer*) arg;
+
+	while (true) {
+		bool enabled[VIEWER_MAX];
+
+		mtx_lock(&self->lock);
+		while (!self->pending && !self->stop) {
+			cnd_wait(&self->cond, &self->lock);
+		}
+		if (self->stop) {
+			mtx_unlock(&self->lock);
+			break;
+		}
+		self->cur = self->submitted;
+		for (u8 i = 0; i < VIEWER_MAX; ++i) {
+			enabled[i] = self->enabled[i];
+			if (!enabled[i]) {
+				self->prev_valid[i] = false;
+			}
+		}
+		self->pending = false;
+		mtx_unlock(&self->lock);
+
+		mtx_lock(&self->image_lock);
+		if (enabled[VIEWER_TILES]) {
+			ppu_generate_tile_map(
+				&self->cur,
+				self->prev_valid[VIEWER_TILES] ? &self->prev : NULL,
+				TILE_VIEWER_WIDTH,
+				TILE_VIEWER_HEIGHT,
+				self->images[VIEWER_TILES]);
+		}
+		if (enabled[VIEWER_SPRITES]) {
+			ppu_generate_sprite_map(
+				&self->cur,
+				self->prev_valid[VIEWER_SPRITES] ? &self->prev : NULL,
+				SPRITE_VIEWER_WIDTH,
+				SPRITE_VIEWER_HEIGHT,
+				self->images[VIEWER_SPRITES]);
+		}
+		for (u8 i = 0; i < VIEWER_MAX; ++i) {
+			if (enabled[i]) {
+				self->updated[i] |= !self->prev_valid[i] || memcmp(&self->cur, &self->prev, sizeof(PpuTileData)) != 0;
+				self->prev_valid[i] = true;
+			}
+		}
+		mtx_unlock(&self->image_lock);
+
+		self->prev = self->cur;
+	}
+
+	return 0;
+}
+
+Viewer* viewer_new(u32 max_fps) {
+	Viewer* self = calloc(1, sizeof(Viewer));
+	if (!self) {
+		return NULL;
+	}
+
+	for (u8 i = 0; i < VIEWER_MAX; ++i) {
+		self->images[i] = calloc(1, VIEWER_WIDTHS[i] * VIEWER_HEIGHTS[i] * 4);
+		if (!self->images[i]) {
+			for (u8 j = 0; j < i; ++j) {
+				free(self->images[j]);
+			}
+			free(self);
+			return NULL;
+		}
+	}
+	self->interval_ns = 1000000000 / max_fps;
+
+	mtx_init(&self->lock, mtx_plain);
+	mtx_init(&self->image_lock, mtx_plain);
+	cnd_init(&self->cond);
+	if (thrd_create(&self->thread, viewer_main, self) != thrd_success) {
+		mtx_destroy(&self->lock);
+		mtx_destroy(&self->image_lock);
+		cnd_destroy(&self->cond);
+		for (u8 i = 0; i < VIEWER_MAX; ++i) {
+			free(self->images[i]);
+		}
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void viewer_free(Viewer* self) {
+	mtx_lock(&self->lock);
+	self->stop = true;
+	cnd_signal(&self->cond);
+	mtx_unlock(&self->lock);
+	thrd_join(self->thread, NULL);
+
+	mtx_destroy(&self->lock);
+	mtx_destroy(&self->image_lock);
+	cnd_destroy(&self->cond);
+	for (u8 i = 0; i < VIEWER_MAX; ++i) {
+		free(self->images[i]);
+	}
+	free(self);
+}
+
+void viewer_set_enabled(Viewer* self, ViewerKind kind, bool enabled) {
+	mtx_lock(&self->lock);
+	self->enabled[kind] = enabled;
+	mtx_unlock(&self->lock);
+	// Submit right away so a newly opened window doesn't wait for the next interval
+	atomic_store_explicit(&self->last_submit_ns, 0, memory_order_relaxed);
+}
+
+void viewer_submit(Viewer* self, const Ppu* ppu) {
+	u64 now = now_ns();
+	if (now - atomic_load_explicit(&self->last_submit_ns, memory_order_relaxed) < self->interval_ns) {
+		return;
+	}
+
+	mtx_lock(&self->lock);
+	if (!self->enabled[VIEWER_TILES] && !self->enabled[VIEWER_SPRITES]) {
+		mtx_unlock(&self->lock);
+		return;
+	}
+	// Still busy with the previous one, try again next frame
+	if (!self->pending) {
+		ppu_copy_tile_data(ppu, &self->submitted);
+		self->pending = true;
+		atomic_store_explicit(&self->last_submit_ns, now, memory_order_relaxed);
+		cnd_signal(&self->cond);
+	}
+	mtx_unlock(&self->lock);
+}
+
+// Returns the image if it changed since it was last acquired, must be followed by viewer_release
+const u32* viewer_acquire(Viewer* self, ViewerKind kind) {
+	if (mtx_trylock(&self->image_lock) != thrd_success) {
+		return NULL;
+	}
+	if (!self->updated[kind]) {
+		mtx_unlock(&self->image_lock);
+		return NULL;
+	}
+	self->updated[kind] = false;
+	return self->images[kind];
+}
+
+void viewer_release(Viewer* self) {
+	mtx_unlock(&self->image_lock);
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "ppu.h"
+
+#define TILE_VIEWER_WIDTH (128 * 4)
+#define TILE_VIEWER_HEIGHT (128 * 4)
+
+#define SPRITE_VIEWER_WIDTH (128 * 4)
+#define SPRITE_VIEWER_HEIGHT (128 * 4)
+
+typedef enum {
+	VIEWER_TILES,
+	VIEWER_SPRITES,
+	VIEWER_MAX
+} ViewerKind;
+
+typedef struct Viewer Viewer;
+
+Viewer* viewer_new(u32 max_fps);
+void viewer_free(Viewer* self);
+void viewer_set_enabled(Viewer* self, ViewerKind kind, bool enabled);
+void viewer_submit(Viewer* self, const Ppu* ppu);
+const u32* viewer_acquire(Viewer* self, ViewerKind kind);
+void viewer_release(Viewer* self);
@@ -0,0 +1,183 @@
+#include "wav_writer.h"
+#include "utils/ring_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+
+// 16-bit PCM WAV output. Samples go through a ring to a thread that converts and writes
+// them, the producer only waits if the disk falls a whole second behind.
+
+#define HEADER_SIZE 44
+// Samples converted and written at once
+#define CHUNK 4096
+
+struct WavWriter {
+	FILE* file;
+	u32 sample_rate;
+	u16 channels;
+	RingBuffer ring;
+	thrd_t thread;
+	mtx_t lock;
+	// Signalled when samples were added to the ring or it is closing, and when space was freed
+	cnd_t data_cond;
+	cnd_t space_cond;
+	bool closing;
+	bool failed;
+	u64 data_size;
+};
+
+static void put_u16(u8* out, u16 value) {
+	out[0] = (u8) value;
+	out[1] = (u8) (value >> 8);
+}
+
+static void put_u32(u8* out, u32 value) {
+	put_u16(out, (u16) value);
+	put_u16(out + 2, (u16) (value >> 16));
+}
+
+static bool wav_writer_write_header(WavWriter* self) {
+	// The sizes saturate, players cope with that better than with a wrapped size
+	u32 data_size = self->data_size > 0xFFFFFFFF - HEADER_SIZE ? 0xFFFFFFFF - HEADER_SIZE : (u32) self->data_size;
+	u16 block_align = self->channels * 2;
+
+	u8 header[HEADER_SIZE] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' '};
+	put_u32(header + 4, data_size + HEADER_SIZE - 8);
+	put_u32(header + 16, 16);
+	// PCM
+	put_u16(header + 20, 1);
+	put_u16(header + 22, self->channels);
+	put_u32(header + 24, self->sample_rate);
+	put_u32(header + 28, self->sample_rate * block_align);
+	put_u16(header + 32, block_align);
+	put_u16(header + 34, 16);
+	header[36] = 'd';
+	header[37] = 'a';
+	header[38] = 't';
+	header[39] = 'a';
+	put_u32(header + 40, data_size);
+
+	return fseek(self->file, 0, SEEK_SET) == 0 && fwrite(header, HEADER_SIZE, 1, self->file) == 1;
+}
+
+static int wav_writer_main(void* arg) {
+	WavWriter* self = (WavWriter*) arg;
+
+	f32 samples[CHUNK];
+	u8 pcm[CHUNK * 2];
+	while (true) {
+		mtx_lock(&self->lock);
+		while (!ring_buffer_size(&self->ring) && !self->closing) {
+			cnd_wait(&self->data_cond, &self->lock);
+		}
+		bool closing = self->closing;
+		mtx_unlock(&self->lock);
+
+		u32 count;
+		while ((count = ring_buffer_read(&self->ring, samples, CHUNK))) {
+			mtx_lock(&self->lock);
+			cnd_signal(&self->space_cond);
+			mtx_unlock(&self->lock);
+
+			for (u32 i = 0; i < count; ++i) {
+				f32 sample = samples[i] * 32767.0f;
+				if (sample > 32767.0f) {
+					sample = 32767.0f;
+				}
+				else if (sample < -32768.0f) {
+					sample = -32768.0f;
+				}
+				i32 value = (i32) (sample < 0 ? sample - 0.5f : sample + 0.5f);
+				put_u16(pcm + i * 2, (u16) value);
+			}
+			if (!self->failed && fwrite(pcm, count * 2, 1, self->file) != 1) {
+				fprintf(stderr, "warning: failed to write wav data\n");
+				self->failed = true;
+			}
+			self->data_size += count * 2;
+		}
+
+		// Only after the ring was drained, everything written before closing is in it
+		if (closing) {
+			break;
+		}
+	}
+	return 0;
+}
+
+WavWriter* wav_writer_new(const char* path, u32 sample_rate, u16 channels) {
+	WavWriter* self = calloc(1, sizeof(WavWriter));
+	if (!self) {
+		return NULL;
+	}
+	self->sample_rate = sample_rate;
+	self->channels = channels;
+
+	self->file = fopen(path, "wb");
+	if (!self->file) {
+		free(self);
+		return NULL;
+	}
+	// Placeholder sizes until close
+	if (!wav_writer_write_header(self) || !ring_buffer_init(&self->ring, sample_rate * channels)) {
+		fclose(self->file);
+		free(self);
+		return NULL;
+	}
+
+	mtx_init(&self->lock, mtx_plain);
+	cnd_init(&self->data_cond);
+	cnd_init(&self->space_cond);
+	if (thrd_create(&self->thread, wav_writer_main, self) != thrd_success) {
+		mtx_destroy(&self->lock);
+		cnd_destroy(&self->data_cond);
+		cnd_destroy(&self->space_cond);
+		ring_buffer_free(&self->ring);
+		fclose(self->file);
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+// Interleaved frames, blocks only if the writer thread is a whole ring behind
+void wav_writer_write(WavWriter* self, const f32* samples, u32 frames) {
+	u32 count = frames * self->channels;
+	while (true) {
+		u32 written = ring_buffer_write(&self->ring, samples, count);
+		samples += written;
+		count -= written;
+
+		mtx_lock(&self->lock);
+		cnd_signal(&self->data_cond);
+		if (!count) {
+			mtx_unlock(&self->lock);
+			break;
+		}
+		while (ring_buffer_size(&self->ring) == self->ring.capacity) {
+			cnd_wait(&self->space_cond, &self->lock);
+		}
+		mtx_unlock(&self->lock);
+	}
+}
+
+// Writes out everything still buffered and finishes the header, returns false if any write failed
+bool wav_writer_close(WavWriter* self) {
+	mtx_lock(&self->lock);
+	self->closing = true;
+	cnd_signal(&self->data_cond);
+	mtx_unlock(&self->lock);
+	thrd_join(self->thread, NULL);
+
+	bool ok = !self->failed && wav_writer_write_header(self);
+	if (fclose(self->file) != 0) {
+		ok = false;
+	}
+
+	mtx_destroy(&self->lock);
+	cnd_destroy(&self->data_cond);
+	cnd_destroy(&self->space_cond);
+	ring_buffer_free(&self->ring);
+	free(self);
+	return ok;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "types.h"
+
+typedef struct WavWriter WavWriter;
+
+WavWriter* wav_writer_new(const char* path, u32 sample_rate, u16 channels);
+void wav_writer_write(WavWriter* self, const f32* samples, u32 frames);
+bool wav_writer_close(WavWriter* self);